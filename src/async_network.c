@@ -22,14 +22,17 @@
  * SOFTWARE.
  */
 
+#define _GNU_SOURCE             // for recvmmsg() and sendmmsg()
 #include "async_network.h"
 #include <glib.h>
 #include <stdio.h>
 #include <pthread.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <event2/event.h>
 #include <event2/util.h>
@@ -44,20 +47,136 @@
 #include "ppb_message_loop.h"
 
 
-static struct event_base *event_b = NULL;
-static struct evdns_base *evdns_b = NULL;
-static GHashTable        *tasks_ht = NULL;
-static pthread_mutex_t    lock;
+#define DEFAULT_NETWORK_THREADS     2
+#define MAX_NETWORK_THREADS         8
+#define UDP_RING_SLOTS              16
+#define UDP_SLOT_SIZE               (64 * 1024)     // largest possible datagram
+#define DNS_CACHE_MAX_ENTRIES       256
+#define DNS_CACHE_MAX_TTL           3600            // seconds
+#define DNS_NEGATIVE_TTL            30              // seconds, for names without records
+
+struct network_worker_s {
+    struct event_base  *base;
+    struct event       *keepalive;      ///< keeps loop running while there are no sockets
+};
+
+struct task_queue_s {
+    struct async_network_task_s *head;
+    struct async_network_task_s *tail;
+};
+
+// datagrams received ahead of RecvFrom calls
+struct udp_ring_s {
+    uint8_t                        *data;       ///< UDP_RING_SLOTS slots, allocated on first use
+    uint32_t                        len[UDP_RING_SLOTS];
+    struct PP_NetAddress_Private    from[UDP_RING_SLOTS];
+    uint32_t                        head;
+    uint32_t                        count;
+};
+
+// Socket state, lives from the first operation on a socket until it's disconnected. All events
+// of a socket belong to the same worker, so their handlers never run concurrently.
+struct network_socket_s {
+    int                             sock;
+    struct network_worker_s        *worker;
+    pthread_mutex_t                 lock;
+    struct event                   *read_ev;    ///< persistent, armed while read_q is not empty
+    struct event                   *write_ev;   ///< persistent, armed while write_q is not empty
+    struct task_queue_s             read_q;
+    struct task_queue_s             write_q;
+    int                             read_armed;
+    int                             write_armed;
+    struct async_network_task_s    *connect_task;   ///< connect waiting for completion
+    uint32_t                        immediate_count;    ///< operations completed without waiting
+    uint32_t                        queued_count;       ///< operations waited for readiness
+    struct udp_ring_s               ring;
+    int64_t                         create_time;
+    uint32_t                        packets_received;
+    uint32_t                        packets_sent;
+    uint32_t                        recv_calls;         ///< recvmmsg() calls
+    uint32_t                        send_calls;         ///< sendmmsg() calls
+};
+
+struct dns_cache_entry_s {
+    int                 result;
+    int                 count;
+    void               *addrs;
+    int64_t             expire_time;
+};
+
+struct dns_request_s {
+    char               *key;
+    evdns_callback_type callback;
+    void               *arg;
+};
+
+struct connect_race_s;
+
+struct connect_attempt_s {
+    int                     fd;
+    int                     is_own_socket;  ///< |fd| is the plugin's socket itself
+    struct event           *ev;
+    struct connect_race_s  *race;
+};
+
+// Connection race as described in RFC 8305. Addresses of both families are tried in turns, each
+// attempt gets a head start before the next one begins, and the first to connect wins. Apart
+// from setup, it's only touched from the worker its socket belongs to.
+struct connect_race_s {
+    struct async_network_task_s    *task;
+    struct event_base              *base;
+    char                           *host;
+    uint16_t                        port;
+    int                             ref_count;
+    int                             finished;
+    int                             started;            ///< connection attempts began
+    int                             pending_answers;    ///< DNS queries not answered yet
+    GQueue                          addrs_v6;           ///< of struct PP_NetAddress_Private
+    GQueue                          addrs_v4;
+    int                             prefer_v4;          ///< family of the next attempt
+    GList                          *attempts;           ///< of struct connect_attempt_s
+    struct event                   *timer;              ///< resolution or attempt delay
+    unsigned int                    attempt_count;
+    int                             last_error;
+};
+
+struct dns_answer_s {
+    struct connect_race_s  *race;
+    int                     result;
+    char                    type;
+    int                     count;
+    void                   *addrs;
+};
+
+static struct network_worker_s  workers[MAX_NETWORK_THREADS];
+static unsigned int             worker_count = 0;
+static unsigned int             next_worker = 0;
+static struct evdns_base       *evdns_b = NULL;
+static GHashTable              *sockets_ht = NULL;  // sock -> struct network_socket_s
+static pthread_mutex_t          lock;
+static pthread_once_t           network_once = PTHREAD_ONCE_INIT;
+static GHashTable              *dns_cache_ht = NULL;    // "type:host" -> struct dns_cache_entry_s
+static pthread_mutex_t          dns_cache_lock;
 
 static const struct timeval connect_timeout = { .tv_sec =  60, .tv_usec = 0 };
+static const struct timeval keepalive_interval = { .tv_sec = 3600, .tv_usec = 0 };
+static const struct timeval zero_timeout = { .tv_sec = 0, .tv_usec = 0 };
+static const struct timeval resolution_delay = { .tv_sec = 0, .tv_usec = 50 * 1000 };
+static const struct timeval attempt_delay = { .tv_sec = 0, .tv_usec = 250 * 1000 };
+
+static
+void
+dns_cache_entry_free(gpointer data);
 
 static
 void
 __attribute__((constructor))
 async_network_constructor(void)
 {
-    tasks_ht = g_hash_table_new(g_direct_hash, g_direct_equal);
+    sockets_ht = g_hash_table_new(g_direct_hash, g_direct_equal);
+    dns_cache_ht = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, dns_cache_entry_free);
     pthread_mutex_init(&lock, NULL);
+    pthread_mutex_init(&dns_cache_lock, NULL);
 }
 
 static
@@ -65,8 +184,10 @@ void
 __attribute__((destructor))
 async_network_destructor(void)
 {
-    g_hash_table_unref(tasks_ht);
+    g_hash_table_unref(sockets_ht);
+    g_hash_table_unref(dns_cache_ht);
     pthread_mutex_destroy(&lock);
+    pthread_mutex_destroy(&dns_cache_lock);
 }
 
 static
@@ -99,16 +220,6 @@ get_pp_errno(void)
     return retval;
 }
 
-static
-void
-add_event_mapping(struct async_network_task_s *task, struct event *ev)
-{
-    pthread_mutex_lock(&lock);
-    task->event = ev;
-    g_hash_table_replace(tasks_ht, task, task);
-    pthread_mutex_unlock(&lock);
-}
-
 struct async_network_task_s *
 async_network_task_create(void)
 {
@@ -119,400 +230,1024 @@ static
 void
 task_destroy(struct async_network_task_s *task)
 {
-    pthread_mutex_lock(&lock);
-    g_hash_table_remove(tasks_ht, task);
     if (task->event) {
         event_free(task->event);
         task->event = NULL;
     }
     free(task->host);
     g_slice_free(struct async_network_task_s, task);
-    pthread_mutex_unlock(&lock);
 }
 
 static
 void
-handle_tcp_connect_stage3(struct async_network_task_s *task);
+task_complete(struct async_network_task_s *task, int32_t result)
+{
+    ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0, result, 0,
+                                           __func__);
+    task_destroy(task);
+}
 
 static
 void
-handle_tcp_connect_stage4(int sock, short event_flags, void *arg)
+task_queue_push(struct task_queue_s *q, struct async_network_task_s *task)
 {
-    struct async_network_task_s *task = arg;
-    struct pp_tcp_socket_s *ts = pp_resource_acquire(task->resource, PP_RESOURCE_TCP_SOCKET);
-    if (!ts) {
-        trace_warning("%s, tcp socket resource was closed during request (%s:%u)\n", __func__,
-                      task->host, (unsigned int)task->port);
-        free(task->addr);
-        task_destroy(task);
-        return;
-    }
-    char buf[200];
-    socklen_t len = sizeof(buf);
-
-    if (event_flags & EV_TIMEOUT)
-        ts->is_connected = 0;
+    task->next = NULL;
+    if (q->tail)
+        q->tail->next = task;
     else
-        ts->is_connected = (getpeername(ts->sock, (struct sockaddr *)buf, &len) == 0);
+        q->head = task;
+    q->tail = task;
+}
 
-    if (ts->is_connected) {
-        ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0, PP_OK, 0,
-                                               __func__);
-        pp_resource_release(task->resource);
-        free(task->addr);
-        task_destroy(task);
-        return;
+static
+struct async_network_task_s *
+task_queue_pop(struct task_queue_s *q)
+{
+    struct async_network_task_s *task = q->head;
+
+    if (task) {
+        q->head = task->next;
+        if (!q->head)
+            q->tail = NULL;
+        task->next = NULL;
     }
 
-    // try other addresses, one by one
-    task->addr_ptr++;
-    if (task->addr_ptr < task->addr_count) {
-        pp_resource_release(task->resource);
-        handle_tcp_connect_stage3(task);
-        return;
+    return task;
+}
+
+static
+void
+handle_socket_readable(int sock, short event_flags, void *arg);
+
+static
+void
+handle_socket_writable(int sock, short event_flags, void *arg);
+
+// Finds state of a socket and returns it locked. If |create| is set, missing state is created.
+static
+struct network_socket_s *
+lock_socket(int sock, int create)
+{
+    pthread_mutex_lock(&lock);
+    struct network_socket_s *ns = g_hash_table_lookup(sockets_ht, GINT_TO_POINTER(sock));
+
+    if (!ns && create) {
+        ns = g_slice_new0(struct network_socket_s);
+        ns->sock = sock;
+        ns->create_time = g_get_monotonic_time();
+
+        // spread sockets over workers
+        ns->worker = &workers[next_worker];
+        next_worker = (next_worker + 1) % worker_count;
+
+        pthread_mutex_init(&ns->lock, NULL);
+        ns->read_ev = event_new(ns->worker->base, sock, EV_READ | EV_PERSIST,
+                                handle_socket_readable, ns);
+        ns->write_ev = event_new(ns->worker->base, sock, EV_WRITE | EV_PERSIST,
+                                 handle_socket_writable, ns);
+        g_hash_table_insert(sockets_ht, GINT_TO_POINTER(sock), ns);
     }
 
-    // no addresses left, fail gracefully
-    trace_warning("%s, connection failed to all addresses (%s:%u)\n", __func__, task->host,
-                  (unsigned int)task->port);
-    ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0, get_pp_errno(), 0,
-                                           __func__);
-    pp_resource_release(task->resource);
-    free(task->addr);
-    task_destroy(task);
+    // taken while the table is locked, so disconnect can't free state in between
+    if (ns)
+        pthread_mutex_lock(&ns->lock);
+
+    pthread_mutex_unlock(&lock);
+    return ns;
 }
 
 static
 void
-handle_tcp_connect_stage3(struct async_network_task_s *task)
+unlock_socket(struct network_socket_s *ns)
+{
+    pthread_mutex_unlock(&ns->lock);
+}
+
+static
+int
+would_block(void)
 {
-    int res = -1;
-    if (task->addr_type == DNS_IPv4_A) {
-        struct sockaddr_in sai;
-        memset(&sai, 0, sizeof(sai));
-        sai.sin_family = AF_INET;
-        sai.sin_addr.s_addr = *((uint32_t *)task->addr + task->addr_ptr);
-        sai.sin_port = htons(task->port);
-        res = connect(task->sock, (struct sockaddr *)&sai, sizeof(sai));
-    } else if (task->addr_type == DNS_IPv6_AAAA) {
-        struct sockaddr_in6 sai;
-        memset(&sai, 0, sizeof(sai));
-        sai.sin6_family = AF_INET6;
-        memcpy(&sai.sin6_addr, (char*)task->addr + task->addr_ptr * sizeof(sai.sin6_addr),
-                                                                    sizeof(sai.sin6_addr));
-        sai.sin6_port = htons(task->port);
-        res = connect(task->sock, (struct sockaddr *)&sai, sizeof(sai));
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+// Sends as much of the buffer as socket accepts. Write completes only when the whole buffer is
+// sent, partial writes are continued once socket becomes writable again.
+static
+int
+try_tcp_write(struct async_network_task_s *task)
+{
+    ssize_t ret = 0;
+
+    while (task->bytes_done < task->bufsize) {
+        ret = send(task->sock, task->buffer + task->bytes_done,
+                   task->bufsize - task->bytes_done, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (ret <= 0)
+            break;
+        task->bytes_done += ret;
+    }
+
+    if (task->bytes_done < task->bufsize && ret < 0 && would_block())
+        return -1;
+
+    if (task->bytes_done > 0) {
+        // error, if any, will be reported by the next write
+        task->result = task->bytes_done;
     } else {
-        // handled in stage2
+        task->result = get_pp_errno();
+    }
+
+    return 0;
+}
+
+// Receives as many datagrams as there are free slots in the ring, with a single call.
+// Returns number of datagrams received, or -1 on error.
+static
+int
+fill_udp_ring(struct network_socket_s *ns)
+{
+    struct udp_ring_s *ring = &ns->ring;
+    struct mmsghdr     msgs[UDP_RING_SLOTS];
+    struct iovec       iov[UDP_RING_SLOTS];
+    const uint32_t     free_slots = UDP_RING_SLOTS - ring->count;
+
+    if (!ring->data) {
+        // pages are only touched by datagrams actually received
+        ring->data = malloc(UDP_RING_SLOTS * UDP_SLOT_SIZE);
+        if (!ring->data) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    memset(msgs, 0, free_slots * sizeof(msgs[0]));
+    for (uint32_t k = 0; k < free_slots; k ++) {
+        const uint32_t slot = (ring->head + ring->count + k) % UDP_RING_SLOTS;
+
+        iov[k].iov_base = ring->data + slot * UDP_SLOT_SIZE;
+        iov[k].iov_len = UDP_SLOT_SIZE;
+        msgs[k].msg_hdr.msg_iov = &iov[k];
+        msgs[k].msg_hdr.msg_iovlen = 1;
+        msgs[k].msg_hdr.msg_name = ring->from[slot].data;
+        msgs[k].msg_hdr.msg_namelen = sizeof(ring->from[slot].data);
+    }
+
+    int ret = recvmmsg(ns->sock, msgs, free_slots, MSG_DONTWAIT, NULL);
+    ns->recv_calls ++;
+    if (ret <= 0)
+        return ret;
+
+    for (int k = 0; k < ret; k ++) {
+        const uint32_t slot = (ring->head + ring->count + k) % UDP_RING_SLOTS;
+
+        ring->len[slot] = msgs[k].msg_len;
+        ring->from[slot].size = msgs[k].msg_hdr.msg_namelen;
+    }
+
+    ring->count += ret;
+    ns->packets_received += ret;
+    return ret;
+}
+
+// Completes RecvFrom with the oldest datagram in the ring, refilling ring if it's empty.
+static
+int
+try_udp_recv(struct network_socket_s *ns, struct async_network_task_s *task)
+{
+    struct udp_ring_s *ring = &ns->ring;
+
+    if (ring->count == 0) {
+        int ret = fill_udp_ring(ns);
+        if (ret < 0 && would_block())
+            return -1;
+
+        if (ret <= 0) {
+            task->netaddr.size = 0;
+            task->result = (ret < 0) ? get_pp_errno() : PP_ERROR_FAILED;
+            return 0;
+        }
+    }
+
+    const uint32_t slot = ring->head;
+    const int32_t  len = MIN(ring->len[slot], (uint32_t)task->bufsize);
+
+    memcpy(task->buffer, ring->data + slot * UDP_SLOT_SIZE, len);
+    task->netaddr = ring->from[slot];
+    task->result = len;
+
+    ring->head = (ring->head + 1) % UDP_RING_SLOTS;
+    ring->count --;
+    return 0;
+}
+
+// Sends consecutive queued SendTo datagrams with a single call. Returns -1 if socket would block.
+static
+int
+try_udp_send_batch(struct network_socket_s *ns, struct task_queue_s *q,
+                   struct task_queue_s *done)
+{
+    struct mmsghdr               msgs[UDP_RING_SLOTS];
+    struct iovec                 iov[UDP_RING_SLOTS];
+    struct async_network_task_s *task = q->head;
+    unsigned int                 n = 0;
+
+    memset(msgs, 0, sizeof(msgs));
+    while (task && task->type == ASYNC_NETWORK_UDP_SEND && n < UDP_RING_SLOTS) {
+        iov[n].iov_base = task->buffer;
+        iov[n].iov_len = task->bufsize;
+        msgs[n].msg_hdr.msg_iov = &iov[n];
+        msgs[n].msg_hdr.msg_iovlen = 1;
+        msgs[n].msg_hdr.msg_name = task->netaddr.data;
+        msgs[n].msg_hdr.msg_namelen = task->netaddr.size;
+        n ++;
+        task = task->next;
+    }
+
+    int ret = sendmmsg(ns->sock, msgs, n, MSG_DONTWAIT | MSG_NOSIGNAL);
+    ns->send_calls ++;
+
+    if (ret < 0) {
+        if (would_block())
+            return -1;
+
+        // first datagram failed, report it; the rest are tried again
+        task = task_queue_pop(q);
+        task->result = get_pp_errno();
+        task_queue_push(done, task);
+        return 0;
+    }
+
+    for (int k = 0; k < ret; k ++) {
+        task = task_queue_pop(q);
+        task->result = msgs[k].msg_len;
+        task_queue_push(done, task);
+    }
+
+    ns->packets_sent += ret;
+    return 0;
+}
+
+// Tries to perform socket operation without blocking. Returns 0 and stores result into
+// |task->result| on completion, or -1 if socket is not ready yet.
+static
+int
+try_socket_io(struct network_socket_s *ns, struct async_network_task_s *task)
+{
+    ssize_t ret;
+
+    switch (task->type) {
+    case ASYNC_NETWORK_TCP_READ:
+        ret = recv(task->sock, task->buffer, task->bufsize, MSG_DONTWAIT);
+        break;
+    case ASYNC_NETWORK_TCP_WRITE:
+        return try_tcp_write(task);
+    case ASYNC_NETWORK_UDP_RECV:
+        return try_udp_recv(ns, task);
+    case ASYNC_NETWORK_UDP_SEND:
+        ret = sendto(task->sock, task->buffer, task->bufsize, MSG_DONTWAIT | MSG_NOSIGNAL,
+                     (struct sockaddr *)task->netaddr.data, task->netaddr.size);
+        if (ret >= 0)
+            ns->packets_sent ++;
+        break;
+    default:
         trace_error("%s, never reached\n", __func__);
+        task->result = PP_ERROR_FAILED;
+        return 0;
     }
 
-    if (res != 0 && errno != EINPROGRESS) {
-        trace_error("%s, res = %d, errno = %d (%s:%u)\n", __func__, res, errno, task->host,
-                    (unsigned int)task->port);
-        ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0, get_pp_errno(),
-                                               0, __func__);
-        free(task->addr);
-        task_destroy(task);
-        return;
+    if (ret < 0 && would_block())
+        return -1;
+
+    task->result = (ret < 0) ? get_pp_errno() : (int32_t)ret;
+    return 0;
+}
+
+// Updates resource with the outcome of a completed operation and calls its callback. Called
+// without socket lock held, as it acquires resource.
+static
+void
+finish_socket_io(struct async_network_task_s *task)
+{
+    if (task->type == ASYNC_NETWORK_TCP_READ && task->result == 0) {
+        struct pp_tcp_socket_s *ts = pp_resource_acquire(task->resource, PP_RESOURCE_TCP_SOCKET);
+        if (ts) {
+            ts->seen_eof = 1;
+            pp_resource_release(task->resource);
+        }
+    } else if (task->type == ASYNC_NETWORK_UDP_RECV) {
+        struct pp_udp_socket_s *us = pp_resource_acquire(task->resource, PP_RESOURCE_UDP_SOCKET);
+        if (us) {
+            us->addr_from = task->netaddr;
+            if (task->result == 0)
+                us->seen_eof = 1;   // TODO: is it needed?
+            pp_resource_release(task->resource);
+        }
     }
 
-    struct event *ev = event_new(event_b, task->sock, EV_WRITE, handle_tcp_connect_stage4, task);
-    add_event_mapping(task, ev);
-    event_add(ev, &connect_timeout);
+    task_complete(task, task->result);
 }
 
+// Performs queued operations until socket would block. Event is disarmed once queue drains.
 static
 void
-handle_tcp_connect_stage2(int result, char type, int count, int ttl, void *addresses, void *arg)
+handle_socket_ready(struct network_socket_s *ns, struct task_queue_s *q, struct event *ev,
+                    int *armed)
 {
-    struct async_network_task_s *task = arg;
+    struct task_queue_s done = { NULL, NULL };
 
-    if (result != DNS_ERR_NONE || count < 1) {
-        trace_warning("%s, evdns returned code %d, count = %d (%s:%u)\n", __func__, result, count,
-                      task->host, (unsigned int)task->port);
-        ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0,
-                                               PP_ERROR_NAME_NOT_RESOLVED, 0, __func__);
-        task_destroy(task);
+    pthread_mutex_lock(&ns->lock);
+    while (q->head) {
+        if (q->head->type == ASYNC_NETWORK_UDP_SEND) {
+            if (try_udp_send_batch(ns, q, &done) != 0)
+                break;
+            continue;
+        }
+
+        if (try_socket_io(ns, q->head) != 0)
+            break;
+        task_queue_push(&done, task_queue_pop(q));
+    }
+
+    if (!q->head && *armed) {
+        event_del(ev);
+        *armed = 0;
+    }
+    pthread_mutex_unlock(&ns->lock);
+
+    struct async_network_task_s *task;
+    while ((task = task_queue_pop(&done)) != NULL)
+        finish_socket_io(task);
+}
+
+static
+void
+handle_socket_readable(int sock, short event_flags, void *arg)
+{
+    struct network_socket_s *ns = arg;
+    handle_socket_ready(ns, &ns->read_q, ns->read_ev, &ns->read_armed);
+}
+
+static
+void
+handle_socket_writable(int sock, short event_flags, void *arg)
+{
+    struct network_socket_s *ns = arg;
+    handle_socket_ready(ns, &ns->write_q, ns->write_ev, &ns->write_armed);
+}
+
+static
+void
+queue_socket_io(struct async_network_task_s *task)
+{
+    struct network_socket_s *ns = lock_socket(task->sock, 1);
+    const int is_read = (task->type == ASYNC_NETWORK_TCP_READ ||
+                         task->type == ASYNC_NETWORK_UDP_RECV);
+    struct task_queue_s *q = is_read ? &ns->read_q : &ns->write_q;
+
+    // Data may be already buffered, or there may be room in send buffer. Try to complete
+    // operation right away, without a round trip through the network thread. Operations
+    // queued earlier go first, to keep their order.
+    if (!q->head && try_socket_io(ns, task) == 0) {
+        ns->immediate_count ++;
+        unlock_socket(ns);
+        finish_socket_io(task);
         return;
     }
 
-    evutil_make_socket_nonblocking(task->sock);
+    // need to wait
+    ns->queued_count ++;
+    task_queue_push(q, task);
+    if (is_read && !ns->read_armed) {
+        event_add(ns->read_ev, NULL);
+        ns->read_armed = 1;
+    } else if (!is_read && !ns->write_armed) {
+        event_add(ns->write_ev, NULL);
+        ns->write_armed = 1;
+    }
+    unlock_socket(ns);
+}
 
-    task->addr_count = count;
-    task->addr_ptr = 0;
-    task->addr_type = type;
+static
+size_t
+dns_addr_size(char type)
+{
+    return (type == DNS_IPv6_AAAA) ? sizeof(struct in6_addr) : sizeof(struct in_addr);
+}
 
-    if (type == DNS_IPv4_A) {
-        task->addr = malloc(4 * count);
-        memcpy(task->addr, addresses, 4 * count);
-    } else if (type == DNS_IPv6_AAAA) {
-        task->addr = malloc(16 * count);
-        memcpy(task->addr, addresses, 16 * count);
+static
+void
+dns_cache_entry_free(gpointer data)
+{
+    struct dns_cache_entry_s *entry = data;
+
+    g_free(entry->addrs);
+    g_slice_free(struct dns_cache_entry_s, entry);
+}
+
+static
+gboolean
+dns_cache_entry_expired(gpointer key, gpointer value, gpointer user_data)
+{
+    struct dns_cache_entry_s *entry = value;
+    const int64_t *now = user_data;
+
+    return entry->expire_time <= *now;
+}
+
+static
+void
+dns_cache_store(const char *key, int result, char type, int count, int ttl, void *addresses)
+{
+    if (result == DNS_ERR_NONE && count > 0) {
+        ttl = MIN(ttl, DNS_CACHE_MAX_TTL);
+    } else if (result == DNS_ERR_NONE || result == DNS_ERR_NOTEXIST) {
+        // negative answer: name or record doesn't exist
+        count = 0;
+        ttl = DNS_NEGATIVE_TTL;
     } else {
-        trace_error("%s, bad evdns type %d (%s:%u)\n", __func__, type, task->host,
-                    (unsigned int)task->port);
-        ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0,
-                                               PP_ERROR_FAILED, 0, __func__);
-        task_destroy(task);
+        // server failures and timeouts are not cached
         return;
     }
 
-    handle_tcp_connect_stage3(task);
+    if (ttl <= 0)
+        return;
+
+    const int64_t now = g_get_monotonic_time();
+    struct dns_cache_entry_s *entry = g_slice_new(struct dns_cache_entry_s);
+
+    entry->result = result;
+    entry->count = count;
+    entry->addrs = count > 0 ? g_memdup(addresses, count * dns_addr_size(type)) : NULL;
+    entry->expire_time = now + ttl * (int64_t)G_USEC_PER_SEC;
+
+    pthread_mutex_lock(&dns_cache_lock);
+    if (g_hash_table_size(dns_cache_ht) >= DNS_CACHE_MAX_ENTRIES) {
+        g_hash_table_foreach_remove(dns_cache_ht, dns_cache_entry_expired, (gpointer)&now);
+        if (g_hash_table_size(dns_cache_ht) >= DNS_CACHE_MAX_ENTRIES)
+            g_hash_table_remove_all(dns_cache_ht);
+    }
+    g_hash_table_replace(dns_cache_ht, g_strdup(key), entry);
+    pthread_mutex_unlock(&dns_cache_lock);
 }
 
 static
 void
-handle_tcp_connect_stage1(struct async_network_task_s *task)
+handle_dns_answer(int result, char type, int count, int ttl, void *addresses, void *arg)
 {
-    struct evdns_request *req;
-    struct sockaddr_in sai;
+    struct dns_request_s *req = arg;
 
-    memset(&sai, 0, sizeof(sai));
-    if (inet_pton(AF_INET, task->host, &sai.sin_addr) == 1) {
-        // already a valid IP address
-        handle_tcp_connect_stage2(DNS_ERR_NONE, DNS_IPv4_A, 1, 300, &sai.sin_addr, task);
+    dns_cache_store(req->key, result, type, count, ttl, addresses);
+    req->callback(result, type, count, ttl, addresses, req->arg);
+
+    g_free(req->key);
+    g_slice_free(struct dns_request_s, req);
+}
+
+// Resolves host name, looking into cache first. Cached answers are passed to |callback| right
+// away, in the calling thread; others arrive later in the network thread.
+static
+void
+resolve_host(const char *host, char type, evdns_callback_type callback, void *arg)
+{
+    char          *key = g_strdup_printf("%d:%s", type, host);
+    const int64_t  now = g_get_monotonic_time();
+
+    pthread_mutex_lock(&dns_cache_lock);
+    struct dns_cache_entry_s *entry = g_hash_table_lookup(dns_cache_ht, key);
+    if (entry && entry->expire_time > now) {
+        const int   result = entry->result;
+        const int   count = entry->count;
+        const int   ttl = (entry->expire_time - now) / G_USEC_PER_SEC;
+        void       *addrs = count > 0 ? g_memdup(entry->addrs, count * dns_addr_size(type))
+                                      : NULL;
+
+        pthread_mutex_unlock(&dns_cache_lock);
+        callback(result, type, count, ttl, addrs, arg);
+        g_free(addrs);
+        g_free(key);
         return;
     }
+    pthread_mutex_unlock(&dns_cache_lock);
 
-    // queue DNS request
-    req = evdns_base_resolve_ipv4(evdns_b, task->host, DNS_QUERY_NO_SEARCH,
-                                  handle_tcp_connect_stage2, task);
-    // TODO: what about ipv6?
+    struct dns_request_s *req = g_slice_new(struct dns_request_s);
+    struct evdns_request *evreq;
 
-    if (!req) {
-        trace_warning("%s, early dns resolution failure (%s:%u)\n", __func__, task->host,
-                      (unsigned int)task->port);
-        ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0,
-                                               PP_ERROR_NAME_NOT_RESOLVED, 0, __func__);
-        task_destroy(task);
-        return;
+    req->key = key;
+    req->callback = callback;
+    req->arg = arg;
+
+    if (type == DNS_IPv6_AAAA)
+        evreq = evdns_base_resolve_ipv6(evdns_b, host, DNS_QUERY_NO_SEARCH, handle_dns_answer, req);
+    else
+        evreq = evdns_base_resolve_ipv4(evdns_b, host, DNS_QUERY_NO_SEARCH, handle_dns_answer, req);
+
+    if (!evreq) {
+        trace_warning("%s, early dns resolution failure (%s)\n", __func__, host);
+        g_free(req->key);
+        g_slice_free(struct dns_request_s, req);
+        callback(DNS_ERR_UNKNOWN, type, 0, 0, NULL, arg);
     }
 }
 
 static
 void
-handle_tcp_connect_with_net_address(struct async_network_task_s *task)
+race_add_address(struct connect_race_s *race, int family, const void *addr)
 {
-    if (task->netaddr.size == sizeof(struct sockaddr_in)) {
-        struct sockaddr_in *sai = (void *)task->netaddr.data;
-        task->port = ntohs(sai->sin_port);
-        handle_tcp_connect_stage2(DNS_ERR_NONE, DNS_IPv4_A, 1, 3600, &sai->sin_addr, task);
-    } else if (task->netaddr.size == sizeof(struct sockaddr_in6)) {
-        struct sockaddr_in6 *sai = (void *)task->netaddr.data;
-        task->port = ntohs(sai->sin6_port);
-        handle_tcp_connect_stage2(DNS_ERR_NONE, DNS_IPv6_AAAA, 1, 3600, &sai->sin6_addr, task);
+    struct PP_NetAddress_Private *na = g_slice_new0(struct PP_NetAddress_Private);
+
+    if (family == AF_INET6) {
+        struct sockaddr_in6 sai6 = {
+            .sin6_family = AF_INET6,
+            .sin6_port =   htons(race->port),
+        };
+
+        memcpy(&sai6.sin6_addr, addr, sizeof(struct in6_addr));
+        na->size = sizeof(sai6);
+        memcpy(na->data, &sai6, sizeof(sai6));
+        g_queue_push_tail(&race->addrs_v6, na);
     } else {
-        trace_error("%s, bad address type\n", __func__);
-        ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0,
-                                               PP_ERROR_NAME_NOT_RESOLVED, 0, __func__);
-        task_destroy(task);
+        struct sockaddr_in sai = {
+            .sin_family = AF_INET,
+            .sin_port =   htons(race->port),
+        };
+
+        memcpy(&sai.sin_addr, addr, sizeof(struct in_addr));
+        na->size = sizeof(sai);
+        memcpy(na->data, &sai, sizeof(sai));
+        g_queue_push_tail(&race->addrs_v4, na);
     }
 }
 
 static
 void
-handle_tcp_read_stage2(int sock, short event_flags, void *arg)
+free_net_address(gpointer data, gpointer user_data)
 {
-    struct async_network_task_s *task = arg;
-    int32_t retval;
+    g_slice_free(struct PP_NetAddress_Private, data);
+}
+
+static
+void
+race_unref(struct connect_race_s *race)
+{
+    if (--race->ref_count > 0)
+        return;
+
+    g_queue_foreach(&race->addrs_v6, free_net_address, NULL);
+    g_queue_foreach(&race->addrs_v4, free_net_address, NULL);
+    g_queue_clear(&race->addrs_v6);
+    g_queue_clear(&race->addrs_v4);
+    event_free(race->timer);
+    g_free(race->host);
+    g_slice_free(struct connect_race_s, race);
+}
+
+static
+void
+free_attempt(struct connect_attempt_s *attempt)
+{
+    event_free(attempt->ev);
+    if (!attempt->is_own_socket)
+        close(attempt->fd);
+    g_slice_free(struct connect_attempt_s, attempt);
+}
+
+// Stops all attempts and completes connect task. Caller must have removed task from socket
+// state. Aborted races don't touch resource, as disconnect holds socket lock.
+static
+void
+race_finish(struct connect_race_s *race, int32_t result)
+{
+    struct async_network_task_s *task = race->task;
+
+    race->finished = 1;
+    race->task = NULL;
+    task->race = NULL;
 
-    retval = recv(sock, task->buffer, task->bufsize, 0);
-    if (retval < 0)
-        retval = get_pp_errno();
-    else if (retval == 0) {
+    for (GList *ll = race->attempts; ll != NULL; ll = g_list_next(ll))
+        free_attempt(ll->data);
+    g_list_free(race->attempts);
+    race->attempts = NULL;
+    event_del(race->timer);
+
+    if (result != PP_ERROR_ABORTED) {
         struct pp_tcp_socket_s *ts = pp_resource_acquire(task->resource, PP_RESOURCE_TCP_SOCKET);
         if (ts) {
-            ts->seen_eof = 1;
+            ts->is_connected = (result == PP_OK);
             pp_resource_release(task->resource);
         }
     }
 
-    ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0, retval, 0,
-                                           __func__);
-    task_destroy(task);
+    task_complete(task, result);
+    race_unref(race);
 }
 
 static
 void
-handle_tcp_read_stage1(struct async_network_task_s *task)
+race_detach_from_socket(struct connect_race_s *race)
 {
-    struct pp_tcp_socket_s *ts = pp_resource_acquire(task->resource, PP_RESOURCE_TCP_SOCKET);
-    if (!ts) {
-        trace_error("%s, bad resource\n", __func__);
-        task_destroy(task);
-        return;
+    struct network_socket_s *ns = lock_socket(race->task->sock, 0);
+    if (ns) {
+        if (ns->connect_task == race->task)
+            ns->connect_task = NULL;
+        unlock_socket(ns);
     }
-
-    struct event *ev = event_new(event_b, ts->sock, EV_READ, handle_tcp_read_stage2, task);
-    pp_resource_release(task->resource);
-    add_event_mapping(task, ev);
-    event_add(ev, NULL);
 }
 
 static
 void
-handle_tcp_write_stage2(int sock, short event_flags, void *arg)
+race_fail(struct connect_race_s *race)
 {
-    struct async_network_task_s *task = arg;
+    int32_t result = PP_ERROR_NAME_NOT_RESOLVED;
 
-    int32_t retval = send(sock, task->buffer, task->bufsize, 0);
-    if (retval < 0)
-        retval = get_pp_errno();
+    if (race->attempt_count > 0) {
+        trace_warning("%s, connection failed to all addresses (%s:%u)\n", __func__, race->host,
+                      (unsigned int)race->port);
+        errno = race->last_error;
+        result = get_pp_errno();
+    } else {
+        trace_warning("%s, no addresses for %s\n", __func__, race->host);
+    }
 
-    ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0, retval, 0,
-                                           __func__);
-    task_destroy(task);
+    race_detach_from_socket(race);
+    race_finish(race, result);
 }
 
 static
 void
-handle_tcp_write_stage1(struct async_network_task_s *task)
+race_win(struct connect_attempt_s *attempt)
 {
-    struct pp_tcp_socket_s *ts = pp_resource_acquire(task->resource, PP_RESOURCE_TCP_SOCKET);
-    if (!ts) {
-        trace_error("%s, bad resource\n", __func__);
-        task_destroy(task);
+    struct connect_race_s *race = attempt->race;
+
+    race_detach_from_socket(race);
+
+    if (attempt->is_own_socket) {
+        race_finish(race, PP_OK);
         return;
     }
 
-    struct event *ev = event_new(event_b, ts->sock, EV_WRITE, handle_tcp_write_stage2, task);
-    pp_resource_release(task->resource);
-    add_event_mapping(task, ev);
-    event_add(ev, NULL);
+    // Winning socket takes place of the one plugin knows about. Options plugin have set on the
+    // original socket are applied again. Resource is held, so SetOption can't slip in between.
+    struct pp_tcp_socket_s *ts = pp_resource_acquire(race->task->resource, PP_RESOURCE_TCP_SOCKET);
+    if (dup2(attempt->fd, race->task->sock) < 0) {
+        trace_error("%s, dup2 failed, errno = %d\n", __func__, errno);
+        if (ts)
+            pp_resource_release(race->task->resource);
+        race_finish(race, get_pp_errno());
+        return;
+    }
+
+    if (ts) {
+        if (ts->no_delay >= 0 && setsockopt(race->task->sock, IPPROTO_TCP, TCP_NODELAY,
+                                            &ts->no_delay, sizeof(ts->no_delay)) != 0)
+        {
+            trace_warning("%s, can't restore TCP_NODELAY, errno = %d\n", __func__, errno);
+        }
+        pp_resource_release(race->task->resource);
+    }
+
+    race_finish(race, PP_OK);
 }
 
 static
 void
-handle_disconnect_stage2(int sock, short event_flags, void *arg)
+handle_attempt_done(int sock, short event_flags, void *arg);
+
+// Whether plugin's socket can be connected directly, without a fresh socket taking its place
+static
+int
+is_own_socket_usable(struct connect_race_s *race, const struct sockaddr *sa)
 {
-    struct async_network_task_s *task = arg;
-    GHashTableIter iter;
-    gpointer key, val;
+    int       domain;
+    socklen_t len = sizeof(domain);
+
+    // only when this is the first and the only candidate
+    if (race->attempt_count > 0 || race->pending_answers > 0 ||
+        !g_queue_is_empty(&race->addrs_v6) || !g_queue_is_empty(&race->addrs_v4))
+    {
+        return 0;
+    }
 
-    pthread_mutex_lock(&lock);
-    g_hash_table_iter_init(&iter, tasks_ht);
-    while (g_hash_table_iter_next(&iter, &key, &val)) {
-        struct async_network_task_s *cur = key;
-        if (cur == task)  // skip current task
+    if (getsockopt(race->task->sock, SOL_SOCKET, SO_DOMAIN, &domain, &len) != 0)
+        return 0;
+
+    return domain == sa->sa_family;
+}
+
+// Starts connecting to the next address. Candidates of the other family go first.
+static
+void
+race_try_next(struct connect_race_s *race)
+{
+    while (1) {
+        GQueue *first = race->prefer_v4 ? &race->addrs_v4 : &race->addrs_v6;
+        GQueue *second = race->prefer_v4 ? &race->addrs_v6 : &race->addrs_v4;
+        struct PP_NetAddress_Private *na = g_queue_pop_head(first);
+
+        if (na)
+            race->prefer_v4 = !race->prefer_v4;
+        else
+            na = g_queue_pop_head(second);
+
+        if (!na)
+            break;
+
+        const struct sockaddr *sa = (const void *)na->data;
+        const int is_own_socket = is_own_socket_usable(race, sa);
+        int fd = is_own_socket ? race->task->sock : socket(sa->sa_family, SOCK_STREAM, 0);
+        int res = -1;
+
+        race->attempt_count ++;
+        if (fd >= 0) {
+            evutil_make_socket_nonblocking(fd);
+            res = connect(fd, sa, na->size);
+        }
+        g_slice_free(struct PP_NetAddress_Private, na);
+
+        if (fd < 0 || (res != 0 && errno != EINPROGRESS)) {
+            race->last_error = errno;
+            if (fd >= 0 && !is_own_socket)
+                close(fd);
             continue;
-        if (cur->resource == task->resource) {
-            g_hash_table_iter_remove(&iter);
-            event_free(cur->event);
-            ppb_message_loop_post_work_with_result(cur->callback_ml, cur->callback, 0,
-                                                   PP_ERROR_ABORTED, 0, __func__);
-            g_slice_free(struct async_network_task_s, cur);
         }
+
+        struct connect_attempt_s *attempt = g_slice_new0(struct connect_attempt_s);
+        attempt->fd = fd;
+        attempt->is_own_socket = is_own_socket;
+        attempt->race = race;
+        attempt->ev = event_new(race->base, fd, EV_WRITE, handle_attempt_done, attempt);
+        event_add(attempt->ev, &connect_timeout);
+        race->attempts = g_list_prepend(race->attempts, attempt);
+
+        // give it a head start before trying next address
+        evtimer_add(race->timer, &attempt_delay);
+        return;
     }
-    pthread_mutex_unlock(&lock);
 
-    close(task->sock);
-    task_destroy(task);
+    if (!race->attempts && race->pending_answers == 0)
+        race_fail(race);
 }
 
 static
 void
-handle_disconnect_stage1(struct async_network_task_s *task)
+handle_attempt_done(int sock, short event_flags, void *arg)
 {
-    struct event *ev = evtimer_new(event_b, handle_disconnect_stage2, task);
-    struct timeval timeout = {.tv_sec = 0};
-    add_event_mapping(task, ev);
-    event_add(ev, &timeout);
+    struct connect_attempt_s *attempt = arg;
+    struct connect_race_s *race = attempt->race;
+    int err = ETIMEDOUT;
+
+    if (!(event_flags & EV_TIMEOUT)) {
+        socklen_t len = sizeof(err);
+        if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) != 0)
+            err = errno;
+    }
+
+    if (err == 0) {
+        race_win(attempt);
+        return;
+    }
+
+    race->last_error = err;
+    race->attempts = g_list_remove(race->attempts, attempt);
+    free_attempt(attempt);
+
+    // failed attempt doesn't hold next one back
+    event_del(race->timer);
+    race_try_next(race);
 }
 
+// Decides whether to start connecting, after new addresses have arrived.
 static
 void
-handle_udp_recv_stage2(int sock, short event_flags, void *arg)
+race_step(struct connect_race_s *race)
 {
-    struct async_network_task_s *task = arg;
-
-    struct pp_udp_socket_s *us = pp_resource_acquire(task->resource, PP_RESOURCE_UDP_SOCKET);
-    if (!us) {
-        trace_error("%s, bad resource\n", __func__);
-        task_destroy(task);
+    if (race->started) {
+        // late answer; proceed unless an attempt is already in its head start
+        if (!race->attempts && !evtimer_pending(race->timer, NULL))
+            race_try_next(race);
         return;
     }
 
-    socklen_t len = sizeof(us->addr_from.data);
-    int32_t retval = recvfrom(sock, task->buffer, task->bufsize, 0,
-                              (struct sockaddr *)us->addr_from.data, &len);
-    us->addr_from.size = len;
+    if (!g_queue_is_empty(&race->addrs_v6) || race->pending_answers == 0) {
+        race->started = 1;
+        event_del(race->timer);
+        race_try_next(race);
+    } else if (!g_queue_is_empty(&race->addrs_v4) && !evtimer_pending(race->timer, NULL)) {
+        // IPv4 addresses are here, give IPv6 a little more time
+        evtimer_add(race->timer, &resolution_delay);
+    }
+}
+
+static
+void
+handle_race_timer(int sock, short event_flags, void *arg)
+{
+    struct connect_race_s *race = arg;
+
+    race->started = 1;
+    race_try_next(race);
+}
+
+static
+void
+handle_race_kick(int sock, short event_flags, void *arg)
+{
+    struct connect_race_s *race = arg;
+
+    if (!race->finished)
+        race_step(race);
+    race_unref(race);
+}
+
+static
+void
+handle_race_dns_answer_stage2(int sock, short event_flags, void *arg)
+{
+    struct dns_answer_s *answer = arg;
+    struct connect_race_s *race = answer->race;
+
+    race->pending_answers --;
+    if (!race->finished) {
+        const int family = (answer->type == DNS_IPv6_AAAA) ? AF_INET6 : AF_INET;
+        const size_t addr_size = dns_addr_size(answer->type);
 
-    if (retval < 0)
-        retval = get_pp_errno();
-    else if (retval == 0) {
-        us->seen_eof = 1;   // TODO: is it needed?
+        for (int k = 0; k < answer->count; k ++)
+            race_add_address(race, family, (char *)answer->addrs + k * addr_size);
+
+        race_step(race);
     }
 
-    pp_resource_release(task->resource);
-    ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0, retval, 0,
-                                           __func__);
-    task_destroy(task);
+    g_free(answer->addrs);
+    g_slice_free(struct dns_answer_s, answer);
+    race_unref(race);
 }
 
 static
 void
-handle_udp_recv_stage1(struct async_network_task_s *task)
+handle_race_dns_answer(int result, char type, int count, int ttl, void *addresses, void *arg)
 {
-    struct pp_udp_socket_s *us = pp_resource_acquire(task->resource, PP_RESOURCE_UDP_SOCKET);
-    if (!us) {
-        trace_error("%s, bad resource\n", __func__);
-        task_destroy(task);
-        return;
+    struct dns_answer_s *answer = g_slice_new0(struct dns_answer_s);
+
+    answer->race = arg;
+    answer->type = type;
+    if (result == DNS_ERR_NONE && count > 0 && (type == DNS_IPv4_A || type == DNS_IPv6_AAAA)) {
+        answer->count = count;
+        answer->addrs = g_memdup(addresses, count * dns_addr_size(type));
     }
 
-    memset(&us->addr_from, 0, sizeof(us->addr_from));
+    // race state is only changed from its own worker
+    event_base_once(answer->race->base, -1, EV_TIMEOUT, handle_race_dns_answer_stage2, answer,
+                    &zero_timeout);
+}
 
-    struct event *ev = event_new(event_b, us->sock, EV_READ, handle_udp_recv_stage2, task);
-    pp_resource_release(task->resource);
-    add_event_mapping(task, ev);
-    event_add(ev, NULL);
+static
+struct connect_race_s *
+race_create(struct async_network_task_s *task, const char *host, uint16_t port)
+{
+    struct connect_race_s *race = g_slice_new0(struct connect_race_s);
+
+    race->task = task;
+    race->host = g_strdup(host);
+    race->port = port;
+    race->ref_count = 1;
+    g_queue_init(&race->addrs_v6);
+    g_queue_init(&race->addrs_v4);
+    task->race = race;
+    return race;
 }
 
+// Makes race visible to disconnect. After that, race can only be referenced through references
+// taken beforehand.
 static
 void
-handle_udp_send_stage2(int sock, short event_flags, void *arg)
+race_publish(struct connect_race_s *race)
 {
-    struct async_network_task_s *task = arg;
+    struct network_socket_s *ns = lock_socket(race->task->sock, 1);
 
-    int retval = sendto(sock, task->buffer, task->bufsize, MSG_NOSIGNAL,
-                        (struct sockaddr *)task->netaddr.data, task->netaddr.size);
-    if (retval < 0)
-        retval = get_pp_errno();
+    race->base = ns->worker->base;
+    race->timer = evtimer_new(race->base, handle_race_timer, race);
+    ns->connect_task = race->task;
+    unlock_socket(ns);
+}
 
-    ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0, retval, 0,
-                                           __func__);
-    task_destroy(task);
+static
+void
+handle_tcp_connect_stage1(struct async_network_task_s *task)
+{
+    struct connect_race_s *race = race_create(task, task->host, task->port);
+    struct in6_addr addr6;
+    struct in_addr addr4;
+
+    if (inet_pton(AF_INET, race->host, &addr4) == 1) {
+        // already a valid IP address
+        race_add_address(race, AF_INET, &addr4);
+    } else if (inet_pton(AF_INET6, race->host, &addr6) == 1) {
+        race_add_address(race, AF_INET6, &addr6);
+    } else {
+        // resolve both families in parallel, each answer holds a reference
+        race->pending_answers = 2;
+        race->ref_count += 2;
+        race_publish(race);
+        resolve_host(race->host, DNS_IPv6_AAAA, handle_race_dns_answer, race);
+        resolve_host(race->host, DNS_IPv4_A, handle_race_dns_answer, race);
+        return;
+    }
+
+    race->ref_count += 1;
+    race_publish(race);
+    event_base_once(race->base, -1, EV_TIMEOUT, handle_race_kick, race, &zero_timeout);
 }
 
 static
 void
-handle_udp_send_stage1(struct async_network_task_s *task)
+handle_tcp_connect_with_net_address(struct async_network_task_s *task)
 {
-    struct pp_udp_socket_s *us = pp_resource_acquire(task->resource, PP_RESOURCE_UDP_SOCKET);
-    if (!us) {
-        trace_error("%s, bad resource\n", __func__);
+    struct connect_race_s *race;
+
+    if (task->netaddr.size == sizeof(struct sockaddr_in)) {
+        struct sockaddr_in *sai = (void *)task->netaddr.data;
+        race = race_create(task, "", ntohs(sai->sin_port));
+        race_add_address(race, AF_INET, &sai->sin_addr);
+    } else if (task->netaddr.size == sizeof(struct sockaddr_in6)) {
+        struct sockaddr_in6 *sai = (void *)task->netaddr.data;
+        race = race_create(task, "", ntohs(sai->sin6_port));
+        race_add_address(race, AF_INET6, &sai->sin6_addr);
+    } else {
+        trace_error("%s, bad address type\n", __func__);
+        ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0,
+                                               PP_ERROR_NAME_NOT_RESOLVED, 0, __func__);
         task_destroy(task);
         return;
     }
 
-    // try to send immediately, but don't wait
-    int retval = sendto(us->sock, task->buffer, task->bufsize, MSG_DONTWAIT | MSG_NOSIGNAL,
-                        (struct sockaddr *)task->netaddr.data, task->netaddr.size);
-    pp_resource_release(task->resource);
+    race->ref_count += 1;
+    race_publish(race);
+    event_base_once(race->base, -1, EV_TIMEOUT, handle_race_kick, race, &zero_timeout);
+}
 
-    if (retval >= 0) {
-        // successfully sent
-        ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0, retval, 0,
-                                               __func__);
+static
+void
+handle_disconnect_stage2(int sock, short event_flags, void *arg)
+{
+    struct async_network_task_s *task = arg;
+
+    pthread_mutex_lock(&lock);
+    struct network_socket_s *ns = g_hash_table_lookup(sockets_ht, GINT_TO_POINTER(task->sock));
+    if (ns) {
+        g_hash_table_remove(sockets_ht, GINT_TO_POINTER(task->sock));
+        pthread_mutex_lock(&ns->lock);
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (ns) {
+        struct async_network_task_s *cur;
+
+        // abort all pending operations
+        while ((cur = task_queue_pop(&ns->read_q)) != NULL)
+            task_complete(cur, PP_ERROR_ABORTED);
+        while ((cur = task_queue_pop(&ns->write_q)) != NULL)
+            task_complete(cur, PP_ERROR_ABORTED);
+        if (ns->connect_task) {
+            struct async_network_task_s *connect_task = ns->connect_task;
+            ns->connect_task = NULL;
+            race_finish(connect_task->race, PP_ERROR_ABORTED);
+        }
+
+        trace_info_f("%s, sock %d, %u operations completed immediately, %u waited\n",
+                     __func__, ns->sock, ns->immediate_count, ns->queued_count);
+        trace_info_f("%s, sock %d, received %u packets in %u calls, sent %u packets in %u "
+                     "batches, %.1f s\n", __func__, ns->sock, ns->packets_received,
+                     ns->recv_calls, ns->packets_sent, ns->send_calls,
+                     (g_get_monotonic_time() - ns->create_time) / 1e6);
+
+        event_free(ns->read_ev);
+        event_free(ns->write_ev);
+        free(ns->ring.data);
+        pthread_mutex_unlock(&ns->lock);
+        pthread_mutex_destroy(&ns->lock);
+        g_slice_free(struct network_socket_s, ns);
+    }
+
+    close(task->sock);
+    task_destroy(task);
+}
+
+static
+void
+handle_disconnect_stage1(struct async_network_task_s *task)
+{
+    pthread_mutex_lock(&lock);
+    struct network_socket_s *ns = g_hash_table_lookup(sockets_ht, GINT_TO_POINTER(task->sock));
+    struct event_base *base = ns ? ns->worker->base : NULL;
+    pthread_mutex_unlock(&lock);
+
+    if (!base) {
+        // socket was never used, nothing to wait for
+        close(task->sock);
         task_destroy(task);
         return;
     }
 
-    // need to wait
-    struct event *ev = event_new(event_b, us->sock, EV_WRITE, handle_udp_send_stage2, task);
-    add_event_mapping(task, ev);
-    event_add(ev, NULL);
+    // run on socket's worker, after event handlers that may be in progress
+    event_base_once(base, -1, EV_TIMEOUT, handle_disconnect_stage2, task, &zero_timeout);
 }
 
 static
@@ -592,51 +1327,63 @@ static
 void
 handle_host_resolve_stage1(struct async_network_task_s *task)
 {
-    struct evdns_request *req;
-
-    // queue DNS request
-    req = evdns_base_resolve_ipv4(evdns_b, task->host, DNS_QUERY_NO_SEARCH,
-                                  handle_host_resolve_stage2, task);
+    resolve_host(task->host, DNS_IPv4_A, handle_host_resolve_stage2, task);
     // TODO: what about ipv6?
+}
 
-    if (!req) {
-        trace_warning("%s, early dns resolution failure (%s:%u)\n", __func__, task->host,
-                      (unsigned int)task->port);
-        ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0,
-                                               PP_ERROR_NAME_NOT_RESOLVED, 0, __func__);
-        task_destroy(task);
-        return;
-    }
+static
+void
+handle_keepalive(int sock, short event_flags, void *arg)
+{
 }
 
 static
 void *
 network_worker_thread(void *param)
 {
-    event_base_dispatch(event_b);
-    event_base_free(event_b);
+    struct network_worker_s *worker = param;
+
+    event_base_dispatch(worker->base);
+    event_base_free(worker->base);
     trace_error("%s, thread terminated\n", __func__);
     return NULL;
 }
 
+static
 void
-async_network_task_push(struct async_network_task_s *task)
+network_initialize(void)
 {
-    static int thread_started = 0;
+    evthread_use_pthreads();
 
-    if (!thread_started) {
-        pthread_t t;
+    worker_count = DEFAULT_NETWORK_THREADS;
+    if (config.network_threads > 0)
+        worker_count = MIN(config.network_threads, MAX_NETWORK_THREADS);
+
+    for (unsigned int k = 0; k < worker_count; k ++) {
+        struct network_worker_s *worker = &workers[k];
 
-        evthread_use_pthreads();
-        event_b = event_base_new();
-        evdns_b = evdns_base_new(event_b, 0);
-        evdns_base_resolv_conf_parse(evdns_b, DNS_OPTIONS_ALL, "/etc/resolv.conf");
-        if (config.randomize_dns_case == 0)
-            evdns_base_set_option(evdns_b, "randomize-case:", "0");
-        pthread_create(&t, NULL, network_worker_thread, NULL);
+        worker->base = event_base_new();
+        worker->keepalive = event_new(worker->base, -1, EV_PERSIST, handle_keepalive, NULL);
+        event_add(worker->keepalive, &keepalive_interval);
+    }
+
+    // DNS requests are served by the first worker
+    evdns_b = evdns_base_new(workers[0].base, 0);
+    evdns_base_resolv_conf_parse(evdns_b, DNS_OPTIONS_ALL, "/etc/resolv.conf");
+    if (config.randomize_dns_case == 0)
+        evdns_base_set_option(evdns_b, "randomize-case:", "0");
+
+    for (unsigned int k = 0; k < worker_count; k ++) {
+        pthread_t t;
+        pthread_create(&t, NULL, network_worker_thread, &workers[k]);
         pthread_detach(t);
-        thread_started = 1;
     }
+}
+
+void
+async_network_task_push(struct async_network_task_s *task)
+{
+    pthread_once(&network_once, network_initialize);
 
     switch (task->type) {
     case ASYNC_NETWORK_TCP_CONNECT:
@@ -649,16 +1396,10 @@ async_network_task_push(struct async_network_task_s *task)
         handle_disconnect_stage1(task);
         break;
     case ASYNC_NETWORK_TCP_READ:
-        handle_tcp_read_stage1(task);
-        break;
     case ASYNC_NETWORK_TCP_WRITE:
-        handle_tcp_write_stage1(task);
-        break;
     case ASYNC_NETWORK_UDP_RECV:
-        handle_udp_recv_stage1(task);
-        break;
     case ASYNC_NETWORK_UDP_SEND:
-        handle_udp_send_stage1(task);
+        queue_socket_io(task);
         break;
     case ASYNC_NETWORK_HOST_RESOLVE:
         handle_host_resolve_stage1(task);
@@ -55,11 +55,11 @@ struct async_network_task_s {
     int                             sock;
 
     // private fields
+    struct async_network_task_s    *next;       ///< next operation queued on the same socket
     void                           *event;
-    void                           *addr;
-    uint32_t                        addr_ptr;
-    uint32_t                        addr_type;
-    uint32_t                        addr_count;
+    int32_t                         result;
+    int32_t                         bytes_done; ///< part of the buffer already written
+    void                           *race;       ///< connection attempts in progress
 };
 
 void
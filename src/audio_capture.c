@@ -0,0 +1,231 @@
+/*
+ * Copyright © 2013-2015  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "audio_capture.h"
+#include "audio_dsp.h"
+#include "audio_ringbuffer.h"
+#include "config.h"
+#include "eintr_retry.h"
+#include "ppb_message_loop.h"
+#include "trace.h"
+#include <glib.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+// device data is processed in pieces of that size, so conversion buffers have fixed size
+#define MAX_PIECE_FRAMES    1024
+#define MAX_CHANNELS        8
+
+
+struct audio_capture_s {
+    unsigned int                device_channel_count;
+    unsigned int                sample_rate;
+    size_t                      sample_frame_count;
+    audio_stream_capture_cb_f  *cb;
+    void                       *cb_user_data;
+
+    audio_s16_resampler        *resampler;          ///< NULL if rates are equal
+    int16_t                    *conv_buf;           ///< mono data, before and after resampling
+    size_t                      conv_buf_frames;
+    audio_ringbuffer           *rb;                 ///< mono data at plugin rate
+    int16_t                    *chunk_buf;          ///< passed to plugin
+
+    pthread_t                   thread;
+    int                         thread_started;
+    sem_t                       wakeup_sem;         ///< posted on each push
+    volatile gint               terminate;
+    volatile gint               device_latency_us;
+    volatile gint               callback_count;
+    volatile gint               overrun_count;
+    volatile gint               max_callback_latency_us;
+};
+
+
+static
+void *
+delivery_thread(void *param)
+{
+    audio_capture *ac = param;
+    const size_t   chunk = ac->sample_frame_count * sizeof(int16_t);
+
+    ppb_message_loop_mark_thread_unsuitable();
+
+    while (1) {
+        RETRY_ON_EINTR(sem_wait(&ac->wakeup_sem));
+        if (g_atomic_int_get(&ac->terminate))
+            break;
+
+        while (audio_ringbuffer_read_space(ac->rb) >= chunk) {
+            // oldest sample in chunk have waited for the whole ring content to be captured
+            const size_t queued_frames = audio_ringbuffer_read_space(ac->rb) / sizeof(int16_t);
+            const double latency = g_atomic_int_get(&ac->device_latency_us) / 1e6 +
+                                   (double)queued_frames / ac->sample_rate;
+            struct timespec t_start, t_end;
+
+            audio_ringbuffer_read(ac->rb, ac->chunk_buf, chunk);
+
+            clock_gettime(CLOCK_MONOTONIC, &t_start);
+            ac->cb(ac->chunk_buf, chunk, latency, ac->cb_user_data);
+            clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+            const gint latency_us = (t_end.tv_sec - t_start.tv_sec) * 1000 * 1000 +
+                                    (t_end.tv_nsec - t_start.tv_nsec) / 1000;
+            if (latency_us > g_atomic_int_get(&ac->max_callback_latency_us))
+                g_atomic_int_set(&ac->max_callback_latency_us, latency_us);
+            g_atomic_int_inc(&ac->callback_count);
+        }
+    }
+
+    return NULL;
+}
+
+audio_capture *
+audio_capture_new(unsigned int device_rate, unsigned int device_channel_count,
+                  unsigned int sample_rate, unsigned int sample_frame_count,
+                  audio_stream_capture_cb_f *cb, void *cb_user_data)
+{
+    if (device_channel_count < 1 || device_channel_count > MAX_CHANNELS) {
+        trace_error("%s, unsupported channel count %u\n", __func__, device_channel_count);
+        return NULL;
+    }
+
+    audio_capture *ac = calloc(1, sizeof(*ac));
+    if (!ac)
+        return NULL;
+
+    ac->device_channel_count = device_channel_count;
+    ac->sample_rate = sample_rate;
+    ac->sample_frame_count = sample_frame_count;
+    ac->cb = cb;
+    ac->cb_user_data = cb_user_data;
+    sem_init(&ac->wakeup_sem, 0, 0);
+
+    ac->conv_buf_frames = MAX_PIECE_FRAMES;
+    if (device_rate != sample_rate) {
+        ac->resampler = audio_s16_resampler_new(device_rate, sample_rate, 1, MAX_PIECE_FRAMES);
+        if (!ac->resampler) {
+            trace_error("%s, can't resample from %u Hz to %u Hz\n", __func__, device_rate,
+                        sample_rate);
+            goto err;
+        }
+        ac->conv_buf_frames = MAX(ac->conv_buf_frames,
+                                  audio_s16_resampler_max_output_frames(ac->resampler));
+    }
+
+    // keep up to a second of data, so plugin can be late for a while without losing any
+    const size_t rb_frames = MAX(sample_rate, 4 * sample_frame_count);
+
+    ac->conv_buf = malloc(ac->conv_buf_frames * sizeof(int16_t));
+    ac->chunk_buf = malloc(sample_frame_count * sizeof(int16_t));
+    ac->rb = audio_ringbuffer_new(rb_frames * sizeof(int16_t));
+    if (!ac->conv_buf || !ac->chunk_buf || !ac->rb) {
+        trace_error("%s, memory allocation failure\n", __func__);
+        goto err;
+    }
+
+    // pushing side runs in audio thread, which may be realtime
+    audio_thread_lock_memory(ac->conv_buf, ac->conv_buf_frames * sizeof(int16_t));
+    if (config.audio_realtime_priority > 0)
+        audio_ringbuffer_mlock(ac->rb);
+
+    if (pthread_create(&ac->thread, NULL, delivery_thread, ac) != 0) {
+        trace_error("%s, can't create delivery thread\n", __func__);
+        goto err;
+    }
+    ac->thread_started = 1;
+
+    return ac;
+
+err:
+    audio_capture_free(ac);
+    return NULL;
+}
+
+void
+audio_capture_stop(audio_capture *ac)
+{
+    if (!ac->thread_started)
+        return;
+
+    g_atomic_int_set(&ac->terminate, 1);
+    sem_post(&ac->wakeup_sem);
+    pthread_join(ac->thread, NULL);
+    ac->thread_started = 0;
+}
+
+void
+audio_capture_free(audio_capture *ac)
+{
+    if (!ac)
+        return;
+
+    audio_capture_stop(ac);
+    audio_thread_unlock_memory(ac->conv_buf, ac->conv_buf_frames * sizeof(int16_t));
+    audio_s16_resampler_free(ac->resampler);
+    audio_ringbuffer_free(ac->rb);
+    free(ac->conv_buf);
+    free(ac->chunk_buf);
+    sem_destroy(&ac->wakeup_sem);
+    free(ac);
+}
+
+void
+audio_capture_push(audio_capture *ac, const int16_t *data, size_t frame_count, double latency)
+{
+    g_atomic_int_set(&ac->device_latency_us, latency * 1e6);
+
+    while (frame_count > 0) {
+        const size_t piece = MIN(frame_count, MAX_PIECE_FRAMES);
+        size_t       out_frames = piece;
+
+        audio_dsp_downmix_s16(data, ac->conv_buf, piece, ac->device_channel_count);
+        if (ac->resampler)
+            out_frames = audio_s16_resampler_process(ac->resampler, ac->conv_buf, piece,
+                                                     ac->conv_buf);
+
+        // drop newest data rather than overwriting data plugin may be reading right now
+        const size_t len = out_frames * sizeof(int16_t);
+        if (audio_ringbuffer_write_space(ac->rb) >= len)
+            audio_ringbuffer_write(ac->rb, ac->conv_buf, len);
+        else
+            g_atomic_int_inc(&ac->overrun_count);
+
+        data += piece * ac->device_channel_count;
+        frame_count -= piece;
+    }
+
+    sem_post(&ac->wakeup_sem);
+}
+
+void
+audio_capture_get_stats(audio_capture *ac, audio_stream_stats *stats)
+{
+    stats->callback_count = g_atomic_int_get(&ac->callback_count);
+    stats->overrun_count = g_atomic_int_get(&ac->overrun_count);
+    stats->max_callback_latency_us = g_atomic_int_get(&ac->max_callback_latency_us);
+}
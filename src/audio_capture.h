@@ -0,0 +1,67 @@
+/*
+ * Copyright © 2013-2015  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPP_AUDIO_CAPTURE_H
+#define FPP_AUDIO_CAPTURE_H
+
+#include "audio_thread.h"
+#include <stddef.h>
+#include <stdint.h>
+
+
+/// capture pipeline, shared by audio backends
+///
+/// Backend pushes data in device format from its own thread. Pipeline downmixes it to mono,
+/// resamples to the rate plugin asked for, and keeps it in a lock-free ring. A separate
+/// delivery thread passes data to plugin callback, always in whole chunks. So slow plugin
+/// doesn't stall device reads, and device reads of any size don't cause partial callbacks.
+typedef struct audio_capture_s audio_capture;
+
+
+audio_capture *
+audio_capture_new(unsigned int device_rate, unsigned int device_channel_count,
+                  unsigned int sample_rate, unsigned int sample_frame_count,
+                  audio_stream_capture_cb_f *cb, void *cb_user_data);
+
+/// stops delivery thread, no callbacks are called after function returns
+///
+/// Pushing data is still allowed, until audio_capture_free() is called.
+void
+audio_capture_stop(audio_capture *ac);
+
+void
+audio_capture_free(audio_capture *ac);
+
+/// passes interleaved device data to the pipeline
+///
+/// Never blocks nor allocates. Data which doesn't fit into the ring is dropped and counted as
+/// an overrun. @latency is a time, in seconds, data spent in device buffers.
+void
+audio_capture_push(audio_capture *ac, const int16_t *data, size_t frame_count, double latency);
+
+/// fills callback and overrun related fields of @stats
+void
+audio_capture_get_stats(audio_capture *ac, audio_stream_stats *stats);
+
+#endif // FPP_AUDIO_CAPTURE_H
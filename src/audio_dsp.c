@@ -0,0 +1,574 @@
+/*
+ * Copyright © 2013-2015  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "audio_dsp.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+#define POLYPHASE_TAPS          24      ///< filter length per phase, multiple of 4
+#define POLYPHASE_MAX_PHASES    512
+#define RESAMPLER_MAX_CHANNELS  2
+#define RESAMPLER_CHUNK_FRAMES  1024    ///< input is processed in pieces of that size
+
+struct audio_resampler_s {
+    audio_resampler_quality quality;
+    unsigned int            channel_count;
+    unsigned int            up;         ///< interpolation factor, L
+    unsigned int            down;       ///< decimation factor, M
+
+    // linear
+    uint64_t                pos;        ///< 32.32 fixed-point position, relative to prev
+    uint64_t                step;
+    float                   prev[RESAMPLER_MAX_CHANNELS];
+
+    // polyphase
+    float                  *bank;       ///< up * POLYPHASE_TAPS coefficients, reversed
+    float                  *work[RESAMPLER_MAX_CHANNELS];   ///< history followed by input
+    size_t                  hist_len;
+    size_t                  skip;       ///< input frames to skip on next call
+    unsigned int            phase;
+};
+
+struct audio_s16_resampler_s {
+    audio_resampler    *rs;
+    unsigned int        channel_count;
+    size_t              max_in_frame_count;
+    size_t              max_out_frame_count;
+    float              *planar_in[RESAMPLER_MAX_CHANNELS];
+    float              *planar_out[RESAMPLER_MAX_CHANNELS];
+};
+
+
+void
+audio_dsp_s16_to_float(const int16_t *src, float *dst, size_t count)
+{
+    size_t k = 0;
+
+#if defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+    for (; k + 8 <= count; k += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + k));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(dst + k, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(dst + k + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+#endif
+
+    for (; k < count; k ++)
+        dst[k] = src[k] * (1.0f / 32768.0f);
+}
+
+static
+inline
+int16_t
+float_to_s16_scalar(float v)
+{
+    v = v * 32768.0f;
+    v = CLAMP(v, -32768.0f, 32767.0f);
+    return (int16_t)lrintf(v);
+}
+
+#if defined(__SSE2__)
+static
+inline
+__m128i
+float_to_s32_sse2(__m128 v)
+{
+    const __m128 scale = _mm_set1_ps(32768.0f);
+    const __m128 lo_limit = _mm_set1_ps(-32768.0f);
+    const __m128 hi_limit = _mm_set1_ps(32767.0f);
+
+    v = _mm_mul_ps(v, scale);
+    v = _mm_min_ps(_mm_max_ps(v, lo_limit), hi_limit);
+    return _mm_cvtps_epi32(v);
+}
+#endif
+
+void
+audio_dsp_float_to_s16(const float *src, int16_t *dst, size_t count)
+{
+    size_t k = 0;
+
+#if defined(__SSE2__)
+    for (; k + 8 <= count; k += 8) {
+        __m128i lo = float_to_s32_sse2(_mm_loadu_ps(src + k));
+        __m128i hi = float_to_s32_sse2(_mm_loadu_ps(src + k + 4));
+        _mm_storeu_si128((__m128i *)(dst + k), _mm_packs_epi32(lo, hi));
+    }
+#endif
+
+    for (; k < count; k ++)
+        dst[k] = float_to_s16_scalar(src[k]);
+}
+
+void
+audio_dsp_deinterleave_s16_to_float(const int16_t *src, float *dst_l, float *dst_r,
+                                    size_t frame_count)
+{
+    size_t k = 0;
+
+#if defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+    for (; k + 4 <= frame_count; k += 4) {
+        // L0 R0 L1 R1 L2 R2 L3 R3
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + 2 * k));
+        __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+        __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+        __m128 l = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 r = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+        _mm_storeu_ps(dst_l + k, _mm_mul_ps(l, scale));
+        _mm_storeu_ps(dst_r + k, _mm_mul_ps(r, scale));
+    }
+#endif
+
+    for (; k < frame_count; k ++) {
+        dst_l[k] = src[2 * k] * (1.0f / 32768.0f);
+        dst_r[k] = src[2 * k + 1] * (1.0f / 32768.0f);
+    }
+}
+
+void
+audio_dsp_interleave_float_to_s16(const float *src_l, const float *src_r, int16_t *dst,
+                                  size_t frame_count)
+{
+    size_t k = 0;
+
+#if defined(__SSE2__)
+    for (; k + 4 <= frame_count; k += 4) {
+        __m128 l = _mm_loadu_ps(src_l + k);
+        __m128 r = _mm_loadu_ps(src_r + k);
+        __m128i lo = float_to_s32_sse2(_mm_unpacklo_ps(l, r));
+        __m128i hi = float_to_s32_sse2(_mm_unpackhi_ps(l, r));
+        _mm_storeu_si128((__m128i *)(dst + 2 * k), _mm_packs_epi32(lo, hi));
+    }
+#endif
+
+    for (; k < frame_count; k ++) {
+        dst[2 * k] = float_to_s16_scalar(src_l[k]);
+        dst[2 * k + 1] = float_to_s16_scalar(src_r[k]);
+    }
+}
+
+void
+audio_dsp_apply_gain_s16(int16_t *buf, size_t count, float gain)
+{
+    size_t k = 0;
+
+    if (gain == 1.0f)
+        return;
+
+    if (gain == 0.0f) {
+        memset(buf, 0, count * sizeof(int16_t));
+        return;
+    }
+
+#if defined(__SSE2__)
+    const __m128 g = _mm_set1_ps(gain);
+    for (; k + 8 <= count; k += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + k));
+        __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+        __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+        __m128i lo_i = _mm_cvtps_epi32(_mm_mul_ps(lo, g));
+        __m128i hi_i = _mm_cvtps_epi32(_mm_mul_ps(hi, g));
+        _mm_storeu_si128((__m128i *)(buf + k), _mm_packs_epi32(lo_i, hi_i));
+    }
+#endif
+
+    for (; k < count; k ++) {
+        float v = buf[k] * gain;
+        buf[k] = (int16_t)lrintf(CLAMP(v, -32768.0f, 32767.0f));
+    }
+}
+
+void
+audio_dsp_mix_s16(int16_t *dst, const int16_t *src, size_t count)
+{
+    size_t k = 0;
+
+#if defined(__SSE2__)
+    for (; k + 8 <= count; k += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(dst + k));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + k));
+        _mm_storeu_si128((__m128i *)(dst + k), _mm_adds_epi16(a, b));
+    }
+#endif
+
+    for (; k < count; k ++) {
+        int32_t v = (int32_t)dst[k] + src[k];
+        dst[k] = CLAMP(v, INT16_MIN, INT16_MAX);
+    }
+}
+
+void
+audio_dsp_downmix_s16(const int16_t *src, int16_t *dst, size_t frame_count,
+                      unsigned int channel_count)
+{
+    size_t k = 0;
+
+#if defined(__SSE2__)
+    if (channel_count == 2) {
+        // pairwise average of 16-bit lanes, loads two stereo blocks per store
+        const __m128i ones = _mm_set1_epi16(1);
+        for (; k + 8 <= frame_count; k += 8) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(src + 2 * k));
+            __m128i b = _mm_loadu_si128((const __m128i *)(src + 2 * k + 8));
+            __m128i sa = _mm_srai_epi32(_mm_madd_epi16(a, ones), 1);
+            __m128i sb = _mm_srai_epi32(_mm_madd_epi16(b, ones), 1);
+            _mm_storeu_si128((__m128i *)(dst + k), _mm_packs_epi32(sa, sb));
+        }
+    }
+#endif
+
+    for (; k < frame_count; k ++) {
+        int32_t sum = 0;
+        for (unsigned int ch = 0; ch < channel_count; ch ++)
+            sum += src[k * channel_count + ch];
+        // round towards minus infinity, as SIMD path does
+        const int32_t n = channel_count;
+        dst[k] = (sum >= 0) ? sum / n : -((n - 1 - sum) / n);
+    }
+}
+
+static
+inline
+float
+dot_product(const float *a, const float *b)
+{
+#if defined(__SSE2__)
+    __m128 acc = _mm_setzero_ps();
+    for (int k = 0; k < POLYPHASE_TAPS; k += 4)
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + k), _mm_loadu_ps(b + k)));
+
+    // horizontal sum
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    return _mm_cvtss_f32(acc);
+#else
+    float sum = 0.0f;
+    for (int k = 0; k < POLYPHASE_TAPS; k ++)
+        sum += a[k] * b[k];
+    return sum;
+#endif
+}
+
+static
+unsigned int
+gcd(unsigned int a, unsigned int b)
+{
+    while (b != 0) {
+        unsigned int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// windowed sinc low-pass filter, split into phases
+static
+float *
+build_filter_bank(unsigned int up, unsigned int down)
+{
+    const unsigned int len = up * POLYPHASE_TAPS;
+    // cutoff, relative to upsampled rate, slightly below Nyquist frequency of slower side
+    const double fc = 0.5 * 0.92 / MAX(up, down);
+    float *bank = malloc(len * sizeof(float));
+
+    if (!bank)
+        return NULL;
+
+    for (unsigned int n = 0; n < len; n ++) {
+        const double t = n - (len - 1) / 2.0;
+        const double x = 2.0 * M_PI * fc * t;
+        const double sinc = (fabs(t) < 1e-9) ? 1.0 : sin(x) / x;
+        // Blackman window
+        const double w = 0.42 - 0.5 * cos(2.0 * M_PI * n / (len - 1)) +
+                         0.08 * cos(4.0 * M_PI * n / (len - 1));
+        const double h = 2.0 * fc * up * sinc * w;
+
+        // coefficient k of phase p multiplies x[i - k]; they are stored reversed, so
+        // filtering becomes a plain dot product over the input window
+        const unsigned int p = n % up;
+        const unsigned int k = n / up;
+        bank[p * POLYPHASE_TAPS + (POLYPHASE_TAPS - 1 - k)] = h;
+    }
+
+    return bank;
+}
+
+audio_resampler *
+audio_resampler_new(unsigned int in_rate, unsigned int out_rate, unsigned int channel_count,
+                    audio_resampler_quality quality)
+{
+    if (in_rate == 0 || out_rate == 0 || channel_count == 0 ||
+        channel_count > RESAMPLER_MAX_CHANNELS)
+    {
+        return NULL;
+    }
+
+    audio_resampler *rs = calloc(1, sizeof(*rs));
+    if (!rs)
+        return NULL;
+
+    const unsigned int d = gcd(in_rate, out_rate);
+    rs->quality = quality;
+    rs->channel_count = channel_count;
+    rs->up = out_rate / d;
+    rs->down = in_rate / d;
+    rs->step = ((uint64_t)rs->down << 32) / rs->up;
+
+    if (quality == AUDIO_RESAMPLER_POLYPHASE) {
+        if (rs->up > POLYPHASE_MAX_PHASES)
+            goto err;
+
+        rs->bank = build_filter_bank(rs->up, rs->down);
+        if (!rs->bank)
+            goto err;
+
+        for (unsigned int ch = 0; ch < channel_count; ch ++) {
+            rs->work[ch] = calloc(POLYPHASE_TAPS - 1 + RESAMPLER_CHUNK_FRAMES, sizeof(float));
+            if (!rs->work[ch])
+                goto err;
+        }
+
+        // start with silence in history
+        rs->hist_len = POLYPHASE_TAPS - 1;
+    }
+
+    return rs;
+
+err:
+    audio_resampler_free(rs);
+    return NULL;
+}
+
+void
+audio_resampler_free(audio_resampler *rs)
+{
+    if (!rs)
+        return;
+
+    for (unsigned int ch = 0; ch < RESAMPLER_MAX_CHANNELS; ch ++)
+        free(rs->work[ch]);
+    free(rs->bank);
+    free(rs);
+}
+
+size_t
+audio_resampler_max_output_frames(audio_resampler *rs, size_t in_frame_count)
+{
+    return ((uint64_t)in_frame_count * rs->up + rs->down - 1) / rs->down + 2;
+}
+
+static
+size_t
+process_linear(audio_resampler *rs, const float *const *in, size_t in_frame_count,
+               float *const *out)
+{
+    size_t   produced = 0;
+    uint64_t pos = rs->pos;
+
+    if (in_frame_count == 0)
+        return 0;
+
+    for (unsigned int ch = 0; ch < rs->channel_count; ch ++) {
+        const float *src = in[ch];
+        float       *dst = out[ch];
+        size_t       n = 0;
+
+        // position 0 is the last sample of previous call, position 1 is src[0]
+        pos = rs->pos;
+        while ((pos >> 32) < in_frame_count) {
+            const size_t i = pos >> 32;
+            const float  f = (pos & 0xffffffffu) * (1.0f / 4294967296.0f);
+            const float  a = (i == 0) ? rs->prev[ch] : src[i - 1];
+
+            dst[n ++] = a + (src[i] - a) * f;
+            pos += rs->step;
+        }
+
+        rs->prev[ch] = src[in_frame_count - 1];
+        produced = n;
+    }
+
+    rs->pos = pos - ((uint64_t)in_frame_count << 32);
+    return produced;
+}
+
+static
+size_t
+process_polyphase(audio_resampler *rs, const float *const *in, size_t in_frame_count,
+                  float *const *out, size_t out_ofs)
+{
+    const size_t len = rs->hist_len + in_frame_count;
+    size_t       ipos = 0;
+    size_t       produced = 0;
+    unsigned int phase = 0;
+
+    for (unsigned int ch = 0; ch < rs->channel_count; ch ++) {
+        float *x = rs->work[ch];
+        float *dst = out[ch] + out_ofs;
+        size_t n = 0;
+
+        memcpy(x + rs->hist_len, in[ch], in_frame_count * sizeof(float));
+
+        ipos = rs->skip;
+        phase = rs->phase;
+        while (ipos + POLYPHASE_TAPS <= len) {
+            dst[n ++] = dot_product(rs->bank + phase * POLYPHASE_TAPS, x + ipos);
+
+            phase += rs->down;
+            ipos += phase / rs->up;
+            phase %= rs->up;
+        }
+
+        // keep unprocessed tail as history for the next call
+        if (ipos < len)
+            memmove(x, x + ipos, (len - ipos) * sizeof(float));
+
+        produced = n;
+    }
+
+    rs->phase = phase;
+    if (ipos < len) {
+        rs->hist_len = len - ipos;
+        rs->skip = 0;
+    } else {
+        rs->hist_len = 0;
+        rs->skip = ipos - len;
+    }
+
+    return produced;
+}
+
+size_t
+audio_resampler_process(audio_resampler *rs, const float *const *in, size_t in_frame_count,
+                        float *const *out)
+{
+    if (rs->quality == AUDIO_RESAMPLER_LINEAR)
+        return process_linear(rs, in, in_frame_count, out);
+
+    // work buffers have limited size, so feed input in pieces
+    size_t produced = 0;
+    size_t ofs = 0;
+    while (ofs < in_frame_count) {
+        const size_t chunk = MIN(in_frame_count - ofs, RESAMPLER_CHUNK_FRAMES);
+        const float *in_chunk[RESAMPLER_MAX_CHANNELS];
+
+        for (unsigned int ch = 0; ch < rs->channel_count; ch ++)
+            in_chunk[ch] = in[ch] + ofs;
+
+        produced += process_polyphase(rs, in_chunk, chunk, out, produced);
+        ofs += chunk;
+    }
+
+    return produced;
+}
+
+audio_s16_resampler *
+audio_s16_resampler_new(unsigned int in_rate, unsigned int out_rate, unsigned int channel_count,
+                        size_t max_in_frame_count)
+{
+    audio_s16_resampler *rs = calloc(1, sizeof(*rs));
+    if (!rs)
+        return NULL;
+
+    rs->channel_count = channel_count;
+    rs->max_in_frame_count = max_in_frame_count;
+    rs->rs = audio_resampler_new(in_rate, out_rate, channel_count, AUDIO_RESAMPLER_POLYPHASE);
+    if (!rs->rs) {
+        // ratio is too complex for polyphase filter
+        rs->rs = audio_resampler_new(in_rate, out_rate, channel_count, AUDIO_RESAMPLER_LINEAR);
+    }
+    if (!rs->rs)
+        goto err;
+
+    rs->max_out_frame_count = audio_resampler_max_output_frames(rs->rs, max_in_frame_count);
+    for (unsigned int ch = 0; ch < channel_count; ch ++) {
+        rs->planar_in[ch] = malloc(max_in_frame_count * sizeof(float));
+        rs->planar_out[ch] = malloc(rs->max_out_frame_count * sizeof(float));
+        if (!rs->planar_in[ch] || !rs->planar_out[ch])
+            goto err;
+    }
+
+    return rs;
+
+err:
+    audio_s16_resampler_free(rs);
+    return NULL;
+}
+
+void
+audio_s16_resampler_free(audio_s16_resampler *rs)
+{
+    if (!rs)
+        return;
+
+    for (unsigned int ch = 0; ch < RESAMPLER_MAX_CHANNELS; ch ++) {
+        free(rs->planar_in[ch]);
+        free(rs->planar_out[ch]);
+    }
+    audio_resampler_free(rs->rs);
+    free(rs);
+}
+
+size_t
+audio_s16_resampler_max_output_frames(audio_s16_resampler *rs)
+{
+    return rs->max_out_frame_count;
+}
+
+size_t
+audio_s16_resampler_process(audio_s16_resampler *rs, const int16_t *in, size_t in_frame_count,
+                            int16_t *out)
+{
+    size_t out_frame_count;
+
+    in_frame_count = MIN(in_frame_count, rs->max_in_frame_count);
+
+    if (rs->channel_count == 2) {
+        audio_dsp_deinterleave_s16_to_float(in, rs->planar_in[0], rs->planar_in[1],
+                                            in_frame_count);
+    } else {
+        audio_dsp_s16_to_float(in, rs->planar_in[0], in_frame_count);
+    }
+
+    out_frame_count = audio_resampler_process(rs->rs, (const float *const *)rs->planar_in,
+                                              in_frame_count, rs->planar_out);
+
+    if (rs->channel_count == 2) {
+        audio_dsp_interleave_float_to_s16(rs->planar_out[0], rs->planar_out[1], out,
+                                          out_frame_count);
+    } else {
+        audio_dsp_float_to_s16(rs->planar_out[0], out, out_frame_count);
+    }
+
+    return out_frame_count;
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright © 2013-2015  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPP_AUDIO_DSP_H
+#define FPP_AUDIO_DSP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/// sample format conversion, floats are in [-1.0, 1.0] range
+void
+audio_dsp_s16_to_float(const int16_t *src, float *dst, size_t count);
+
+void
+audio_dsp_float_to_s16(const float *src, int16_t *dst, size_t count);
+
+/// splits interleaved stereo into two planar channels
+void
+audio_dsp_deinterleave_s16_to_float(const int16_t *src, float *dst_l, float *dst_r,
+                                    size_t frame_count);
+
+/// merges two planar channels into interleaved stereo
+void
+audio_dsp_interleave_float_to_s16(const float *src_l, const float *src_r, int16_t *dst,
+                                  size_t frame_count);
+
+/// scales samples by @gain, zero gain mutes
+void
+audio_dsp_apply_gain_s16(int16_t *buf, size_t count, float gain);
+
+/// adds @src to @dst with saturation
+void
+audio_dsp_mix_s16(int16_t *dst, const int16_t *src, size_t count);
+
+/// averages channels of interleaved @src into mono @dst, which may point to @src
+void
+audio_dsp_downmix_s16(const int16_t *src, int16_t *dst, size_t frame_count,
+                      unsigned int channel_count);
+
+
+typedef enum {
+    AUDIO_RESAMPLER_LINEAR,
+    AUDIO_RESAMPLER_POLYPHASE,
+} audio_resampler_quality;
+
+/// sample rate converter for planar float data
+typedef struct audio_resampler_s audio_resampler;
+
+/// creates resampler
+///
+/// Returns NULL if polyphase filter can't be built for the given pair of rates, as its size
+/// depends on rate ratio. Linear resampler works with any rates.
+audio_resampler *
+audio_resampler_new(unsigned int in_rate, unsigned int out_rate, unsigned int channel_count,
+                    audio_resampler_quality quality);
+
+void
+audio_resampler_free(audio_resampler *rs);
+
+/// upper bound of number of frames audio_resampler_process() produces from @in_frame_count
+size_t
+audio_resampler_max_output_frames(audio_resampler *rs, size_t in_frame_count);
+
+/// converts all @in_frame_count input frames, returns number of frames written to @out
+///
+/// Each of @out channels should have room for audio_resampler_max_output_frames() frames.
+size_t
+audio_resampler_process(audio_resampler *rs, const float *const *in, size_t in_frame_count,
+                        float *const *out);
+
+
+/// sample rate converter for interleaved 16-bit data, mono or stereo
+///
+/// Uses polyphase filter when possible, and falls back to linear interpolation otherwise.
+typedef struct audio_s16_resampler_s audio_s16_resampler;
+
+audio_s16_resampler *
+audio_s16_resampler_new(unsigned int in_rate, unsigned int out_rate, unsigned int channel_count,
+                        size_t max_in_frame_count);
+
+void
+audio_s16_resampler_free(audio_s16_resampler *rs);
+
+/// upper bound of number of frames produced from max_in_frame_count input frames
+size_t
+audio_s16_resampler_max_output_frames(audio_s16_resampler *rs);
+
+/// converts up to max_in_frame_count frames, returns number of frames written to @out
+///
+/// @out may point to the same buffer as @in, if it's large enough.
+size_t
+audio_s16_resampler_process(audio_s16_resampler *rs, const int16_t *in, size_t in_frame_count,
+                            int16_t *out);
+
+#endif // FPP_AUDIO_DSP_H
@@ -0,0 +1,189 @@
+/*
+ * Copyright © 2013-2015  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "audio_ringbuffer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <glib.h>
+#include <sys/mman.h>
+
+
+struct audio_ringbuffer_s {
+    char           *data;
+    size_t          size;       ///< always a power of two
+    size_t          mask;
+    int             locked;
+
+    // Positions grow monotonically and are wrapped by masking. Since size is a power of two,
+    // unsigned overflow doesn't break their difference.
+    size_t          read_pos  __attribute__((aligned(64)));
+    size_t          write_pos __attribute__((aligned(64)));
+};
+
+
+audio_ringbuffer *
+audio_ringbuffer_new(size_t size)
+{
+    audio_ringbuffer *rb = calloc(1, sizeof(*rb));
+    if (!rb)
+        return NULL;
+
+    rb->size = 1;
+    while (rb->size < size)
+        rb->size <<= 1;
+    rb->mask = rb->size - 1;
+
+    rb->data = calloc(1, rb->size);
+    if (!rb->data) {
+        free(rb);
+        return NULL;
+    }
+
+    return rb;
+}
+
+void
+audio_ringbuffer_free(audio_ringbuffer *rb)
+{
+    if (!rb)
+        return;
+
+    if (rb->locked)
+        munlock(rb->data, rb->size);
+    free(rb->data);
+    free(rb);
+}
+
+int
+audio_ringbuffer_mlock(audio_ringbuffer *rb)
+{
+    // mlock() also faults in all pages of the range
+    if (mlock(rb->data, rb->size) != 0)
+        return -1;
+
+    rb->locked = 1;
+    return 0;
+}
+
+size_t
+audio_ringbuffer_size(audio_ringbuffer *rb)
+{
+    return rb->size;
+}
+
+size_t
+audio_ringbuffer_read_space(audio_ringbuffer *rb)
+{
+    const size_t w = __atomic_load_n(&rb->write_pos, __ATOMIC_ACQUIRE);
+    const size_t r = __atomic_load_n(&rb->read_pos, __ATOMIC_RELAXED);
+    return w - r;
+}
+
+size_t
+audio_ringbuffer_write_space(audio_ringbuffer *rb)
+{
+    const size_t r = __atomic_load_n(&rb->read_pos, __ATOMIC_ACQUIRE);
+    const size_t w = __atomic_load_n(&rb->write_pos, __ATOMIC_RELAXED);
+    return rb->size - (w - r);
+}
+
+void *
+audio_ringbuffer_get_read_ptr(audio_ringbuffer *rb, size_t *len)
+{
+    const size_t r = __atomic_load_n(&rb->read_pos, __ATOMIC_RELAXED);
+    const size_t avail = audio_ringbuffer_read_space(rb);
+    const size_t ofs = r & rb->mask;
+
+    *len = MIN(avail, rb->size - ofs);
+    return rb->data + ofs;
+}
+
+void
+audio_ringbuffer_read_advance(audio_ringbuffer *rb, size_t len)
+{
+    const size_t r = __atomic_load_n(&rb->read_pos, __ATOMIC_RELAXED);
+    __atomic_store_n(&rb->read_pos, r + len, __ATOMIC_RELEASE);
+}
+
+void *
+audio_ringbuffer_get_write_ptr(audio_ringbuffer *rb, size_t *len)
+{
+    const size_t w = __atomic_load_n(&rb->write_pos, __ATOMIC_RELAXED);
+    const size_t avail = audio_ringbuffer_write_space(rb);
+    const size_t ofs = w & rb->mask;
+
+    *len = MIN(avail, rb->size - ofs);
+    return rb->data + ofs;
+}
+
+void
+audio_ringbuffer_write_advance(audio_ringbuffer *rb, size_t len)
+{
+    const size_t w = __atomic_load_n(&rb->write_pos, __ATOMIC_RELAXED);
+    __atomic_store_n(&rb->write_pos, w + len, __ATOMIC_RELEASE);
+}
+
+size_t
+audio_ringbuffer_read(audio_ringbuffer *rb, void *dst, size_t len)
+{
+    size_t done = 0;
+
+    // at most two iterations: till the end of the buffer, and from its beginning
+    while (done < len) {
+        size_t chunk;
+        void  *src = audio_ringbuffer_get_read_ptr(rb, &chunk);
+
+        chunk = MIN(chunk, len - done);
+        if (chunk == 0)
+            break;
+
+        memcpy((char *)dst + done, src, chunk);
+        audio_ringbuffer_read_advance(rb, chunk);
+        done += chunk;
+    }
+
+    return done;
+}
+
+size_t
+audio_ringbuffer_write(audio_ringbuffer *rb, const void *src, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        size_t chunk;
+        void  *dst = audio_ringbuffer_get_write_ptr(rb, &chunk);
+
+        chunk = MIN(chunk, len - done);
+        if (chunk == 0)
+            break;
+
+        memcpy(dst, (const char *)src + done, chunk);
+        audio_ringbuffer_write_advance(rb, chunk);
+        done += chunk;
+    }
+
+    return done;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright © 2013-2015  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPP_AUDIO_RINGBUFFER_H
+#define FPP_AUDIO_RINGBUFFER_H
+
+#include <stddef.h>
+
+
+/// lock-free ring buffer with a single producer and a single consumer
+///
+/// Neither reading nor writing side takes locks or allocates memory, so both can be used from
+/// real-time threads.
+typedef struct audio_ringbuffer_s audio_ringbuffer;
+
+
+/// creates ring buffer which can hold at least @size bytes
+audio_ringbuffer *
+audio_ringbuffer_new(size_t size);
+
+void
+audio_ringbuffer_free(audio_ringbuffer *rb);
+
+/// locks ring storage in memory, so accessing it never causes page faults
+///
+/// Returns 0 on success. Memory is unlocked by audio_ringbuffer_free().
+int
+audio_ringbuffer_mlock(audio_ringbuffer *rb);
+
+/// actual capacity, in bytes
+size_t
+audio_ringbuffer_size(audio_ringbuffer *rb);
+
+/// number of bytes available for reading
+size_t
+audio_ringbuffer_read_space(audio_ringbuffer *rb);
+
+/// number of bytes available for writing
+size_t
+audio_ringbuffer_write_space(audio_ringbuffer *rb);
+
+/// copies up to @len bytes out of the ring, returns number of bytes read
+size_t
+audio_ringbuffer_read(audio_ringbuffer *rb, void *dst, size_t len);
+
+/// copies up to @len bytes into the ring, returns number of bytes written
+size_t
+audio_ringbuffer_write(audio_ringbuffer *rb, const void *src, size_t len);
+
+/// returns pointer to the contiguous readable region, and its length in @len
+///
+/// Data is consumed by a subsequent audio_ringbuffer_read_advance() call.
+void *
+audio_ringbuffer_get_read_ptr(audio_ringbuffer *rb, size_t *len);
+
+void
+audio_ringbuffer_read_advance(audio_ringbuffer *rb, size_t len);
+
+/// returns pointer to the contiguous writable region, and its length in @len
+///
+/// Data becomes visible to reader after a subsequent audio_ringbuffer_write_advance() call.
+void *
+audio_ringbuffer_get_write_ptr(audio_ringbuffer *rb, size_t *len);
+
+void
+audio_ringbuffer_write_advance(audio_ringbuffer *rb, size_t len);
+
+#endif // FPP_AUDIO_RINGBUFFER_H
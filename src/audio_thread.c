@@ -24,9 +24,22 @@
 
 #include "audio_thread.h"
 #include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include "compat.h"
+#include "config.h"
+#include "trace.h"
 
 extern audio_stream_ops audio_alsa;
 extern audio_stream_ops audio_noaudio;
+extern audio_stream_ops audio_bench;
 #if HAVE_PULSEAUDIO
 extern audio_stream_ops audio_pulse;
 #endif
@@ -38,6 +51,9 @@ extern audio_stream_ops audio_jack;
 audio_stream_ops *
 audio_select_implementation(void)
 {
+    if (audio_bench.available())
+        return &audio_bench;
+
 #if HAVE_JACK
     if (audio_jack.available())
         return &audio_jack;
@@ -65,3 +81,190 @@ audio_capture_device_list_free(audio_device_name *list)
     }
     free(list);
 }
+
+void
+audio_latency_controller_init(audio_latency_controller *lc, size_t min, size_t max,
+                              size_t step, uint32_t shrink_after)
+{
+    lc->min = MAX(min, step);
+    lc->max = MAX(max, lc->min);
+    lc->step = MAX(step, 1);
+    lc->target = lc->min;
+    lc->shrink_after = shrink_after;
+    lc->quiet_ticks = 0;
+}
+
+size_t
+audio_latency_controller_underrun(audio_latency_controller *lc)
+{
+    lc->quiet_ticks = 0;
+    lc->target = MIN(lc->target + MAX(lc->target / 2, lc->step), lc->max);
+    return lc->target;
+}
+
+size_t
+audio_latency_controller_tick(audio_latency_controller *lc)
+{
+    lc->quiet_ticks ++;
+    if (lc->quiet_ticks >= lc->shrink_after) {
+        lc->quiet_ticks = 0;
+        if (lc->target >= lc->min + lc->step)
+            lc->target -= lc->step;
+        else
+            lc->target = lc->min;
+    }
+
+    return lc->target;
+}
+
+#if HAVE_GLIB_DBUS
+// reads integer property of RealtimeKit, returns -1 if there is no such property or no rtkit
+static
+gint64
+get_rtkit_property(GDBusConnection *conn, const char *name)
+{
+    GError   *error = NULL;
+    GVariant *res, *value;
+    gint64    result = -1;
+
+    res = g_dbus_connection_call_sync(conn, "org.freedesktop.RealtimeKit1",
+                                      "/org/freedesktop/RealtimeKit1",
+                                      "org.freedesktop.DBus.Properties", "Get",
+                                      g_variant_new("(ss)", "org.freedesktop.RealtimeKit1", name),
+                                      G_VARIANT_TYPE("(v)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                                      &error);
+    if (!res) {
+        trace_warning("%s, can't get %s, %s\n", __func__, name, error->message);
+        g_clear_error(&error);
+        return -1;
+    }
+
+    g_variant_get(res, "(v)", &value);
+    if (g_variant_is_of_type(value, G_VARIANT_TYPE_INT64))
+        result = g_variant_get_int64(value);
+    else if (g_variant_is_of_type(value, G_VARIANT_TYPE_INT32))
+        result = g_variant_get_int32(value);
+
+    g_variant_unref(value);
+    g_variant_unref(res);
+    return result;
+}
+
+// asks RealtimeKit to promote calling thread, for the case when process have no rights
+// to do that itself
+static
+int
+make_realtime_with_rtkit(int priority)
+{
+    GError          *error = NULL;
+    GDBusConnection *conn;
+    GVariant        *res;
+    int              ret = -1;
+
+    conn = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
+    if (!conn) {
+        trace_warning("%s, can't connect to system bus, %s\n", __func__, error->message);
+        g_clear_error(&error);
+        return -1;
+    }
+
+    // don't touch process limits unless rtkit is there and would accept the priority
+    const gint64 max_priority = get_rtkit_property(conn, "MaxRealtimePriority");
+    const gint64 rttime_max = get_rtkit_property(conn, "RTTimeUSecMax");
+    if (max_priority < priority || rttime_max <= 0)
+        goto done;
+
+    // rtkit refuses to promote threads of processes without RLIMIT_RTTIME set. The limit is
+    // per-process and can't be raised back without privileges, so it's set just for the call,
+    // and restored if the call fails
+    struct rlimit old_rl, rl;
+    int rl_changed = 0;
+    if (getrlimit(RLIMIT_RTTIME, &old_rl) == 0 &&
+        (old_rl.rlim_max == RLIM_INFINITY || old_rl.rlim_max > (rlim_t)rttime_max))
+    {
+        rl.rlim_cur = rl.rlim_max = rttime_max;
+        rl_changed = (setrlimit(RLIMIT_RTTIME, &rl) == 0);
+    }
+
+    res = g_dbus_connection_call_sync(conn, "org.freedesktop.RealtimeKit1",
+                                      "/org/freedesktop/RealtimeKit1",
+                                      "org.freedesktop.RealtimeKit1", "MakeThreadRealtime",
+                                      g_variant_new("(tu)", (guint64)syscall(SYS_gettid),
+                                                    (guint32)priority),
+                                      NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+    if (!res) {
+        trace_warning("%s, MakeThreadRealtime failed, %s\n", __func__, error->message);
+        g_clear_error(&error);
+        if (rl_changed && setrlimit(RLIMIT_RTTIME, &old_rl) != 0)
+            trace_warning("%s, can't restore RLIMIT_RTTIME\n", __func__);
+        goto done;
+    }
+
+    if (rl_changed) {
+        trace_info("%s, RLIMIT_RTTIME of the process set to %u us\n", __func__,
+                   (unsigned)rttime_max);
+    }
+
+    g_variant_unref(res);
+    ret = 0;
+
+done:
+    g_object_unref(conn);
+    return ret;
+}
+#endif // HAVE_GLIB_DBUS
+
+int
+audio_thread_make_realtime(int priority_offset)
+{
+    struct sched_param  param;
+    int                 policy;
+
+    if (config.audio_realtime_priority <= 0)
+        goto done;
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = MAX(config.audio_realtime_priority - priority_offset, 1);
+    param.sched_priority = MIN(param.sched_priority, sched_get_priority_max(SCHED_FIFO));
+
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0)
+        goto done;
+
+#if HAVE_GLIB_DBUS
+    if (make_realtime_with_rtkit(param.sched_priority) == 0)
+        goto done;
+#endif
+
+    trace_warning("%s, can't enable realtime scheduling\n", __func__);
+
+done:
+    if (pthread_getschedparam(pthread_self(), &policy, &param) != 0)
+        policy = SCHED_OTHER;
+
+    if (config.audio_realtime_priority > 0)
+        trace_info("%s, thread scheduling policy %d, priority %d\n", __func__, policy,
+                   param.sched_priority);
+
+    return policy;
+}
+
+void
+audio_thread_lock_memory(void *ptr, size_t sz)
+{
+    if (!ptr || sz == 0 || config.audio_realtime_priority <= 0)
+        return;
+
+    // mlock() also faults in all pages of the range, so no page fault would happen later
+    // in audio threads
+    if (mlock(ptr, sz) != 0)
+        trace_warning("%s, mlock failed\n", __func__);
+}
+
+void
+audio_thread_unlock_memory(void *ptr, size_t sz)
+{
+    if (!ptr || sz == 0 || config.audio_realtime_priority <= 0)
+        return;
+
+    munlock(ptr, sz);
+}
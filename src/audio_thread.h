@@ -25,6 +25,7 @@
 #ifndef FPP_AUDIO_THREAD_H
 #define FPP_AUDIO_THREAD_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 
@@ -40,6 +41,17 @@ typedef struct {
 
 typedef struct audio_stream_s audio_stream;
 
+typedef struct {
+    uint32_t    callback_count;     ///< number of plugin callback invocations
+    uint32_t    underrun_count;     ///< times device wanted data which wasn't ready yet
+    uint32_t    overrun_count;      ///< times captured data was dropped for lack of space
+    uint32_t    xrun_count;         ///< xruns reported by sound server
+    uint32_t    max_callback_latency_us;    ///< longest plugin callback invocation
+    int         sched_policy;       ///< scheduling policy of thread calling plugin callbacks
+    uint32_t    min_request_frames; ///< smallest amount of data requested by sound server
+    uint32_t    max_request_frames; ///< largest amount of data requested by sound server
+} audio_stream_stats;
+
 typedef void
 (audio_stream_capture_cb_f)(const void *buf, uint32_t sz, double latency, void *user_data);
 
@@ -70,6 +82,9 @@ typedef void
 typedef void
 (audio_destroy_stream_f)(audio_stream *s);
 
+typedef void
+(audio_get_stream_stats_f)(audio_stream *s, audio_stream_stats *stats);
+
 typedef struct {
     audio_available_f                  *available;
     audio_create_playback_stream_f     *create_playback_stream;
@@ -77,6 +92,7 @@ typedef struct {
     audio_enumerate_capture_devices_f  *enumerate_capture_devices;
     audio_pause_stream_f               *pause;
     audio_destroy_stream_f             *destroy;
+    audio_get_stream_stats_f           *get_stats;     ///< optional, may be NULL
 } audio_stream_ops;
 
 
@@ -86,5 +102,45 @@ audio_select_implementation(void);
 void
 audio_capture_device_list_free(audio_device_name *list);
 
+/// adjusts amount of buffered data, based on underrun history
+///
+/// Values are in arbitrary units, usually bytes. Target grows by a half on each underrun and
+/// shrinks by one step after a long enough period without underruns.
+typedef struct {
+    size_t      min;
+    size_t      max;
+    size_t      step;
+    size_t      target;
+    uint32_t    shrink_after;   ///< number of ticks without underruns before shrinking
+    uint32_t    quiet_ticks;
+} audio_latency_controller;
+
+void
+audio_latency_controller_init(audio_latency_controller *lc, size_t min, size_t max,
+                              size_t step, uint32_t shrink_after);
+
+/// registers underrun, returns new target
+size_t
+audio_latency_controller_underrun(audio_latency_controller *lc);
+
+/// registers a period without underruns, returns new target
+size_t
+audio_latency_controller_tick(audio_latency_controller *lc);
+
+/// promotes calling thread to SCHED_FIFO, if enabled by audio_realtime_priority in config
+///
+/// Thread priority is lowered by @priority_offset from configured value. Falls back to
+/// RealtimeKit if process have no rights to change its scheduling policy.
+/// Returns policy thread ends up with.
+int
+audio_thread_make_realtime(int priority_offset);
+
+/// pre-faults and locks memory region, if realtime audio is enabled in config
+void
+audio_thread_lock_memory(void *ptr, size_t sz);
+
+void
+audio_thread_unlock_memory(void *ptr, size_t sz);
+
 
 #endif // FPP_AUDIO_THREAD_H
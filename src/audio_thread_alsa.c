@@ -25,13 +25,20 @@
 #include "audio_thread.h"
 #include <asoundlib.h>
 #include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdint.h>
 #include <glib.h>
 #include <unistd.h>
+#include <time.h>
 #include "trace.h"
 #include "config.h"
 #include "utils.h"
 #include "eintr_retry.h"
 #include "ppb_message_loop.h"
+#include "audio_ringbuffer.h"
+#include "audio_capture.h"
+#include "audio_dsp.h"
 
 
 struct audio_stream_s {
@@ -39,11 +46,40 @@ struct audio_stream_s {
     snd_pcm_t                  *pcm;
     struct pollfd              *fds;
     size_t                      nfds;
+    size_t                      sample_rate;
     size_t                      sample_frame_count;
-    audio_stream_capture_cb_f  *capture_cb;
+    size_t                      frame_size;
+    size_t                      period_frames;
     audio_stream_playback_cb_f *playback_cb;
     void                       *cb_user_data;
     volatile int                paused;
+    audio_capture              *capture;            ///< capture streams only
+
+    // All playback streams are mixed into a single device stream. Device stream owns pcm
+    // and fds, and has list of its inputs. Inputs have no pcm.
+    GList                      *inputs;             ///< protected by mixer_lock
+    int16_t                    *mix_buf;
+    size_t                      mix_buf_frames;
+    audio_stream               *mixer;              ///< device stream input is mixed into
+
+    // Inputs with sample rate different from device one are resampled by producer thread
+    audio_s16_resampler        *resampler;
+    size_t                      out_chunk_frames;   ///< frames, produced from one callback
+    int16_t                    *cb_buf;             ///< plugin data before resampling or copying
+
+    // Playback data is prepared ahead of time by a producer thread, so slow plugin callback
+    // doesn't stall audio thread, which serves all streams.
+    audio_ringbuffer           *rb;
+    audio_latency_controller    latency_ctl;        ///< how much data to keep in rb, in bytes
+    volatile gint               device_delay_frames;    ///< device stream only
+    pthread_t                   producer_thread;
+    int                         producer_started;
+    sem_t                       producer_sem;       ///< posted when data is consumed from rb
+    volatile gint               terminate_producer;
+    volatile gint               callback_count;
+    volatile gint               underrun_count;
+    volatile gint               max_callback_latency_us;
+    volatile gint               sched_policy;
 };
 
 static GHashTable      *active_streams_ht = NULL;
@@ -57,6 +93,13 @@ static pthread_t        audio_thread_id;
 static pthread_mutex_t  lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_barrier_t stream_list_update_barrier;
 
+// device stream all playback streams are mixed into. Its sample rate is set by the first
+// playback stream
+static audio_stream    *mixer_stream = NULL;
+static pthread_mutex_t  mixer_lock = PTHREAD_MUTEX_INITIALIZER;
+// serializes mixer creation and destruction, never taken by audio thread
+static pthread_mutex_t  mixer_create_lock = PTHREAD_MUTEX_INITIALIZER;
+
 
 static
 void
@@ -98,6 +141,12 @@ process_stream_deletions_unlocked(void)
         for (uintptr_t k = 0; k < as->nfds; k ++)
             g_hash_table_remove(stream_by_fd_ht, GINT_TO_POINTER(as->fds[k].fd));
         snd_pcm_close(as->pcm);
+        audio_ringbuffer_free(as->rb);
+        audio_capture_free(as->capture);
+        sem_destroy(&as->producer_sem);
+        audio_thread_unlock_memory(as->mix_buf, as->mix_buf_frames * as->frame_size);
+        free(as->mix_buf);
+        free(as->fds);
         free(as);
 
         ll = g_list_next(ll);
@@ -168,15 +217,92 @@ err:
     return nfds;
 }
 
+// mixes data, prepared by producer threads, and writes it to the device
+static
+void
+write_playback_data(audio_stream *mixer, size_t avail_frames)
+{
+    const size_t frame_size = mixer->frame_size;
+    const size_t samples_per_frame = frame_size / sizeof(int16_t);
+    size_t       frame_count = MIN(avail_frames, mixer->mix_buf_frames);
+    size_t       min_input_frames = SIZE_MAX;
+    int          have_active_inputs = 0;
+
+    pthread_mutex_lock(&mixer_lock);
+
+    // write only as much as every input can supply, so inputs with less buffered data don't get
+    // silence spliced in. But at least a period, otherwise poll() will return immediately again
+    for (GList *ll = mixer->inputs; ll != NULL; ll = g_list_next(ll)) {
+        audio_stream *as = ll->data;
+        if (g_atomic_int_get(&as->paused))
+            continue;
+        have_active_inputs = 1;
+        min_input_frames = MIN(min_input_frames, audio_ringbuffer_read_space(as->rb) / frame_size);
+    }
+
+    if (have_active_inputs)
+        frame_count = MIN(frame_count, MAX(min_input_frames, mixer->period_frames));
+
+    memset(mixer->mix_buf, 0, frame_count * frame_size);
+
+    for (GList *ll = mixer->inputs; ll != NULL; ll = g_list_next(ll)) {
+        audio_stream *as = ll->data;
+        size_t        mixed = 0;
+
+        if (g_atomic_int_get(&as->paused))
+            continue;
+
+        const size_t to_mix = MIN(audio_ringbuffer_read_space(as->rb) / frame_size, frame_count);
+        while (mixed < to_mix) {
+            size_t len;
+            const int16_t *ptr = audio_ringbuffer_get_read_ptr(as->rb, &len);
+            const size_t chunk = MIN(len / frame_size, to_mix - mixed);
+
+            audio_dsp_mix_s16(mixer->mix_buf + mixed * samples_per_frame, ptr,
+                              chunk * samples_per_frame);
+            audio_ringbuffer_read_advance(as->rb, chunk * frame_size);
+            mixed += chunk;
+        }
+
+        // ring ran empty, producer is late
+        if (mixed < frame_count)
+            g_atomic_int_inc(&as->underrun_count);
+
+        // let producer refill the buffer
+        sem_post(&as->producer_sem);
+    }
+
+    pthread_mutex_unlock(&mixer_lock);
+
+    size_t written = 0;
+    while (written < frame_count) {
+        snd_pcm_sframes_t res = snd_pcm_writei(mixer->pcm,
+                                               mixer->mix_buf + written * samples_per_frame,
+                                               frame_count - written);
+        if (res < 0) {
+            trace_warning("%s, snd_pcm_writei error %d\n", __func__, (int)res);
+            recover_pcm(mixer->pcm);
+            break;
+        }
+        written += res;
+    }
+
+    // inputs use device delay to report latency
+    snd_pcm_sframes_t delay;
+    if (snd_pcm_delay(mixer->pcm, &delay) == 0)
+        g_atomic_int_set(&mixer->device_delay_frames, MAX(delay, 0));
+}
+
 static
 void *
 audio_thread(void *param)
 {
     struct pollfd  *fds = NULL;
     nfds_t          nfds = 0;
-    static char     buf[16 * 1024];
+    static int16_t  buf[8 * 1024];      // capture only
 
     ppb_message_loop_mark_thread_unsuitable();
+    audio_thread_make_realtime(0);
 
     nfds = do_rebuild_fds(&fds);
     pthread_barrier_wait(&stream_list_update_barrier);
@@ -229,57 +355,39 @@ audio_thread(void *param)
                 snd_pcm_sframes_t   frame_count = snd_pcm_avail(as->pcm);
 
                 if (revents & POLLIN) {
-                    // POLLIN
-                    const size_t frame_size = 1 * sizeof(int16_t); // mono 16-bit
-                    const size_t max_segment_length = MIN(as->sample_frame_count * frame_size,
-                                                          sizeof(buf));
-                    size_t       to_process = frame_count * frame_size;
-
-                    while (to_process > 0) {
+                    // POLLIN. Data is handed to capture pipeline, which converts it and calls
+                    // plugin from its own thread
+                    const size_t max_segment_frames = sizeof(buf) / as->frame_size;
+                    snd_pcm_sframes_t delay = 0;
+                    snd_pcm_delay(as->pcm, &delay);
+                    const double latency = (double)MAX(delay, 0) / as->sample_rate;
+
+                    while (frame_count > 0) {
+                        const size_t segment_frames = MIN(frame_count, max_segment_frames);
                         snd_pcm_sframes_t frames_read;
-                        const size_t segment_length = MIN(to_process, max_segment_length);
 
-                        frames_read = snd_pcm_readi(as->pcm, buf, segment_length / frame_size);
+                        frames_read = snd_pcm_readi(as->pcm, buf, segment_frames);
                         if (frames_read < 0) {
                             trace_warning("%s, snd_pcm_readi error %d\n", __func__,
                                           (int)frames_read);
                             recover_pcm(as->pcm);
-                            continue;
+                            break;
                         }
 
-                        if (!paused && as->capture_cb)
-                            as->capture_cb(buf, frames_read * frame_size, 0, as->cb_user_data);
+                        if (!paused && as->capture)
+                            audio_capture_push(as->capture, buf, frames_read, latency);
 
-                        to_process -= frames_read * frame_size;
+                        frame_count -= frames_read;
                     }
 
                 } else {
                     // POLLOUT
-                    const size_t frame_size = 2 * sizeof(int16_t); // stereo 16-bit
-                    const size_t max_segment_length = MIN(as->sample_frame_count * frame_size,
-                                                          sizeof(buf));
-                    size_t       to_process = frame_count * frame_size;
-
-                    while (to_process > 0) {
-                        snd_pcm_sframes_t frames_written;
-                        const size_t segment_length = MIN(to_process, max_segment_length);
-
-                        if (paused || !as->playback_cb)
-                            memset(buf, 0, segment_length);
-                        else
-                            as->playback_cb(buf, segment_length, 0, as->cb_user_data);
-
-                        frames_written = snd_pcm_writei(as->pcm, buf, segment_length / frame_size);
-
-                        if (frames_written < 0) {
-                            trace_warning("%s, snd_pcm_writei error %d\n", __func__,
-                                          (int)frames_written);
-                            recover_pcm(as->pcm);
-                            continue;
-                        }
-
-                        to_process -= frames_written * frame_size;
+                    if (frame_count < 0) {
+                        recover_pcm(as->pcm);
+                        continue;
                     }
+
+                    write_playback_data(as, frame_count);
                 }
             }
         }
@@ -326,6 +434,92 @@ destructor_audio_thread_alsa(void)
     close(notification_pipe[1]);
 }
 
+static
+void *
+playback_producer_thread(void *param)
+{
+    audio_stream *as = param;
+    const size_t  chunk = as->out_chunk_frames * as->frame_size;
+    const double  device_rate = as->mixer->sample_rate;
+    uint32_t      seen_underruns = 0;
+    size_t        target_fill = as->latency_ctl.target;
+
+    ppb_message_loop_mark_thread_unsuitable();
+
+    // Producers run plugin code, which may spin. With realtime priority that would starve
+    // the whole system, so they stay at normal priority; ring buffer covers scheduling delays.
+    g_atomic_int_set(&as->sched_policy, SCHED_OTHER);
+
+    while (!g_atomic_int_get(&as->terminate_producer)) {
+        struct timespec t_start, t_end;
+        size_t          len;
+        void           *ptr;
+
+        // grow buffer after underruns, and shrink it slowly while there are none
+        const uint32_t underruns = g_atomic_int_get(&as->underrun_count);
+        if (underruns != seen_underruns) {
+            seen_underruns = underruns;
+            target_fill = audio_latency_controller_underrun(&as->latency_ctl);
+        }
+
+        if (g_atomic_int_get(&as->paused) ||
+            audio_ringbuffer_read_space(as->rb) >= target_fill ||
+            audio_ringbuffer_write_space(as->rb) < chunk)
+        {
+            // wait until audio thread consumes some data, but wake up periodically to check
+            // for termination
+            struct timespec t;
+            clock_gettime(CLOCK_REALTIME, &t);
+            t.tv_nsec += 100 * 1000 * 1000;
+            if (t.tv_nsec >= 1000 * 1000 * 1000) {
+                t.tv_sec += 1;
+                t.tv_nsec -= 1000 * 1000 * 1000;
+            }
+            RETRY_ON_EINTR(sem_timedwait(&as->producer_sem, &t));
+            continue;
+        }
+
+        // data written now will be played after everything in the ring and in the device
+        const size_t queued_frames = audio_ringbuffer_read_space(as->rb) / as->frame_size +
+                                     g_atomic_int_get(&as->mixer->device_delay_frames);
+        const double latency = queued_frames / device_rate;
+
+        clock_gettime(CLOCK_MONOTONIC, &t_start);
+
+        ptr = audio_ringbuffer_get_write_ptr(as->rb, &len);
+        if (as->resampler) {
+            const size_t n = as->sample_frame_count;
+            as->playback_cb(as->cb_buf, n * as->frame_size, latency, as->cb_user_data);
+
+            // cb_buf has room for resampled data too
+            int16_t *out = (len >= chunk) ? ptr : as->cb_buf;
+            const size_t out_n = audio_s16_resampler_process(as->resampler, as->cb_buf, n, out);
+            if (out == ptr)
+                audio_ringbuffer_write_advance(as->rb, out_n * as->frame_size);
+            else
+                audio_ringbuffer_write(as->rb, out, out_n * as->frame_size);
+        } else if (len >= chunk) {
+            // there is enough contiguous space, let plugin write directly into the ring
+            as->playback_cb(ptr, chunk, latency, as->cb_user_data);
+            audio_ringbuffer_write_advance(as->rb, chunk);
+        } else {
+            as->playback_cb(as->cb_buf, chunk, latency, as->cb_user_data);
+            audio_ringbuffer_write(as->rb, as->cb_buf, chunk);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t_end);
+        const gint latency_us = (t_end.tv_sec - t_start.tv_sec) * 1000 * 1000 +
+                                (t_end.tv_nsec - t_start.tv_nsec) / 1000;
+        if (latency_us > g_atomic_int_get(&as->max_callback_latency_us))
+            g_atomic_int_set(&as->max_callback_latency_us, latency_us);
+
+        g_atomic_int_inc(&as->callback_count);
+        target_fill = audio_latency_controller_tick(&as->latency_ctl);
+    }
+
+    return NULL;
+}
+
 static
 void
 wakeup_audio_thread(void)
@@ -356,8 +550,11 @@ alsa_create_stream(audio_stream_direction direction, unsigned int sample_rate,
     if (!as)
         goto err;
 
+    as->direction = direction;
+    as->sample_rate = sample_rate;
     as->sample_frame_count = sample_frame_count;
     g_atomic_int_set(&as->paused, 1);
+    sem_init(&as->producer_sem, 0, 0);
 
 #define CHECK_A(funcname, params)                                                       \
     do {                                                                                \
@@ -381,8 +578,14 @@ alsa_create_stream(audio_stream_direction direction, unsigned int sample_rate,
     unsigned int rate = sample_rate;
     CHECK_A(snd_pcm_hw_params_set_rate_near, (as->pcm, hw_params, &rate, &dir));
 
-    const int channel_count = (direction == STREAM_PLAYBACK) ? 2 : 1;
-    CHECK_A(snd_pcm_hw_params_set_channels, (as->pcm, hw_params, channel_count));
+    // Playback device is always stereo. Capture prefers mono, but some devices are stereo
+    // only, capture pipeline downmixes their data.
+    unsigned int channel_count = (direction == STREAM_PLAYBACK) ? 2 : 1;
+    if (direction == STREAM_PLAYBACK) {
+        CHECK_A(snd_pcm_hw_params_set_channels, (as->pcm, hw_params, channel_count));
+    } else {
+        CHECK_A(snd_pcm_hw_params_set_channels_near, (as->pcm, hw_params, &channel_count));
+    }
 
     unsigned int period_time = (long long)sample_frame_count * 1000 * 1000 / sample_rate;
     period_time = CLAMP(period_time,
@@ -398,8 +601,32 @@ alsa_create_stream(audio_stream_direction direction, unsigned int sample_rate,
     dir = 0;
     CHECK_A(snd_pcm_hw_params_get_buffer_time, (hw_params, &buffer_time, &dir));
     CHECK_A(snd_pcm_hw_params, (as->pcm, hw_params));
+
+    snd_pcm_uframes_t period_size;
+    snd_pcm_uframes_t buffer_size;
+    dir = 0;
+    CHECK_A(snd_pcm_hw_params_get_period_size, (hw_params, &period_size, &dir));
+    CHECK_A(snd_pcm_hw_params_get_buffer_size, (hw_params, &buffer_size));
     snd_pcm_hw_params_free(hw_params);
 
+    as->frame_size = channel_count * sizeof(int16_t);
+    as->period_frames = period_size;
+
+    // device may not support requested rate exactly
+    as->sample_rate = rate;
+
+    if (direction == STREAM_PLAYBACK) {
+        // mixer device stream, is never paused
+        g_atomic_int_set(&as->paused, 0);
+        as->mix_buf_frames = buffer_size;
+        as->mix_buf = malloc(buffer_size * as->frame_size);
+        if (!as->mix_buf) {
+            trace_error("%s, memory allocation failure\n", __func__);
+            goto err;
+        }
+        audio_thread_lock_memory(as->mix_buf, buffer_size * as->frame_size);
+    }
+
     CHECK_A(snd_pcm_sw_params_malloc, (&sw_params));
     CHECK_A(snd_pcm_sw_params_current, (as->pcm, sw_params));
     CHECK_A(snd_pcm_sw_params, (as->pcm, sw_params));
@@ -429,23 +656,161 @@ alsa_create_stream(audio_stream_direction direction, unsigned int sample_rate,
 
     return as;
 err:
+    if (as) {
+        sem_destroy(&as->producer_sem);
+        audio_thread_unlock_memory(as->mix_buf, as->mix_buf_frames * as->frame_size);
+        free(as->mix_buf);
+    }
     free(as);
     return NULL;
 }
 
+static
+void
+alsa_destroy_stream(audio_stream *as);
+
+// closes device stream if it has no inputs left. Called with mixer_create_lock held
+static
+void
+release_mixer_if_unused(audio_stream *mixer)
+{
+    pthread_mutex_lock(&mixer_lock);
+    const int unused = (mixer->inputs == NULL);
+    if (unused)
+        mixer_stream = NULL;
+    pthread_mutex_unlock(&mixer_lock);
+
+    if (!unused)
+        return;
+
+    pthread_mutex_lock(&lock);
+    streams_to_delete = g_list_prepend(streams_to_delete, mixer);
+    pthread_mutex_unlock(&lock);
+
+    wakeup_audio_thread();
+}
+
+static
+void
+free_playback_stream(audio_stream *as)
+{
+    const size_t cb_buf_frames = MAX(as->sample_frame_count, as->out_chunk_frames);
+
+    audio_ringbuffer_free(as->rb);
+    audio_s16_resampler_free(as->resampler);
+    audio_thread_unlock_memory(as->cb_buf, cb_buf_frames * as->frame_size);
+    free(as->cb_buf);
+    sem_destroy(&as->producer_sem);
+    free(as);
+}
+
+static
+int
+setup_resampling(audio_stream *as, unsigned int device_rate)
+{
+    as->out_chunk_frames = as->sample_frame_count;
+    if (as->sample_rate != device_rate) {
+        as->resampler = audio_s16_resampler_new(as->sample_rate, device_rate, 2,
+                                                as->sample_frame_count);
+        if (!as->resampler)
+            return -1;
+
+        as->out_chunk_frames = audio_s16_resampler_max_output_frames(as->resampler);
+    }
+
+    // also used when ring has no contiguous space for a whole chunk
+    const size_t cb_buf_frames = MAX(as->sample_frame_count, as->out_chunk_frames);
+    as->cb_buf = malloc(cb_buf_frames * as->frame_size);
+    if (!as->cb_buf)
+        return -1;
+    audio_thread_lock_memory(as->cb_buf, cb_buf_frames * as->frame_size);
+
+    return 0;
+}
+
 static
 audio_stream *
 alsa_create_playback_stream(unsigned int sample_rate, unsigned int sample_frame_count,
                             audio_stream_playback_cb_f *cb, void *cb_user_data)
 {
-    audio_stream *as = alsa_create_stream(STREAM_PLAYBACK, sample_rate, sample_frame_count,
-                                          "default");
+    audio_stream *as = calloc(1, sizeof(*as));
     if (!as)
         return NULL;
 
+    as->direction = STREAM_PLAYBACK;
+    as->sample_rate = sample_rate;
+    as->sample_frame_count = sample_frame_count;
+    as->frame_size = 2 * sizeof(int16_t); // stereo 16-bit
     as->playback_cb = cb;
     as->cb_user_data = cb_user_data;
+    g_atomic_int_set(&as->paused, 1);
+    sem_init(&as->producer_sem, 0, 0);
+
+    pthread_mutex_lock(&mixer_create_lock);
+    pthread_mutex_lock(&mixer_lock);
+    audio_stream *mixer = mixer_stream;
+    pthread_mutex_unlock(&mixer_lock);
+
+    if (!mixer) {
+        mixer = alsa_create_stream(STREAM_PLAYBACK, sample_rate, sample_frame_count,
+                                   "default");
+        if (!mixer) {
+            pthread_mutex_unlock(&mixer_create_lock);
+            goto err;
+        }
+        pthread_mutex_lock(&mixer_lock);
+        mixer_stream = mixer;
+        pthread_mutex_unlock(&mixer_lock);
+    }
+
+    const unsigned int device_rate = mixer->sample_rate;
+    if (setup_resampling(as, device_rate) != 0) {
+        trace_error("%s, can't set up resampling from %u Hz to %u Hz\n", __func__, sample_rate,
+                    device_rate);
+        goto err_release_mixer;
+    }
+
+    // keep between audio_buffer_min_ms and audio_buffer_max_ms of data prepared, but
+    // no less than two callbacks worth. Try to shrink buffer every 10 seconds.
+    const size_t chunk = as->out_chunk_frames * as->frame_size;
+    const size_t min_fill = (size_t)device_rate * config.audio_buffer_min_ms / 1000 *
+                            as->frame_size;
+    const size_t max_fill = (size_t)device_rate * config.audio_buffer_max_ms / 1000 *
+                            as->frame_size;
+    const size_t upper = MAX(max_fill, 2 * chunk);
+
+    audio_latency_controller_init(&as->latency_ctl, MIN(MAX(2 * chunk, min_fill), upper), upper,
+                                  chunk, 10 * device_rate / as->out_chunk_frames);
+    as->rb = audio_ringbuffer_new(upper + chunk);
+    if (!as->rb) {
+        trace_error("%s, can't allocate ring buffer\n", __func__);
+        goto err_release_mixer;
+    }
+
+    if (config.audio_realtime_priority > 0 && audio_ringbuffer_mlock(as->rb) != 0)
+        trace_warning("%s, can't lock ring buffer in memory\n", __func__);
+
+    as->mixer = mixer;
+    pthread_mutex_lock(&mixer_lock);
+    mixer->inputs = g_list_prepend(mixer->inputs, as);
+    pthread_mutex_unlock(&mixer_lock);
+    pthread_mutex_unlock(&mixer_create_lock);
+
+    if (pthread_create(&as->producer_thread, NULL, playback_producer_thread, as) != 0) {
+        trace_error("%s, can't create producer thread\n", __func__);
+        alsa_destroy_stream(as);
+        return NULL;
+    }
+    as->producer_started = 1;
+
     return as;
+
+err_release_mixer:
+    release_mixer_if_unused(mixer);
+    pthread_mutex_unlock(&mixer_create_lock);
+err:
+    free_playback_stream(as);
+    return NULL;
 }
 
 static
@@ -518,8 +883,14 @@ alsa_create_capture_stream(unsigned int sample_rate, unsigned int sample_frame_c
     if (!as)
         return NULL;
 
-    as->capture_cb = cb;
-    as->cb_user_data = cb_user_data;
+    as->capture = audio_capture_new(as->sample_rate, as->frame_size / sizeof(int16_t),
+                                    sample_rate, sample_frame_count, cb, cb_user_data);
+    if (!as->capture) {
+        trace_error("%s, can't create capture pipeline\n", __func__);
+        alsa_destroy_stream(as);
+        return NULL;
+    }
+
     return as;
 }
 
@@ -584,12 +955,43 @@ void
 alsa_pause_stream(audio_stream *as, int enabled)
 {
     g_atomic_int_set(&as->paused, enabled);
+    if (!enabled && as->direction == STREAM_PLAYBACK)
+        sem_post(&as->producer_sem);
 }
 
 static
 void
 alsa_destroy_stream(audio_stream *as)
 {
+    // no callbacks should be called after function returns
+    if (as->producer_started) {
+        g_atomic_int_set(&as->terminate_producer, 1);
+        sem_post(&as->producer_sem);
+        pthread_join(as->producer_thread, NULL);
+        as->producer_started = 0;
+    }
+
+    if (as->direction == STREAM_PLAYBACK) {
+        audio_stream *mixer = as->mixer;
+
+        pthread_mutex_lock(&mixer_create_lock);
+        pthread_mutex_lock(&mixer_lock);
+        mixer->inputs = g_list_remove(mixer->inputs, as);
+        pthread_mutex_unlock(&mixer_lock);
+
+        // audio thread accesses inputs only with mixer_lock held, so it's safe to free now
+        free_playback_stream(as);
+
+        // close device when last input is gone
+        release_mixer_if_unused(mixer);
+        pthread_mutex_unlock(&mixer_create_lock);
+        return;
+    }
+
+    // audio thread may still push captured data, pipeline is freed along with stream
+    if (as->capture)
+        audio_capture_stop(as->capture);
+
     pthread_mutex_lock(&lock);
     streams_to_delete = g_list_prepend(streams_to_delete, as);
     pthread_mutex_unlock(&lock);
@@ -597,6 +999,21 @@ alsa_destroy_stream(audio_stream *as)
     wakeup_audio_thread();
 }
 
+static
+void
+alsa_get_stream_stats(audio_stream *as, audio_stream_stats *stats)
+{
+    if (as->capture) {
+        audio_capture_get_stats(as->capture, stats);
+        return;
+    }
+
+    stats->callback_count = g_atomic_int_get(&as->callback_count);
+    stats->underrun_count = g_atomic_int_get(&as->underrun_count);
+    stats->max_callback_latency_us = g_atomic_int_get(&as->max_callback_latency_us);
+    stats->sched_policy = g_atomic_int_get(&as->sched_policy);
+}
+
 static
 int
 alsa_available(void)
@@ -634,4 +1051,5 @@ audio_stream_ops audio_alsa = {
     .enumerate_capture_devices =    alsa_enumerate_capture_devices,
     .pause =                        alsa_pause_stream,
     .destroy =                      alsa_destroy_stream,
+    .get_stats =                    alsa_get_stream_stats,
 };
@@ -0,0 +1,341 @@
+/*
+ * Copyright © 2013-2015  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "audio_thread_bench.h"
+#include "audio_capture.h"
+#include "config.h"
+#include "ppb_message_loop.h"
+#include "trace.h"
+#include <glib.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define TONE_FREQUENCY  440.0
+
+
+struct audio_stream_s {
+    audio_stream_direction      direction;
+    unsigned int                sample_rate;
+    size_t                      sample_frame_count;
+    audio_stream_playback_cb_f *playback_cb;
+    void                       *cb_user_data;
+    audio_capture              *capture;            ///< capture streams only
+    int16_t                    *buf;                ///< interleaved stereo
+    uint64_t                    tone_phase;
+    volatile gint               paused;
+    volatile gint               terminate;
+    pthread_t                   thread;
+
+    pthread_mutex_t             lock;               ///< protects fields below
+    uint64_t                    frame_count;
+    uint32_t                    callback_count;
+    int64_t                     wall_time_ns;
+    int64_t                     callback_ns_total;
+    int64_t                     callback_ns_max;
+    int64_t                     jitter_ns_total;
+    int64_t                     jitter_ns_max;
+};
+
+
+static
+int64_t
+timespec_to_ns(struct timespec t)
+{
+    return (int64_t)t.tv_sec * 1000 * 1000 * 1000 + t.tv_nsec;
+}
+
+static
+struct timespec
+ns_to_timespec(int64_t ns)
+{
+    return (struct timespec){ .tv_sec = ns / (1000 * 1000 * 1000),
+                              .tv_nsec = ns % (1000 * 1000 * 1000) };
+}
+
+static
+int64_t
+monotonic_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return timespec_to_ns(t);
+}
+
+// fills buf with a stereo tone, as a microphone would capture it
+static
+void
+generate_tone(audio_stream *as)
+{
+    for (size_t k = 0; k < as->sample_frame_count; k ++) {
+        const double t = (double)(as->tone_phase + k) / as->sample_rate;
+        const int16_t v = 16000 * sin(2 * M_PI * TONE_FREQUENCY * t);
+        as->buf[2 * k] = v;
+        as->buf[2 * k + 1] = v;
+    }
+    as->tone_phase += as->sample_frame_count;
+}
+
+static
+void *
+bench_thread(void *param)
+{
+    audio_stream *as = param;
+    const double  speed = MAX(config.audio_bench_speed, 1);
+    const int64_t period_ns = 1e9 * as->sample_frame_count / as->sample_rate / speed;
+    int64_t       next = 0;
+    int64_t       prev_end = 0;
+
+    ppb_message_loop_mark_thread_unsuitable();
+
+    while (!g_atomic_int_get(&as->terminate)) {
+        if (g_atomic_int_get(&as->paused)) {
+            usleep(10 * 1000);
+            next = 0;
+            continue;
+        }
+
+        if (next == 0) {
+            // (re)starting, schedule begins now
+            next = prev_end = monotonic_ns();
+        }
+
+        struct timespec deadline = ns_to_timespec(next);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) != 0) {
+            // interrupted by a signal
+        }
+
+        const int64_t start = monotonic_ns();
+        if (as->direction == STREAM_PLAYBACK) {
+            as->playback_cb(as->buf, as->sample_frame_count * 2 * sizeof(int16_t), 0,
+                            as->cb_user_data);
+        } else {
+            generate_tone(as);
+            audio_capture_push(as->capture, as->buf, as->sample_frame_count, 0);
+        }
+        const int64_t end = monotonic_ns();
+
+        pthread_mutex_lock(&as->lock);
+        as->frame_count += as->sample_frame_count;
+        as->callback_count += 1;
+        as->wall_time_ns += end - prev_end;
+        as->callback_ns_total += end - start;
+        as->callback_ns_max = MAX(as->callback_ns_max, end - start);
+        as->jitter_ns_total += start - next;
+        as->jitter_ns_max = MAX(as->jitter_ns_max, start - next);
+        pthread_mutex_unlock(&as->lock);
+
+        // don't try to catch up if callbacks are slower than schedule
+        next = MAX(next + period_ns, end);
+        prev_end = end;
+    }
+
+    return NULL;
+}
+
+static
+int
+bench_available(void)
+{
+    return config.audio_bench_speed > 0;
+}
+
+static
+audio_stream *
+bench_create_stream(audio_stream_direction direction, unsigned int sample_rate,
+                    unsigned int sample_frame_count)
+{
+    audio_stream *as = calloc(1, sizeof(*as));
+    if (!as)
+        return NULL;
+
+    as->direction = direction;
+    as->sample_rate = sample_rate;
+    as->sample_frame_count = sample_frame_count;
+    g_atomic_int_set(&as->paused, 1);
+    pthread_mutex_init(&as->lock, NULL);
+
+    as->buf = malloc(sample_frame_count * 2 * sizeof(int16_t));
+    if (!as->buf) {
+        trace_error("%s, memory allocation failure\n", __func__);
+        goto err;
+    }
+
+    return as;
+
+err:
+    pthread_mutex_destroy(&as->lock);
+    free(as);
+    return NULL;
+}
+
+static
+audio_stream *
+bench_start_stream(audio_stream *as)
+{
+    if (pthread_create(&as->thread, NULL, bench_thread, as) != 0) {
+        trace_error("%s, can't create thread\n", __func__);
+        audio_capture_free(as->capture);
+        free(as->buf);
+        pthread_mutex_destroy(&as->lock);
+        free(as);
+        return NULL;
+    }
+
+    return as;
+}
+
+static
+audio_stream *
+bench_create_playback_stream(unsigned int sample_rate, unsigned int sample_frame_count,
+                             audio_stream_playback_cb_f *cb, void *cb_user_data)
+{
+    audio_stream *as = bench_create_stream(STREAM_PLAYBACK, sample_rate, sample_frame_count);
+    if (!as)
+        return NULL;
+
+    as->playback_cb = cb;
+    as->cb_user_data = cb_user_data;
+    return bench_start_stream(as);
+}
+
+static
+audio_stream *
+bench_create_capture_stream(unsigned int sample_rate, unsigned int sample_frame_count,
+                            audio_stream_capture_cb_f *cb, void *cb_user_data,
+                            const char *longname)
+{
+    audio_stream *as = bench_create_stream(STREAM_CAPTURE, sample_rate, sample_frame_count);
+    if (!as)
+        return NULL;
+
+    // stereo "device", so downmix is measured too
+    as->capture = audio_capture_new(sample_rate, 2, sample_rate, sample_frame_count, cb,
+                                    cb_user_data);
+    if (!as->capture) {
+        free(as->buf);
+        pthread_mutex_destroy(&as->lock);
+        free(as);
+        return NULL;
+    }
+
+    return bench_start_stream(as);
+}
+
+static
+audio_device_name *
+bench_enumerate_capture_devices(void)
+{
+    audio_device_name *list = calloc(2, sizeof(audio_device_name));
+    if (!list)
+        return NULL;
+
+    list[0].name = strdup("Benchmark capture device");
+    list[0].longname = strdup(list[0].name);
+    return list;
+}
+
+static
+void
+bench_pause_stream(audio_stream *as, int enabled)
+{
+    g_atomic_int_set(&as->paused, enabled);
+}
+
+void
+audio_bench_get_results(audio_stream *as, audio_bench_results *results)
+{
+    memset(results, 0, sizeof(*results));
+
+    pthread_mutex_lock(&as->lock);
+    results->frame_count = as->frame_count;
+    results->callback_count = as->callback_count;
+    results->wall_time = as->wall_time_ns / 1e9;
+    if (as->callback_count > 0) {
+        results->mean_callback_us = as->callback_ns_total / 1e3 / as->callback_count;
+        results->mean_jitter_us = as->jitter_ns_total / 1e3 / as->callback_count;
+    }
+    results->max_callback_us = as->callback_ns_max / 1e3;
+    results->max_jitter_us = as->jitter_ns_max / 1e3;
+    pthread_mutex_unlock(&as->lock);
+
+    if (results->wall_time > 0)
+        results->speed = (double)results->frame_count / as->sample_rate / results->wall_time;
+}
+
+static
+void
+bench_get_stream_stats(audio_stream *as, audio_stream_stats *stats)
+{
+    audio_bench_results r;
+
+    audio_bench_get_results(as, &r);
+    stats->callback_count = r.callback_count;
+    stats->max_callback_latency_us = r.max_callback_us;
+
+    if (as->capture) {
+        audio_stream_stats pipeline = {};
+        audio_capture_get_stats(as->capture, &pipeline);
+        stats->callback_count = pipeline.callback_count;
+        stats->overrun_count = pipeline.overrun_count;
+        stats->max_callback_latency_us = pipeline.max_callback_latency_us;
+    }
+}
+
+static
+void
+bench_destroy_stream(audio_stream *as)
+{
+    audio_bench_results r;
+
+    g_atomic_int_set(&as->terminate, 1);
+    pthread_join(as->thread, NULL);
+    audio_capture_free(as->capture);
+
+    audio_bench_get_results(as, &r);
+    trace_info("[audio bench] %s, %u Hz, %u frames: %u callbacks in %.3f s (%.1fx real time), "
+               "callback %.1f us mean, %.1f us max, jitter %.1f us mean, %.1f us max\n",
+               as->direction == STREAM_PLAYBACK ? "playback" : "capture", as->sample_rate,
+               (unsigned)as->sample_frame_count, r.callback_count, r.wall_time, r.speed,
+               r.mean_callback_us, r.max_callback_us, r.mean_jitter_us, r.max_jitter_us);
+
+    free(as->buf);
+    pthread_mutex_destroy(&as->lock);
+    free(as);
+}
+
+
+audio_stream_ops audio_bench = {
+    .available =                    bench_available,
+    .create_playback_stream =       bench_create_playback_stream,
+    .create_capture_stream =        bench_create_capture_stream,
+    .enumerate_capture_devices =    bench_enumerate_capture_devices,
+    .pause =                        bench_pause_stream,
+    .destroy =                      bench_destroy_stream,
+    .get_stats =                    bench_get_stream_stats,
+};
@@ -0,0 +1,55 @@
+/*
+ * Copyright © 2013-2015  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPP_AUDIO_THREAD_BENCH_H
+#define FPP_AUDIO_THREAD_BENCH_H
+
+#include "audio_thread.h"
+#include <stdint.h>
+
+
+/// benchmark backend, enabled by audio_bench_speed in config
+///
+/// Has no sound device behind it. Each stream gets a thread which calls plugin callbacks
+/// audio_bench_speed times faster than real time (or as fast as callbacks allow), feeding
+/// capture streams with a synthetic tone. Callback timings are collected per stream.
+extern audio_stream_ops audio_bench;
+
+typedef struct {
+    uint64_t    frame_count;        ///< frames passed through plugin callbacks
+    uint32_t    callback_count;
+    double      wall_time;          ///< seconds stream was running, excluding pauses
+    double      speed;              ///< seconds of audio processed per second of wall time
+    double      mean_callback_us;   ///< time spent in callback
+    double      max_callback_us;
+    double      mean_jitter_us;     ///< delay of callback start relative to schedule
+    double      max_jitter_us;
+} audio_bench_results;
+
+/// For capture streams, callback time is the time spent pushing data into capture pipeline;
+/// plugin callbacks themselves are called by pipeline thread.
+void
+audio_bench_get_results(audio_stream *as, audio_bench_results *results);
+
+#endif // FPP_AUDIO_THREAD_BENCH_H
@@ -24,6 +24,8 @@
 
 #include "audio_thread.h"
 #include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
 #include <jack/jack.h>
 #include <jack/ringbuffer.h>
 #include <soxr.h>
@@ -31,22 +33,24 @@
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <time.h>
 #include "trace.h"
 #include "config.h"
+#include "eintr_retry.h"
+#include "audio_capture.h"
+#include "audio_dsp.h"
 
 #define CLIENT_NAME     "freshwrapper"
 
-#define CMD_RESAMPLE_NEXT_CHUNK     ((void *)1)
-#define CMD_TERMINATE               ((void *)2)
 
 
 struct audio_stream_s {
     audio_stream_playback_cb_f *playback_cb;
-    audio_stream_capture_cb_f  *capture_cb;
     void                       *cb_user_data;
     audio_stream_direction      direction;
 
-    GAsyncQueue        *async_q;
+    sem_t               wakeup_sem;         ///< posted by ja_process_cb
+    volatile gint       terminate;
     pthread_t           resampler_thread;
     jack_client_t      *client;
     jack_port_t        *input_port;
@@ -61,11 +65,49 @@ struct audio_stream_s {
     void               *jack_buf[2];        ///< buffers for JACK side
     size_t              jack_buf_size;
     volatile int        paused;
-    soxr_t              resampler;
+    soxr_t              resampler;          ///< used for rates built-in resampler can't handle
+    int                 use_dsp;            ///< convert with audio_dsp instead of soxr
+    audio_resampler    *dsp_resampler;      ///< NULL if rates are equal
+    float              *dsp_buf[2];         ///< planar data before (playback) or after
+                                            ///  (capture) resampling
+    size_t              dsp_buf_frames;
     jack_ringbuffer_t  *rb_in;              ///< ringbuffer for audio capture
+    audio_capture      *capture;            ///< converted capture data, delivered to plugin
     jack_ringbuffer_t  *rb_out[2];          ///< ringbuffer for audio playback
+    audio_latency_controller latency_ctl;   ///< how much data to keep in rb_out, in bytes
+    volatile gint       callback_count;
+    // JACK process callback runs in a realtime thread, so it only counts errors. Counters are
+    // reported from resampler thread.
+    volatile gint       underrun_count;
+    volatile gint       overrun_count;
+    volatile gint       xrun_count;
+    volatile gint       max_callback_latency_us;
+    volatile gint       sched_policy;
 };
 
+static
+struct timespec
+ja_callback_start(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t;
+}
+
+static
+void
+ja_callback_end(audio_stream *as, struct timespec t_start)
+{
+    struct timespec t_end;
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+    const gint latency_us = (t_end.tv_sec - t_start.tv_sec) * 1000 * 1000 +
+                            (t_end.tv_nsec - t_start.tv_nsec) / 1000;
+    if (latency_us > g_atomic_int_get(&as->max_callback_latency_us))
+        g_atomic_int_set(&as->max_callback_latency_us, latency_us);
+    g_atomic_int_inc(&as->callback_count);
+}
+
 static
 int
 ja_available(void)
@@ -73,23 +115,138 @@ ja_available(void)
     return config.audio_use_jack;
 }
 
+// reports errors counted in realtime thread, called from resampler thread
+static
+void
+ja_report_errors(audio_stream *as, audio_stream_stats *reported)
+{
+    const uint32_t underruns = g_atomic_int_get(&as->underrun_count);
+    const uint32_t overruns = g_atomic_int_get(&as->overrun_count);
+    const uint32_t xruns = g_atomic_int_get(&as->xrun_count);
+
+    if (underruns != reported->underrun_count) {
+        trace_error("%s, ringbuffer underrun (%u times)\n", __func__,
+                    underruns - reported->underrun_count);
+        reported->underrun_count = underruns;
+    }
+
+    if (overruns != reported->overrun_count) {
+        trace_error("%s, ringbuffer overrun (%u times)\n", __func__,
+                    overruns - reported->overrun_count);
+        reported->overrun_count = overruns;
+    }
+
+    if (xruns != reported->xrun_count) {
+        trace_warning("%s, JACK xrun (%u times)\n", __func__, xruns - reported->xrun_count);
+        reported->xrun_count = xruns;
+    }
+}
+
+// returns time, in seconds, data spend in ringbuffer and in JACK graph
+static
+double
+ja_get_latency(audio_stream *as)
+{
+    jack_latency_range_t range;
+    size_t               queued;
+
+    if (as->direction == STREAM_PLAYBACK) {
+        jack_port_get_latency_range(as->output_port_1, JackPlaybackLatency, &range);
+        queued = jack_ringbuffer_read_space(as->rb_out[0]);
+    } else {
+        jack_port_get_latency_range(as->input_port, JackCaptureLatency, &range);
+        queued = jack_ringbuffer_read_space(as->rb_in);
+    }
+
+    return (range.max + queued / sizeof(float)) / (double)as->jack_sample_rate;
+}
+
+// converts a chunk in pepper_buf to planar floats in jack_buf, returns frame count
+static
+size_t
+ja_dsp_convert_playback(audio_stream *as)
+{
+    const size_t n = as->sample_frame_count;
+    float *out[2] = { as->jack_buf[0], as->jack_buf[1] };
+
+    if (!as->dsp_resampler) {
+        audio_dsp_deinterleave_s16_to_float(as->pepper_buf, out[0], out[1], n);
+        return n;
+    }
+
+    audio_dsp_deinterleave_s16_to_float(as->pepper_buf, as->dsp_buf[0], as->dsp_buf[1], n);
+    return audio_resampler_process(as->dsp_resampler, (const float *const *)as->dsp_buf, n,
+                                   out);
+}
+
+// hands converted data to capture pipeline, which calls plugin in whole chunks
+static
+void
+ja_deliver_capture(audio_stream *as, size_t sz)
+{
+    if (g_atomic_int_get(&as->paused))
+        return;
+
+    audio_capture_push(as->capture, as->pepper_buf, sz / sizeof(int16_t), ja_get_latency(as));
+}
+
+// converts @frame_count frames from jack_buf[0] and passes them to plugin
+static
+void
+ja_dsp_convert_capture(audio_stream *as, size_t frame_count)
+{
+    const float *src = as->jack_buf[0];
+
+    if (as->dsp_resampler) {
+        float *out[1] = { as->dsp_buf[0] };
+        frame_count = audio_resampler_process(as->dsp_resampler, &src, frame_count, out);
+        src = as->dsp_buf[0];
+    }
+
+    // resampler may produce slightly more than pepper_buf can hold
+    size_t ofs = 0;
+    while (ofs < frame_count) {
+        const size_t piece = MIN(frame_count - ofs, as->sample_frame_count);
+
+        audio_dsp_float_to_s16(src + ofs, as->pepper_buf, piece);
+        ja_deliver_capture(as, piece * sizeof(int16_t));
+        ofs += piece;
+    }
+}
+
 static
 void *
 ja_playback_resampler_thread_func(void *param)
 {
-    audio_stream *as = param;
+    audio_stream     *as = param;
+    audio_stream_stats reported = {};
+    size_t             target_fill = as->latency_ctl.target;
+
+    // runs plugin code, which may spin, so stays at normal priority. JACK's own process thread
+    // is realtime, and ring buffer covers scheduling delays of this one
+    g_atomic_int_set(&as->sched_policy, SCHED_OTHER);
 
     while (1) {
-        while (jack_ringbuffer_read_space(as->rb_out[0]) < as->jack_buf_size / 2) {
+        while (jack_ringbuffer_read_space(as->rb_out[0]) < target_fill) {
             if (g_atomic_int_get(&as->paused)) {
                 memset(as->pepper_buf, 0, as->pepper_buf_size);
             } else {
-                as->playback_cb(as->pepper_buf, as->pepper_buf_size, 0, as->cb_user_data);
+                const double latency = ja_get_latency(as);
+                struct timespec t_start = ja_callback_start();
+                as->playback_cb(as->pepper_buf, as->pepper_buf_size, latency,
+                                as->cb_user_data);
+                ja_callback_end(as, t_start);
+                target_fill = audio_latency_controller_tick(&as->latency_ctl);
             }
 
-            size_t idone = 0, odone = 0;
-            soxr_process(as->resampler, as->pepper_buf, as->sample_frame_count, &idone,
-                         as->jack_buf, as->jack_buf_size / sizeof(float), &odone);
+            size_t odone = 0;
+            if (as->use_dsp) {
+                odone = ja_dsp_convert_playback(as);
+            } else {
+                size_t idone = 0;
+                soxr_process(as->resampler, as->pepper_buf, as->sample_frame_count, &idone,
+                             as->jack_buf, as->jack_buf_size / sizeof(float), &odone);
+            }
 
             size_t wr1, wr2;
             wr1 = jack_ringbuffer_write(as->rb_out[0], as->jack_buf[0], odone * sizeof(float));
@@ -98,10 +255,15 @@ ja_playback_resampler_thread_func(void *param)
                 trace_error("%s, ringbuffer overrun\n", __func__);
         }
 
-        void *ptr = g_async_queue_pop(as->async_q);
+        RETRY_ON_EINTR(sem_wait(&as->wakeup_sem));
+
+        // keep more data buffered after underruns
+        if (g_atomic_int_get(&as->underrun_count) != reported.underrun_count)
+            target_fill = audio_latency_controller_underrun(&as->latency_ctl);
+        ja_report_errors(as, &reported);
 
         // termination condition
-        if (ptr == CMD_TERMINATE)
+        if (g_atomic_int_get(&as->terminate))
             break;
     }
 
@@ -112,7 +274,11 @@ static
 void *
 ja_capture_resampler_thread_func(void *param)
 {
-    audio_stream *as = param;
+    audio_stream     *as = param;
+    audio_stream_stats reported = {};
+
+    // only resamples and pushes data into capture pipeline, plugin is called from elsewhere
+    g_atomic_int_set(&as->sched_policy, audio_thread_make_realtime(1));
 
     while (1) {
         if (jack_ringbuffer_read_space(as->rb_in) > as->jack_buf_size / 2) {
@@ -122,19 +288,22 @@ ja_capture_resampler_thread_func(void *param)
             if (rd == 0)
                 trace_error("%s, ringbuffer underrun\n", __func__);
 
-            size_t idone = 0, odone = 0;
-            const size_t pepper_frame_size = 1 * sizeof(int16_t); // mono 16-bit
-            soxr_process(as->resampler, as->jack_buf, rd / sizeof(float), &idone,
-                         as->pepper_buf, as->pepper_buf_size / pepper_frame_size, &odone);
-
-            if (!g_atomic_int_get(&as->paused))
-                as->capture_cb(as->pepper_buf, odone * pepper_frame_size, 0, as->cb_user_data);
+            if (as->use_dsp) {
+                ja_dsp_convert_capture(as, rd / sizeof(float));
+            } else {
+                size_t idone = 0, odone = 0;
+                const size_t pepper_frame_size = 1 * sizeof(int16_t); // mono 16-bit
+                soxr_process(as->resampler, as->jack_buf, rd / sizeof(float), &idone,
+                             as->pepper_buf, as->pepper_buf_size / pepper_frame_size, &odone);
+                ja_deliver_capture(as, odone * pepper_frame_size);
+            }
         }
 
-        void *ptr = g_async_queue_pop(as->async_q);
+        RETRY_ON_EINTR(sem_wait(&as->wakeup_sem));
+        ja_report_errors(as, &reported);
 
         // termination condition
-        if (ptr == CMD_TERMINATE)
+        if (g_atomic_int_get(&as->terminate))
             break;
     }
 
@@ -156,21 +325,48 @@ ja_process_cb(jack_nframes_t nframes, void *param)
         size_t wr1 = jack_ringbuffer_read(as->rb_out[0], out[0], nframes * sizeof(float));
         size_t wr2 = jack_ringbuffer_read(as->rb_out[1], out[1], nframes * sizeof(float));
 
-        if (wr1 != nframes * sizeof(float) || wr2 != nframes * sizeof(float))
-            trace_error("%s, ringbuffer underrun\n", __func__);
+        if (wr1 != nframes * sizeof(float) || wr2 != nframes * sizeof(float)) {
+            // fill the rest with silence instead of leaving garbage in port buffers
+            memset((char *)out[0] + wr1, 0, nframes * sizeof(float) - wr1);
+            memset((char *)out[1] + wr2, 0, nframes * sizeof(float) - wr2);
+            g_atomic_int_inc(&as->underrun_count);
+        }
     } else {
         // STREAM_CAPTURE
         void *in = jack_port_get_buffer(as->input_port, nframes);
 
         size_t wr1 = jack_ringbuffer_write(as->rb_in, in, nframes * sizeof(float));
         if (wr1 != nframes * sizeof(float))
-            trace_error("%s, ringbuffer overrun\n", __func__);
+            g_atomic_int_inc(&as->overrun_count);
     }
 
-    g_async_queue_push(as->async_q, CMD_RESAMPLE_NEXT_CHUNK);
+    // neither locks nor allocates
+    sem_post(&as->wakeup_sem);
+    return 0;
+}
+
+static
+int
+ja_xrun_cb(void *param)
+{
+    audio_stream *as = param;
+
+    g_atomic_int_inc(&as->xrun_count);
     return 0;
 }
 
+static
+void
+ja_unlock_buffers(audio_stream *as)
+{
+    // ringbuffers are unlocked by jack_ringbuffer_free()
+    audio_thread_unlock_memory(as->pepper_buf, as->pepper_buf_size);
+    audio_thread_unlock_memory(as->jack_buf[0], as->jack_buf_size);
+    audio_thread_unlock_memory(as->jack_buf[1], as->jack_buf_size);
+    audio_thread_unlock_memory(as->dsp_buf[0], as->dsp_buf_frames * sizeof(float));
+    audio_thread_unlock_memory(as->dsp_buf[1], as->dsp_buf_frames * sizeof(float));
+}
+
 static
 audio_stream *
 ja_do_create_stream(unsigned int sample_rate, unsigned int sample_frame_count,
@@ -195,7 +391,6 @@ ja_do_create_stream(unsigned int sample_rate, unsigned int sample_frame_count,
     }
 
     as->playback_cb =  playback_cb;
-    as->capture_cb =   capture_cb;
     as->cb_user_data = cb_user_data;
     as->direction =    direction;
     g_atomic_int_set(&as->paused, 1);
@@ -225,8 +420,18 @@ ja_do_create_stream(unsigned int sample_rate, unsigned int sample_frame_count,
         as->jack_buf_size = (2 * as->jack_sample_frame_count) * sizeof(float);
         as->jack_buf[0] = malloc(as->jack_buf_size);
         as->jack_buf[1] = malloc(as->jack_buf_size);
-        as->rb_out[0] = jack_ringbuffer_create(as->jack_buf_size);
-        as->rb_out[1] = jack_ringbuffer_create(as->jack_buf_size);
+
+        // start with a single chunk buffered, grow up to audio_buffer_max_ms on underruns.
+        // Try to shrink buffer every 10 seconds.
+        const size_t chunk = as->jack_buf_size / 2;
+        const size_t max_fill = as->jack_sample_rate * config.audio_buffer_max_ms / 1000 *
+                                sizeof(float);
+        audio_latency_controller_init(&as->latency_ctl, chunk, MAX(max_fill, chunk), chunk,
+                                      10 * as->sample_rate / as->sample_frame_count);
+
+        const size_t rb_size = as->latency_ctl.max + as->jack_buf_size;
+        as->rb_out[0] = jack_ringbuffer_create(rb_size);
+        as->rb_out[1] = jack_ringbuffer_create(rb_size);
 
         if (!as->pepper_buf || !as->jack_buf[0] || !as->jack_buf[1]
             || !as->rb_out[0] || !as->rb_out[1])
@@ -246,27 +451,71 @@ ja_do_create_stream(unsigned int sample_rate, unsigned int sample_frame_count,
         as->jack_buf[0] = malloc(as->jack_buf_size);
         as->rb_in = jack_ringbuffer_create(as->jack_buf_size);
 
-        if (!as->pepper_buf || !as->jack_buf[0] || !as->rb_in) {
+        // data is already resampled, pipeline only decouples plugin from resampler thread
+        as->capture = audio_capture_new(sample_rate, 1, sample_rate, sample_frame_count,
+                                        capture_cb, cb_user_data);
+
+        if (!as->pepper_buf || !as->jack_buf[0] || !as->rb_in || !as->capture) {
             trace_error("%s, memory allocation failure, point 3\n", __func__);
             goto err_3;
         }
     }
 
-    soxr_quality_spec_t quality_spec = soxr_quality_spec(SOXR_QQ, 0);
-    if (as->sample_rate == as->jack_sample_rate) {
-        // workaround issue with same input and output rate
-        quality_spec = soxr_quality_spec(SOXR_QQ, 0);
+    if (config.audio_realtime_priority > 0) {
+        audio_thread_lock_memory(as->pepper_buf, as->pepper_buf_size);
+        for (int k = 0; k < 2; k ++) {
+            audio_thread_lock_memory(as->jack_buf[k], as->jack_buf_size);
+            if (as->rb_out[k])
+                jack_ringbuffer_mlock(as->rb_out[k]);
+        }
+        if (as->rb_in)
+            jack_ringbuffer_mlock(as->rb_in);
     }
 
-    soxr_error_t soxr_err;
-    if (direction == STREAM_PLAYBACK) {
-        soxr_io_spec_t io_spec = soxr_io_spec(SOXR_INT16_I, SOXR_FLOAT32_S);
-        as->resampler = soxr_create(as->sample_rate, as->jack_sample_rate, 2, &soxr_err, &io_spec,
-                                    &quality_spec, NULL);
+    // Built-in resampler handles equal rates and common ratios like 44.1 kHz to 48 kHz.
+    // soxr is used for the rest.
+    if (as->sample_rate == as->jack_sample_rate) {
+        as->use_dsp = 1;
     } else {
-        soxr_io_spec_t io_spec = soxr_io_spec(SOXR_FLOAT32_S, SOXR_INT16_I);
-        as->resampler = soxr_create(as->jack_sample_rate, as->sample_rate, 1, &soxr_err, &io_spec,
-                                    &quality_spec, NULL);
+        if (direction == STREAM_PLAYBACK) {
+            as->dsp_resampler = audio_resampler_new(as->sample_rate, as->jack_sample_rate, 2,
+                                                    AUDIO_RESAMPLER_POLYPHASE);
+            as->dsp_buf_frames = as->sample_frame_count;
+        } else {
+            as->dsp_resampler = audio_resampler_new(as->jack_sample_rate, as->sample_rate, 1,
+                                                    AUDIO_RESAMPLER_POLYPHASE);
+            if (as->dsp_resampler) {
+                as->dsp_buf_frames = audio_resampler_max_output_frames(as->dsp_resampler,
+                                                                 as->jack_sample_frame_count);
+            }
+        }
+
+        if (as->dsp_resampler) {
+            const int channel_count = (direction == STREAM_PLAYBACK) ? 2 : 1;
+            for (int k = 0; k < channel_count; k ++) {
+                as->dsp_buf[k] = malloc(as->dsp_buf_frames * sizeof(float));
+                if (!as->dsp_buf[k]) {
+                    trace_error("%s, memory allocation failure, point 4\n", __func__);
+                    goto err_3;
+                }
+                audio_thread_lock_memory(as->dsp_buf[k], as->dsp_buf_frames * sizeof(float));
+            }
+            as->use_dsp = 1;
+        }
+    }
+
+    soxr_error_t soxr_err = NULL;
+    if (!as->use_dsp) {
+        soxr_quality_spec_t quality_spec = soxr_quality_spec(SOXR_QQ, 0);
+        if (direction == STREAM_PLAYBACK) {
+            soxr_io_spec_t io_spec = soxr_io_spec(SOXR_INT16_I, SOXR_FLOAT32_S);
+            as->resampler = soxr_create(as->sample_rate, as->jack_sample_rate, 2, &soxr_err,
+                                        &io_spec, &quality_spec, NULL);
+        } else {
+            soxr_io_spec_t io_spec = soxr_io_spec(SOXR_FLOAT32_S, SOXR_INT16_I);
+            as->resampler = soxr_create(as->jack_sample_rate, as->sample_rate, 1, &soxr_err,
+                                        &io_spec, &quality_spec, NULL);
+        }
     }
 
     if (soxr_err != NULL) {
@@ -274,13 +523,13 @@ ja_do_create_stream(unsigned int sample_rate, unsigned int sample_frame_count,
         goto err_3;
     }
 
-    as->async_q = g_async_queue_new();
-    if (!as->async_q) {
-        trace_error("%s, can't create GAsyncQueue\n", __func__);
+    if (sem_init(&as->wakeup_sem, 0, 0) != 0) {
+        trace_error("%s, can't create semaphore\n", __func__);
         goto err_4;
     }
 
     jack_set_process_callback(as->client, ja_process_cb, as);
+    jack_set_xrun_callback(as->client, ja_xrun_cb, as);
 
     if (direction == STREAM_PLAYBACK) {
         as->output_port_1 = jack_port_register(as->client, "output1", JACK_DEFAULT_AUDIO_TYPE,
@@ -354,12 +603,14 @@ ja_do_create_stream(unsigned int sample_rate, unsigned int sample_frame_count,
     return as;
 
 err_6:
-    g_async_queue_push(as->async_q, CMD_TERMINATE);
+    g_atomic_int_set(&as->terminate, 1);
+    sem_post(&as->wakeup_sem);
     pthread_join(as->resampler_thread, NULL);
 err_5:
-    g_async_queue_unref(as->async_q);
+    sem_destroy(&as->wakeup_sem);
 err_4:
-    soxr_delete(as->resampler);
+    if (as->resampler)
+        soxr_delete(as->resampler);
 err_3:
     if (as->rb_out[0])
         jack_ringbuffer_free(as->rb_out[0]);
@@ -367,6 +618,11 @@ err_3:
         jack_ringbuffer_free(as->rb_out[1]);
     if (as->rb_in)
         jack_ringbuffer_free(as->rb_in);
+    audio_capture_free(as->capture);
+    ja_unlock_buffers(as);
+    audio_resampler_free(as->dsp_resampler);
+    free(as->dsp_buf[0]);
+    free(as->dsp_buf[1]);
     free(as->pepper_buf);
     free(as->jack_buf[0]);
     free(as->jack_buf[1]);
@@ -427,11 +683,18 @@ void
 ja_destroy_stream(audio_stream *as)
 {
     jack_client_close(as->client);
-    g_async_queue_push(as->async_q, CMD_TERMINATE);
+    g_atomic_int_set(&as->terminate, 1);
+    sem_post(&as->wakeup_sem);
     pthread_join(as->resampler_thread, NULL);
-    g_async_queue_unref(as->async_q);
-    soxr_delete(as->resampler);
-
+    sem_destroy(&as->wakeup_sem);
+    audio_capture_free(as->capture);
+    if (as->resampler)
+        soxr_delete(as->resampler);
+
+    ja_unlock_buffers(as);
+    audio_resampler_free(as->dsp_resampler);
+    free(as->dsp_buf[0]);
+    free(as->dsp_buf[1]);
     free(as->pepper_buf);
     free(as->jack_buf[0]);
     free(as->jack_buf[1]);
@@ -444,6 +707,28 @@ ja_destroy_stream(audio_stream *as)
 }
 
 
+static
+void
+ja_get_stream_stats(audio_stream *as, audio_stream_stats *stats)
+{
+    stats->callback_count = g_atomic_int_get(&as->callback_count);
+    stats->underrun_count = g_atomic_int_get(&as->underrun_count);
+    stats->overrun_count = g_atomic_int_get(&as->overrun_count);
+    stats->xrun_count = g_atomic_int_get(&as->xrun_count);
+    stats->max_callback_latency_us = g_atomic_int_get(&as->max_callback_latency_us);
+    stats->sched_policy = g_atomic_int_get(&as->sched_policy);
+
+    if (as->capture) {
+        // plugin is called by capture pipeline, add ring overruns it counted
+        audio_stream_stats pipeline = {};
+        audio_capture_get_stats(as->capture, &pipeline);
+        stats->callback_count = pipeline.callback_count;
+        stats->overrun_count += pipeline.overrun_count;
+        stats->max_callback_latency_us = pipeline.max_callback_latency_us;
+    }
+}
+
+
 audio_stream_ops audio_jack = {
     .available =                    ja_available,
     .create_playback_stream =       ja_create_playback_stream,
@@ -451,4 +736,5 @@ audio_stream_ops audio_jack = {
     .enumerate_capture_devices =    ja_enumerate_capture_devices,
     .pause =                        ja_pause_stream,
     .destroy =                      ja_destroy_stream,
+    .get_stats =                    ja_get_stream_stats,
 };
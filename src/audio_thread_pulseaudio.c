@@ -29,6 +29,10 @@
 #include <glib.h>
 #include <string.h>
 #include "trace.h"
+#include "config.h"
+#include "audio_capture.h"
+#include "audio_dsp.h"
+#include "audio_ringbuffer.h"
 
 
 #define CLIENT_NAME     "freshwrapper"
@@ -40,9 +44,26 @@ struct audio_stream_s {
     size_t                      sample_frame_count;
     pa_stream                  *stream;
     audio_stream_playback_cb_f *playback_cb;
-    audio_stream_capture_cb_f  *capture_cb;
     void                       *cb_user_data;
     volatile int                paused;
+
+    // Playback streams are resampled to the server rate on client side, so server doesn't
+    // have to do that
+    audio_s16_resampler        *resampler;
+
+    // Plugin is always asked for whole chunks. Data which didn't fit into server buffer is
+    // kept in carry and written next time.
+    int16_t                    *cb_buf;
+    audio_ringbuffer           *carry;          ///< data not yet written to server
+
+    audio_capture              *capture;        ///< capture streams only
+
+    // statistics, protected by mainloop lock
+    audio_stream_stats          stats;
+
+    // server side buffer (tlength) grows on underflows and shrinks back while there are none
+    pa_buffer_attr              buf_attr;
+    audio_latency_controller    latency_ctl;
 };
 
 
@@ -51,6 +72,7 @@ static int                          probed = 0;
 static int                          available = 0;
 static struct pa_threaded_mainloop *mainloop;
 static struct pa_context           *context;
+static unsigned int                 server_sample_rate;
 
 
 static
@@ -86,6 +108,19 @@ destructor_audio_thread_pulseaudio(void)
     pthread_mutex_unlock(&lock);
 }
 
+static
+void
+pulse_server_info_cb(pa_context *c, const pa_server_info *i, void *user_data)
+{
+    if (i)
+        server_sample_rate = i->sample_spec.rate;
+    pa_threaded_mainloop_signal(mainloop, 0);
+}
+
+static
+void
+pulse_wait_for_completion(pa_operation *op, pa_threaded_mainloop *ml);
+
 static
 int
 pulse_available(void)
@@ -134,6 +169,9 @@ pulse_available(void)
         goto err_4;
     }
 
+    pa_operation *op = pa_context_get_server_info(context, pulse_server_info_cb, NULL);
+    pulse_wait_for_completion(op, mainloop);
+
     pa_threaded_mainloop_unlock(mainloop);
     available = 1;
     pthread_mutex_unlock(&lock);
@@ -165,33 +203,126 @@ pulse_stream_state_cb(pa_stream *s, void *user_data)
     }
 }
 
+// returns time, in seconds, data written now will spend in buffers before it's heard
+// (or time captured data have spent there)
+static
+double
+pulse_get_latency(audio_stream *as)
+{
+    pa_usec_t   usec;
+    int         negative = 0;
+
+    if (pa_stream_get_latency(as->stream, &usec, &negative) < 0 || negative)
+        usec = 0;
+
+    if (as->carry)
+        usec += pa_bytes_to_usec(audio_ringbuffer_read_space(as->carry), &as->sample_spec);
+
+    return usec / 1e6;
+}
+
+static
+void
+pulse_update_buffer_attr(audio_stream *as, size_t tlength)
+{
+    if (tlength == as->buf_attr.tlength)
+        return;
+
+    as->buf_attr.tlength = tlength;
+    pa_operation *op = pa_stream_set_buffer_attr(as->stream, &as->buf_attr, NULL, NULL);
+    if (op)
+        pa_operation_unref(op);
+}
+
+static
+void
+pulse_stream_underflow_cb(pa_stream *s, void *user_data)
+{
+    audio_stream *as = user_data;
+    as->stats.underrun_count ++;
+    pulse_update_buffer_attr(as, audio_latency_controller_underrun(&as->latency_ctl));
+}
+
+// asks plugin for a whole chunk of data
+static
+void
+pulse_call_playback_cb(audio_stream *as, void *buf, double latency)
+{
+    const size_t sz = as->sample_frame_count * pa_frame_size(&as->sample_spec);
+
+    as->playback_cb(buf, sz, latency, as->cb_user_data);
+    as->stats.callback_count ++;
+}
+
+// fills @buf with resampled plugin data
+static
+void
+pulse_fill_resampled(audio_stream *as, char *buf, size_t length, double latency)
+{
+    const size_t frame_size = pa_frame_size(&as->sample_spec);
+    size_t       ofs = 0;
+
+    while (ofs < length) {
+        if (audio_ringbuffer_read_space(as->carry) == 0) {
+            const size_t n = as->sample_frame_count;
+            pulse_call_playback_cb(as, as->cb_buf, latency);
+
+            const size_t out_n = audio_s16_resampler_process(as->resampler, as->cb_buf, n,
+                                                             as->cb_buf);
+            audio_ringbuffer_write(as->carry, as->cb_buf, out_n * frame_size);
+        }
+
+        ofs += audio_ringbuffer_read(as->carry, buf + ofs, length - ofs);
+    }
+}
+
+// fills @buf with plugin data. Whole chunks are written directly into @buf, the rest goes
+// through carry.
+static
+void
+pulse_fill(audio_stream *as, char *buf, size_t length, double latency)
+{
+    const size_t chunk = as->sample_frame_count * pa_frame_size(&as->sample_spec);
+    size_t       ofs = audio_ringbuffer_read(as->carry, buf, length);
+
+    while (length - ofs >= chunk) {
+        pulse_call_playback_cb(as, buf + ofs, latency);
+        ofs += chunk;
+    }
+
+    if (ofs < length) {
+        pulse_call_playback_cb(as, as->cb_buf, latency);
+        memcpy(buf + ofs, as->cb_buf, length - ofs);
+        audio_ringbuffer_write(as->carry, (char *)as->cb_buf + (length - ofs),
+                               chunk - (length - ofs));
+    }
+}
+
 static
 void
 pulse_stream_write_cb(pa_stream *s, size_t length, void *user_data)
 {
     audio_stream   *as = user_data;
     char           *buf;
+    const double    latency = pulse_get_latency(as);
 
     pa_stream_begin_write(as->stream, (void **)&buf, &length);
 
+    const uint32_t frames = length / pa_frame_size(&as->sample_spec);
+    if (as->stats.min_request_frames == 0 || frames < as->stats.min_request_frames)
+        as->stats.min_request_frames = frames;
+    as->stats.max_request_frames = MAX(as->stats.max_request_frames, frames);
+
     if (g_atomic_int_get(&as->paused) || !as->playback_cb) {
         memset(buf, 0, length);
+    } else if (as->resampler) {
+        pulse_fill_resampled(as, buf, length, latency);
     } else {
-        const size_t max_segment_length = as->sample_frame_count * pa_frame_size(&as->sample_spec);
-        size_t to_process = length;
-        size_t ofs = 0;
-
-        while (to_process > 0) {
-            const size_t segment_length = MIN(to_process, max_segment_length);
-
-            as->playback_cb(buf + ofs, segment_length, 0, as->cb_user_data);
-
-            to_process -= segment_length;
-            ofs += segment_length;
-        }
+        pulse_fill(as, buf, length, latency);
     }
 
     pa_stream_write(as->stream, buf, length, NULL, 0, PA_SEEK_RELATIVE);
+    pulse_update_buffer_attr(as, audio_latency_controller_tick(&as->latency_ctl));
 }
 
 static
@@ -200,25 +331,20 @@ pulse_stream_read_cb(pa_stream *s, size_t length, void *user_data)
 {
     audio_stream   *as = user_data;
     const char     *data;
+    const double    latency = pulse_get_latency(as);
 
     if (pa_stream_peek(s, (const void **)&data, &length) < 0) {
         trace_error("%s, pa_stream_peek failed\n", __func__);
         return;
     }
 
-    if (!g_atomic_int_get(&as->paused)) {
-        const size_t max_segment_length = as->sample_frame_count * pa_frame_size(&as->sample_spec);
-        size_t to_process = length;
-        size_t ofs = 0;
-
-        while (to_process > 0) {
-            const size_t segment_length = MIN(to_process, max_segment_length);
-
-            as->capture_cb(data + ofs, segment_length, 0, as->cb_user_data);
+    if (length == 0)
+        return;
 
-            to_process -= segment_length;
-            ofs += segment_length;
-        }
+    // NULL data means there is a hole in the stream
+    if (data && !g_atomic_int_get(&as->paused)) {
+        audio_capture_push(as->capture, (const int16_t *)data,
+                           length / pa_frame_size(&as->sample_spec), latency);
     }
 
     pa_stream_drop(s);
@@ -231,6 +357,16 @@ pulse_stream_latency_update_cb(pa_stream *s, void *user_data)
     pa_threaded_mainloop_signal(mainloop, 0);
 }
 
+static
+void
+pulse_free_buffers(audio_stream *as)
+{
+    audio_s16_resampler_free(as->resampler);
+    audio_ringbuffer_free(as->carry);
+    free(as->cb_buf);
+    audio_capture_free(as->capture);
+}
+
 static
 audio_stream *
 pulse_do_create_stream(unsigned int sample_rate, unsigned int sample_frame_count,
@@ -249,7 +385,6 @@ pulse_do_create_stream(unsigned int sample_rate, unsigned int sample_frame_count
         return NULL;
 
     as->playback_cb = playback_cb;
-    as->capture_cb =  capture_cb;
 
     as->cb_user_data =  cb_user_data;
 
@@ -262,6 +397,43 @@ pulse_do_create_stream(unsigned int sample_rate, unsigned int sample_frame_count
     as->sample_frame_count = sample_frame_count;
     g_atomic_int_set(&as->paused, 1);
 
+    // buffer sizes below are in server rate frames
+    size_t stream_frame_count = sample_frame_count;
+
+    if (direction == STREAM_PLAYBACK) {
+        const size_t frame_size = pa_frame_size(&as->sample_spec);
+
+        if (server_sample_rate != 0 && server_sample_rate != sample_rate) {
+            as->resampler = audio_s16_resampler_new(sample_rate, server_sample_rate, 2,
+                                                    sample_frame_count);
+            if (!as->resampler) {
+                trace_error("%s, can't create resampler\n", __func__);
+                goto err_0;
+            }
+
+            stream_frame_count = audio_s16_resampler_max_output_frames(as->resampler);
+            as->sample_spec.rate = server_sample_rate;
+        }
+
+        const size_t max_frame_count = MAX(sample_frame_count, stream_frame_count);
+        as->cb_buf = malloc(max_frame_count * frame_size);
+        as->carry = audio_ringbuffer_new(max_frame_count * frame_size);
+        if (!as->cb_buf || !as->carry) {
+            trace_error("%s, memory allocation failure\n", __func__);
+            goto err_0;
+        }
+    }
+
+    if (direction == STREAM_CAPTURE) {
+        // server converts data to requested format, pipeline only decouples plugin
+        as->capture = audio_capture_new(sample_rate, 1, sample_rate, sample_frame_count,
+                                        capture_cb, cb_user_data);
+        if (!as->capture) {
+            trace_error("%s, can't create capture pipeline\n", __func__);
+            goto err_0;
+        }
+    }
+
     pa_threaded_mainloop_lock(mainloop);
 
     const char *stream_name = (direction == STREAM_PLAYBACK) ? "playback" : "capture";
@@ -278,24 +450,41 @@ pulse_do_create_stream(unsigned int sample_rate, unsigned int sample_frame_count
     pa_stream_set_read_callback(as->stream, pulse_stream_read_cb, as);
     pa_stream_set_write_callback(as->stream, pulse_stream_write_cb, as);
     pa_stream_set_latency_update_callback(as->stream, pulse_stream_latency_update_cb, as);
+    pa_stream_set_underflow_callback(as->stream, pulse_stream_underflow_cb, as);
 
+    // start with two callbacks worth of data, or audio_buffer_min_ms, whichever is larger.
+    // Try to shrink buffer every 10 seconds.
     const size_t frame_size = pa_frame_size(&as->sample_spec);
-    pa_buffer_attr buf_attr = {
+    const size_t chunk = stream_frame_count * frame_size;
+    const size_t min_fill = pa_usec_to_bytes(config.audio_buffer_min_ms * 1000ull,
+                                             &as->sample_spec);
+    const size_t max_fill = pa_usec_to_bytes(config.audio_buffer_max_ms * 1000ull,
+                                             &as->sample_spec);
+    const size_t upper = MAX(max_fill, 2 * chunk);
+
+    audio_latency_controller_init(&as->latency_ctl, MIN(MAX(2 * chunk, min_fill), upper), upper,
+                                  chunk, 10 * as->sample_spec.rate / stream_frame_count);
+
+    as->buf_attr = (pa_buffer_attr){
         .maxlength =    (uint32_t)-1,
-        .tlength =      sample_frame_count * frame_size * 2,
+        .tlength =      as->latency_ctl.target,
         .prebuf =       (uint32_t)-1,
-        .minreq =       sample_frame_count * frame_size / 2,
-        .fragsize =     sample_frame_count * frame_size,
+        .minreq =       chunk / 2,
+        .fragsize =     chunk,
     };
 
     if (direction == STREAM_PLAYBACK) {
-        if (pa_stream_connect_playback(as->stream, NULL, &buf_attr, 0, NULL, NULL) < 0) {
+        const int flags = PA_STREAM_ADJUST_LATENCY | PA_STREAM_INTERPOLATE_TIMING |
+                          PA_STREAM_AUTO_TIMING_UPDATE;
+        if (pa_stream_connect_playback(as->stream, NULL, &as->buf_attr, flags, NULL, NULL) < 0)
+        {
             trace_error("%s, can't connect playback stream\n", __func__);
             goto err_2;
         }
     } else {
-        int flags = PA_STREAM_ADJUST_LATENCY;
-        if (pa_stream_connect_record(as->stream, NULL, &buf_attr, flags) < 0) {
+        const int flags = PA_STREAM_ADJUST_LATENCY | PA_STREAM_INTERPOLATE_TIMING |
+                          PA_STREAM_AUTO_TIMING_UPDATE;
+        if (pa_stream_connect_record(as->stream, NULL, &as->buf_attr, flags) < 0) {
             trace_error("%s, can't connect capture stream\n", __func__);
             goto err_2;
         }
@@ -319,6 +508,8 @@ err_2:
     pa_stream_unref(as->stream);
 err_1:
     pa_threaded_mainloop_unlock(mainloop);
+err_0:
+    pulse_free_buffers(as);
     free(as);
     return NULL;
 }
@@ -393,6 +584,10 @@ static
 void
 pulse_destroy_stream(audio_stream *as)
 {
+    // no callbacks should be called after function returns
+    if (as->capture)
+        audio_capture_stop(as->capture);
+
     pa_threaded_mainloop_lock(mainloop);
 
     pa_operation *op = pa_stream_cork(as->stream, 1, pulse_stream_success_cb, mainloop);
@@ -400,14 +595,29 @@ pulse_destroy_stream(audio_stream *as)
 
     pa_stream_disconnect(as->stream);
     pa_stream_set_state_callback(as->stream, NULL, NULL);
+    pa_stream_set_read_callback(as->stream, NULL, NULL);
     pa_stream_set_write_callback(as->stream, NULL, NULL);
     pa_stream_set_latency_update_callback(as->stream, NULL, NULL);
+    pa_stream_set_underflow_callback(as->stream, NULL, NULL);
     pa_stream_unref(as->stream);
 
     pa_threaded_mainloop_unlock(mainloop);
+    pulse_free_buffers(as);
     free(as);
 }
 
+static
+void
+pulse_get_stream_stats(audio_stream *as, audio_stream_stats *stats)
+{
+    pa_threaded_mainloop_lock(mainloop);
+    *stats = as->stats;
+    pa_threaded_mainloop_unlock(mainloop);
+
+    if (as->capture)
+        audio_capture_get_stats(as->capture, stats);
+}
+
 
 audio_stream_ops audio_pulse = {
     .available =                    pulse_available,
@@ -416,4 +626,5 @@ audio_stream_ops audio_pulse = {
     .enumerate_capture_devices =    pulse_enumerate_capture_devices,
     .pause =                        pulse_pause_stream,
     .destroy =                      pulse_destroy_stream,
+    .get_stats =                    pulse_get_stream_stats,
 };
@@ -0,0 +1,90 @@
+/*
+ * Copyright © 2013-2015  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPP_COMPAT_FFMPEG_H
+#define FPP_COMPAT_FFMPEG_H
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/avutil.h>
+#include "autogenerated_ffmpeg_compat.h"
+
+
+// definitions for older libavcodec versions
+#if !HAVE_AVPixelFormat
+#define AVPixelFormat           PixelFormat
+#define AV_PIX_FMT_NONE         PIX_FMT_NONE
+#define AV_PIX_FMT_YUV420P      PIX_FMT_YUV420P
+#define AV_PIX_FMT_YUVJ420P     PIX_FMT_YUVJ420P
+#define AV_PIX_FMT_YUV422P      PIX_FMT_YUV422P
+#define AV_PIX_FMT_YUVJ422P     PIX_FMT_YUVJ422P
+#define AV_PIX_FMT_VAAPI_VLD    PIX_FMT_VAAPI_VLD
+#endif // !HAVE_AVPixelFormat
+
+#if !HAVE_AV_PIX_FMT_VDPAU
+#define AV_PIX_FMT_VDPAU        (-2)
+#endif // !HAVE_AV_PIX_FMT_VDPAU
+
+#if !HAVE_AVCodecID
+#define AV_CODEC_ID_H264        CODEC_ID_H264
+#define AV_CODEC_ID_MJPEG       CODEC_ID_MJPEG
+#endif // !HAVE_AVCodecID
+
+#if !HAVE_av_frame_alloc
+static inline AVFrame *
+av_frame_alloc(void)
+{
+    return avcodec_alloc_frame();
+}
+#endif // !HAVE_av_frame_alloc
+
+#if !HAVE_av_frame_free
+static inline void
+av_frame_free(AVFrame **frame)
+{
+    av_free(*frame);
+    *frame = NULL;
+}
+#endif // !HAVE_av_frame_free
+
+#if HAVE_AVCodecContext_get_buffer2
+#define AVCTX_HAVE_REFCOUNTED_BUFFERS   1
+#else
+#define AVCTX_HAVE_REFCOUNTED_BUFFERS   0
+#endif // HAVE_AVCodecContext_get_buffer2
+
+#ifndef AV_INPUT_BUFFER_PADDING_SIZE
+#define AV_INPUT_BUFFER_PADDING_SIZE    FF_INPUT_BUFFER_PADDING_SIZE
+#endif
+
+#if !HAVE_avcodec_free_context
+static inline void
+avcodec_free_context(AVCodecContext **pavctx)
+{
+    avcodec_close(*pavctx);
+    av_free(*pavctx);
+    *pavctx = NULL;
+}
+#endif // !HAVE_avcodec_free_context
+
+#endif // FPP_COMPAT_FFMPEG_H
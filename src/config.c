@@ -36,6 +36,8 @@ static struct fpp_config_s default_config = {
     .audio_buffer_min_ms =      20,
     .audio_buffer_max_ms =      500,
     .audio_use_jack      =      0,
+    .audio_realtime_priority =  0,
+    .audio_bench_speed =        0,
     .jack_autoconnect_ports =   1,
     .jack_server_name =         NULL,
     .jack_autostart_server =    1,
@@ -47,11 +49,15 @@ static struct fpp_config_s default_config = {
     .fullscreen_width    =      0,
     .fullscreen_height   =      0,
     .randomize_dns_case =       0,
+    .network_threads =          0,
+    .url_loader_memory_limit_kb = 16384,
     .device_scale        =      1.0,
     .enable_windowed_mode   =   1,
     .enable_xembed          =   1,
     .enable_vaapi =             1,
     .enable_vdpau =             1,
+    .enable_swdec =             0,
+    .video_decode_threads =     0,
     .tie_fullscreen_window_to_browser = 1,
     .vsync_afterwait_us =       0,
     .fs_delay_ms =              300,
@@ -69,6 +75,7 @@ static struct fpp_config_s default_config = {
         .incompatible_npapi_version = 0,
         .x_synchronize              = 0,
         .avoid_stdout               = 0,
+        .vaapi_decode_display_lock  = 0,
     },
 };
 
@@ -76,6 +83,8 @@ static cfg_opt_t opts[] = {
     CFG_SIMPLE_INT("audio_buffer_min_ms",    &config.audio_buffer_min_ms),
     CFG_SIMPLE_INT("audio_buffer_max_ms",    &config.audio_buffer_max_ms),
     CFG_SIMPLE_INT("audio_use_jack",         &config.audio_use_jack),
+    CFG_SIMPLE_INT("audio_realtime_priority", &config.audio_realtime_priority),
+    CFG_SIMPLE_INT("audio_bench_speed",      &config.audio_bench_speed),
     CFG_SIMPLE_INT("jack_autoconnect_ports", &config.jack_autoconnect_ports),
     CFG_SIMPLE_STR("jack_server_name",       &config.jack_server_name),
     CFG_SIMPLE_INT("jack_autostart_server",  &config.jack_autostart_server),
@@ -87,16 +96,22 @@ static cfg_opt_t opts[] = {
     CFG_SIMPLE_INT("fullscreen_width",       &config.fullscreen_width),
     CFG_SIMPLE_INT("fullscreen_height",      &config.fullscreen_height),
     CFG_SIMPLE_INT("randomize_dns_case",     &config.randomize_dns_case),
+    CFG_SIMPLE_INT("network_threads",        &config.network_threads),
+    CFG_SIMPLE_INT("url_loader_memory_limit_kb", &config.url_loader_memory_limit_kb),
     CFG_SIMPLE_FLOAT("device_scale",         &config.device_scale),
     CFG_SIMPLE_INT("enable_windowed_mode",   &config.enable_windowed_mode),
     CFG_SIMPLE_INT("enable_xembed",          &config.enable_xembed),
     CFG_SIMPLE_INT("enable_vaapi",           &config.enable_vaapi),
     CFG_SIMPLE_INT("enable_vdpau",           &config.enable_vdpau),
+    CFG_SIMPLE_INT("enable_swdec",           &config.enable_swdec),
+    CFG_SIMPLE_INT("video_decode_threads",   &config.video_decode_threads),
     CFG_SIMPLE_INT("vsync_afterwait_us",     &config.vsync_afterwait_us),
     CFG_SIMPLE_INT("fs_delay_ms",            &config.fs_delay_ms),
     CFG_SIMPLE_INT("enable_vsync",           &config.enable_vsync),
     CFG_SIMPLE_INT("tie_fullscreen_window_to_browser", &config.tie_fullscreen_window_to_browser),
     CFG_SIMPLE_INT("quirk_plasma5_screensaver",        &config.quirks.plasma5_screensaver),
+    CFG_SIMPLE_INT("quirk_vaapi_decode_display_lock",
+                   &config.quirks.vaapi_decode_display_lock),
     CFG_SIMPLE_INT("double_click_delay_ms",  &config.double_click_delay_ms),
     CFG_SIMPLE_INT("show_version_info",      &config.show_version_info),
     CFG_SIMPLE_INT("probe_video_capture_devices", &config.probe_video_capture_devices),
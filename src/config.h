@@ -32,6 +32,8 @@ struct fpp_config_s {
     int     audio_buffer_min_ms;
     int     audio_buffer_max_ms;
     int     audio_use_jack;
+    int     audio_realtime_priority;
+    int     audio_bench_speed;
     int     jack_autoconnect_ports;
     char   *jack_server_name;
     int     jack_autostart_server;
@@ -43,11 +45,15 @@ struct fpp_config_s {
     int     fullscreen_width;
     int     fullscreen_height;
     int     randomize_dns_case;
+    int     network_threads;
+    int     url_loader_memory_limit_kb;
     double  device_scale;
     int     enable_windowed_mode;
     int     enable_xembed;
     int     enable_vaapi;
     int     enable_vdpau;
+    int     enable_swdec;
+    int     video_decode_threads;
     int     tie_fullscreen_window_to_browser;
     int     vsync_afterwait_us;
     int     fs_delay_ms;
@@ -65,6 +71,7 @@ struct fpp_config_s {
         int   incompatible_npapi_version;
         int   x_synchronize;
         int   avoid_stdout;
+        int   vaapi_decode_display_lock;
     } quirks;
 };
 
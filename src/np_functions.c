@@ -610,6 +610,7 @@ destroy_instance_comt(void *user_data, int32_t result)
     pthread_mutex_lock(&display.lock);
     p->pp_i->npp = NULL;
     pthread_mutex_unlock(&display.lock);
+    ppb_core_browser_thread_instance_gone(p->pp_i->id);
 
     ppb_var_release(p->pp_i->instance_url);
     ppb_var_release(p->pp_i->document_url);
@@ -794,6 +795,47 @@ err:
     g_slice_free1(sizeof(*rt), rt);
 }
 
+/// performs queued read tasks while there is data for them. If |finished| is set, remaining
+/// tasks are completed even without data. Returns completed tasks, which are to be posted by
+/// post_read_tasks() after loader is released
+static
+GList *
+take_ready_read_tasks(struct pp_url_loader_s *ul, int finished)
+{
+    GList *done = NULL;
+    guint cnt = 0;
+
+    while (ul->read_tasks) {
+        GList *llink = g_list_first(ul->read_tasks);
+        struct url_loader_read_task_s *rt = llink->data;
+
+        int32_t read_bytes = url_loader_body_read(ul, rt->buffer, MAX(rt->bytes_to_read, 0));
+        if (read_bytes <= 0 && !finished)
+            break;
+
+        ul->read_tasks = g_list_delete_link(ul->read_tasks, llink);
+        rt->result = (read_bytes < 0) ? PP_ERROR_FAILED : read_bytes;
+        done = g_list_prepend(done, rt);
+        cnt ++;
+    }
+
+    ul->read_batch_max = MAX(ul->read_batch_max, cnt);
+    return g_list_reverse(done);
+}
+
+static
+void
+post_read_tasks(GList *tasks)
+{
+    for (GList *ll = tasks; ll != NULL; ll = g_list_next(ll)) {
+        struct url_loader_read_task_s *rt = ll->data;
+        ppb_message_loop_post_work_with_result(rt->ccb_ml,
+                                               PP_MakeCCB(url_read_task_wrapper_comt, rt), 0,
+                                               rt->result, 0, __func__);
+    }
+    g_list_free(tasks);
+}
+
 NPError
 NPP_DestroyStream(NPP npp, NPStream *stream, NPReason reason)
 {
@@ -823,38 +865,20 @@ NPP_DestroyStream(NPP npp, NPStream *stream, NPReason reason)
     ul->finished_loading = 1;
 
     // execute all remaining tasks in task list
-    while (ul && ul->read_tasks) {
-        GList *llink = g_list_first(ul->read_tasks);
-        struct url_loader_read_task_s *rt = llink->data;
-        ul->read_tasks = g_list_delete_link(ul->read_tasks, llink);
-
-        int32_t read_bytes = -1;
-        off_t ofs = lseek(ul->fd, ul->read_pos, SEEK_SET);
-        if (ofs != (off_t) -1)
-            read_bytes = RETRY_ON_EINTR(read(ul->fd, rt->buffer, rt->bytes_to_read));
-
-        if (read_bytes == -1)
-            read_bytes = PP_ERROR_FAILED;
-        else
-            ul->read_pos += read_bytes;
-
-        pp_resource_release(loader);
-        ppb_message_loop_post_work_with_result(rt->ccb_ml,
-                                               PP_MakeCCB(url_read_task_wrapper_comt, rt), 0,
-                                               read_bytes, 0, __func__);
-        ul = pp_resource_acquire(loader, PP_RESOURCE_URL_LOADER);
-    }
+    GList *done = take_ready_read_tasks(ul, 1);
 
-    if (ul && ul->stream_to_file) {
+    if (ul->stream_to_file) {
         struct PP_CompletionCallback ccb = ul->stream_to_file_ccb;
         PP_Resource                  ccb_ml = ul->stream_to_file_ccb_ml;
 
         pp_resource_release(loader);
+        post_read_tasks(done);
         ppb_message_loop_post_work_with_result(ccb_ml, ccb, 0, PP_OK, 0, __func__);
         return NPERR_NO_ERROR;
     }
 
     pp_resource_release(loader);
+    post_read_tasks(done);
     return NPERR_NO_ERROR;
 }
 
@@ -862,7 +886,17 @@ int32_t
 NPP_WriteReady(NPP npp, NPStream *stream)
 {
     trace_info_f("[NPP] {full} %s npp=%p, stream=%p\n", __func__, npp, stream);
-    return 1024*1024;
+    if (config.quirks.plugin_missing)
+        return 1024*1024;
+
+    PP_Resource loader = (PP_Resource)(size_t)stream->pdata;
+    struct pp_url_loader_s *ul = pp_resource_acquire(loader, PP_RESOURCE_URL_LOADER);
+    if (!ul)
+        return 1024*1024;
+
+    int32_t ready = url_loader_body_write_ready(ul);
+    pp_resource_release(loader);
+    return ready;
 }
 
 int32_t
@@ -886,46 +920,21 @@ NPP_Write(NPP npp, NPStream *stream, int32_t offset, int32_t len, void *buffer)
         return -1;
     }
 
-    if (ul->fd == -1 || len <= 0) {
+    if (!ul->body_open || len <= 0) {
         pp_resource_release(loader);
         return len;
     }
 
-    if (lseek(ul->fd, offset, SEEK_SET) == (off_t) -1) {
+    if (url_loader_body_write(ul, offset, buffer, len) != 0) {
         pp_resource_release(loader);
         return -1;
     }
 
-    RETRY_ON_EINTR(write(ul->fd, buffer, len));
-
-    if (ul->read_tasks == NULL) {
-        pp_resource_release(loader);
-        return len;
-    }
-
-    GList *llink = g_list_first(ul->read_tasks);
-    struct url_loader_read_task_s *rt = llink->data;
-    ul->read_tasks = g_list_delete_link(ul->read_tasks, llink);
-
-    int32_t read_bytes = -1;
-    off_t ofs = lseek(ul->fd, ul->read_pos, SEEK_SET);
-    if (ofs != (off_t) -1)
-        read_bytes = RETRY_ON_EINTR(read(ul->fd, rt->buffer, rt->bytes_to_read));
-    if (read_bytes > 0)
-        ul->read_pos += read_bytes;
-
-    if (read_bytes > 0) {
-        pp_resource_release(loader);
-        ppb_message_loop_post_work_with_result(rt->ccb_ml,
-                                               PP_MakeCCB(url_read_task_wrapper_comt, rt), 0,
-                                               read_bytes, 0, __func__);
-        return len;
-    } else {
-        // reschedule task
-        ul->read_tasks = g_list_prepend(ul->read_tasks, rt);
-        pp_resource_release(loader);
-        return len;
-    }
+    // serve as many queued reads as received data allows
+    GList *done = take_ready_read_tasks(ul, 0);
+    pp_resource_release(loader);
+    post_read_tasks(done);
+    return len;
 }
 
 void
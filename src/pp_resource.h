@@ -248,8 +248,22 @@ struct pp_url_loader_s {
     char                   *status_line;    ///< HTTP/1.1 200 OK
     char                   *headers;        ///< response headers
     int                     http_code;      ///< HTTP response code
-    int                     fd;             ///< file used to store response
+    int                     fd;             ///< file used to store response, -1 if response is
+                                            ///< kept in memory
     size_t                  read_pos;       ///< reading position
+    int                     body_open;      ///< response body storage is set up
+    GQueue                  body_chunks;    ///< unread part of response body, if kept in memory
+    size_t                  body_end;       ///< stream offset past the last received byte
+    int                     body_head_dropped;  ///< file lacks bytes read from memory before
+    uint64_t                bytes_copied;   ///< stats: bytes copied through memory buffer
+    uint32_t                spill_count;    ///< stats: times response was moved to a file
+    char                   *readahead;      ///< buffer for small reads from file
+    size_t                  readahead_pos;  ///< stream offset of readahead buffer
+    size_t                  readahead_len;  ///< number of valid bytes in readahead buffer
+    uint32_t                readahead_fills;    ///< stats: times readahead buffer was filled
+    uint32_t                read_queue_max; ///< stats: longest read task queue
+    uint32_t                read_queue_total;   ///< stats: read tasks queued
+    uint32_t                read_batch_max; ///< stats: most read tasks completed at once
     enum pp_request_method_e method;        ///< GET/POST
     char                   *url;            ///< request URL
     char                   *redirect_url;   ///< value of the Location header if this is
@@ -283,6 +297,7 @@ struct url_loader_read_task_s {
     int32_t                         bytes_to_read;
     struct PP_CompletionCallback    ccb;
     PP_Resource                     ccb_ml;
+    int32_t                         result;     ///< read result, set on completion
 };
 
 struct pp_url_request_info_s {
@@ -420,6 +435,11 @@ struct pp_printing_s {
     COMMON_STRUCTURE_FIELDS
 };
 
+enum video_capture_io_e {
+    VIDEO_CAPTURE_IO_READ = 0,  ///< read() from device
+    VIDEO_CAPTURE_IO_MMAP,      ///< streaming I/O with memory-mapped buffers
+};
+
 struct pp_video_capture_s {
     COMMON_STRUCTURE_FIELDS
     int                 fd;
@@ -433,6 +453,27 @@ struct pp_video_capture_s {
     pthread_t           thread;
     uint32_t            thread_started;
     uint32_t            terminate_thread;
+    pthread_mutex_t     lock;           ///< protects buffer_is_free and terminate_thread
+    pthread_cond_t      buffer_freed;   ///< signaled on ReuseBuffer() and on termination
+    enum video_capture_io_e io_method;
+    struct {
+        void       *start;
+        size_t      length;
+    }                  *mmap_buffers;   ///< device buffers, for VIDEO_CAPTURE_IO_MMAP
+    uint32_t            mmap_buffer_count;
+    uint32_t            streaming;      ///< VIDIOC_STREAMON was called
+    uint32_t            pixelformat;    ///< format device captures in, converted to I420
+    uint32_t            bytesperline;
+    uint8_t            *frame_buf;      ///< staging buffer for read() and MJPEG decoding
+    size_t              frame_buf_size;
+#if HAVE_HWDEC
+    AVCodecContext     *mjpeg_ctx;
+    AVFrame            *mjpeg_frame;
+#endif // HAVE_HWDEC
+    int64_t             capture_start_time;
+    uint32_t            frame_count;
+    uint64_t            conversion_time_total_us;
+    uint32_t            conversion_time_max_us;
     const struct PPP_VideoCapture_Dev_0_1 *ppp_video_capture_dev;
     PP_Resource         message_loop;
 };
@@ -466,6 +507,7 @@ struct pp_tcp_socket_s {
     unsigned int    is_connected;
     unsigned int    destroyed;
     unsigned int    seen_eof;
+    int             no_delay;       ///< TCP_NODELAY set by plugin, or -1. Restored after connect
 };
 
 struct pp_file_ref_s {
@@ -497,6 +539,7 @@ enum hwdec_api_e {
     HWDEC_NONE = 0,
     HWDEC_VAAPI,
     HWDEC_VDPAU,
+    HWDEC_SOFTWARE,     ///< libavcodec decodes, frames are uploaded into textures
 };
 
 #if HAVE_HWDEC
@@ -520,7 +563,7 @@ struct pp_video_decoder_s {
     AVCodecContext         *avctx;
     AVCodecParserContext   *avparser;
     AVFrame                *avframe;
-    uint32_t                width;
+    uint32_t                width;                  ///< of hw surfaces, 0 if there are none
     uint32_t                height;
     int32_t                 last_consumed_bitstream_buffer_id;
     size_t                  buffer_count;
@@ -535,6 +578,12 @@ struct pp_video_decoder_s {
         VdpPresentationQueueTarget  vdp_presentation_queue_target;
         VdpPresentationQueue        vdp_presentation_queue;
     } *buffers;
+    uint32_t               *free_buffers;           ///< ring of free buffer indices
+    uint32_t                free_buffers_head;
+    uint32_t                free_buffer_count;
+    GHashTable             *buffer_idx;             ///< picture buffer id -> index + 1
+    int                     pixmap_depth;           ///< of picture buffer pixmaps
+    int                     fb_config_id;
     struct vaapi_context    va_context;
     struct AVVDPAUContext   vdpau_context;
     VASurfaceID             surfaces[MAX_VA_SURFACES];
@@ -543,11 +592,33 @@ struct pp_video_decoder_s {
 
     VdpVideoMixer           vdp_video_mixer;
     VdpOutputSurface        vdp_output_surface;
+    uint8_t                *rgba_buf;               ///< software decoding conversion buffer
+    size_t                  rgba_buf_size;
 
     unsigned int            initialized : 1;
     unsigned int            buffers_were_requested : 1;
-    unsigned int            failed_state : 1;
+    unsigned int            decode_holds_display_lock : 1;
+    volatile gint           failed_state;
     enum hwdec_api_e        hwdec_api;  ///< HW decoding API used by this resource
+
+    // Decoding is done in a separate thread. It gets bitstream buffers and commands through
+    // task_queue, decoded frames wait in output_queue for a free picture buffer.
+    pthread_t               decoder_thread;
+    int                     decoder_thread_started;
+    GAsyncQueue            *task_queue;
+    GQueue                 *output_queue;           ///< accessed by decoder thread only
+    GQueue                 *deferred_tasks;         ///< tasks waiting for output_queue space
+    pthread_mutex_t         buffers_lock;           ///< protects buffers and free buffer ring
+    PP_Resource             message_loop;           ///< plugin callbacks are called there
+
+    // statistics, updated by decoder thread
+    uint32_t                frame_count;
+    uint32_t                queued_frame_count;     ///< frames which waited for a buffer
+    uint32_t                dropped_frame_count;
+    uint64_t                decode_time_total_us;   ///< time spent in libavcodec
+    uint32_t                decode_time_max_us;
+    uint64_t                latency_total_us;       ///< from Decode() call to PictureReady
+    uint32_t                latency_max_us;
 #endif // HAVE_HWDEC
 };
 
@@ -135,6 +135,18 @@ ppb_audio_destroy(void *p)
         a->is_playing = 0;
     }
 
+    if (a->stream_ops->get_stats) {
+        audio_stream_stats stats = {};
+        a->stream_ops->get_stats(a->stream, &stats);
+        trace_info_f("%s, audio stream stats: callbacks=%u, underruns=%u, xruns=%u, "
+                     "max callback latency=%u us, sched policy=%d, server requests=%u..%u "
+                     "frames, chunk=%u frames\n", __func__,
+                     stats.callback_count, stats.underrun_count, stats.xrun_count,
+                     stats.max_callback_latency_us, stats.sched_policy,
+                     stats.min_request_frames, stats.max_request_frames,
+                     a->sample_frame_count);
+    }
+
     a->stream_ops->destroy(a->stream);
 }
 
@@ -61,8 +61,18 @@ void
 ppb_audio_input_destroy(void *ptr)
 {
     struct pp_audio_input_s *ai = ptr;
-    if (ai->stream)
-        ai->stream_ops->destroy(ai->stream);
+    if (!ai->stream)
+        return;
+
+    if (ai->stream_ops->get_stats) {
+        audio_stream_stats stats = {};
+        ai->stream_ops->get_stats(ai->stream, &stats);
+        trace_info_f("%s, capture stream stats: callbacks=%u, overruns=%u, xruns=%u, "
+                     "max callback latency=%u us\n", __func__, stats.callback_count,
+                     stats.overrun_count, stats.xrun_count, stats.max_callback_latency_us);
+    }
+
+    ai->stream_ops->destroy(ai->stream);
 }
 
 PP_Bool
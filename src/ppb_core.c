@@ -100,6 +100,22 @@ struct call_on_browser_thread_task_s {
     void            *user_data;
 };
 
+struct coalesced_task_s {
+    PP_Instance     instance;
+    void            (*func)(void *);
+    void            *user_data;     ///< most recent data passed to the task
+};
+
+// There is only one browser thread loop, so activation state is global rather than per instance.
+// Activation is scheduled through some instance, and is lost if browser drops async calls for it,
+// e.g. during instance teardown. Owner is tracked to re-arm activation in that case.
+static pthread_mutex_t  activation_lock = PTHREAD_MUTEX_INITIALIZER;
+static int              activation_pending = 0;     ///< NPN_PluginThreadAsyncCall is scheduled
+static PP_Instance      activation_owner = 0;       ///< instance activation was scheduled through
+
+static GList           *coalesced_tasks = NULL;
+static pthread_mutex_t  coalesced_tasks_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static
 void
 call_on_browser_thread_comt(void *user_data, int32_t result)
@@ -113,12 +129,49 @@ static
 void
 activate_browser_thread_ml_ptac(void *param)
 {
+    // Allow next call to schedule activation again. Flag is cleared before running the loop, so
+    // every task pushed before this point will be run by the loop below.
+    pthread_mutex_lock(&activation_lock);
+    activation_pending = 0;
+    pthread_mutex_unlock(&activation_lock);
+
     // If task was already executed and queue is empty, ppb_message_loop_run_int() will return
     // without waiting.
     PP_Resource m_loop = ppb_message_loop_get_for_browser_thread();
     ppb_message_loop_run_int(m_loop, ML_INCREASE_DEPTH | ML_EXIT_ON_EMPTY | ML_NESTED);
 }
 
+static
+void
+schedule_browser_thread_activation(struct pp_instance_s *pp_i)
+{
+    // Activation routine runs all queued tasks, so there is no need to schedule another one
+    // while previous is still pending.
+    pthread_mutex_lock(&activation_lock);
+    if (activation_pending) {
+        pthread_mutex_unlock(&activation_lock);
+        return;
+    }
+    activation_pending = 1;
+    activation_owner = pp_i->id;
+    pthread_mutex_unlock(&activation_lock);
+
+    pthread_mutex_lock(&display.lock);
+    const int scheduled = (pp_i->npp != NULL);
+    if (scheduled) {
+        npn.pluginthreadasynccall(pp_i->npp, activate_browser_thread_ml_ptac,
+                                  GSIZE_TO_POINTER(pp_i->id));
+    }
+    pthread_mutex_unlock(&display.lock);
+
+    if (!scheduled) {
+        pthread_mutex_lock(&activation_lock);
+        if (activation_owner == pp_i->id)
+            activation_pending = 0;
+        pthread_mutex_unlock(&activation_lock);
+    }
+}
+
 // Schedules task for execution on browser thread.
 //
 // Since there is no access to browser event loop, we start a nested event loop which is terminated
@@ -148,11 +201,73 @@ ppb_core_call_on_browser_thread(PP_Instance instance, void (*func)(void *), void
         return;
     }
 
-    // Schedule activation routine.
-    pthread_mutex_lock(&display.lock);
-    if (pp_i->npp)
-        npn.pluginthreadasynccall(pp_i->npp, activate_browser_thread_ml_ptac, user_data);
-    pthread_mutex_unlock(&display.lock);
+    schedule_browser_thread_activation(pp_i);
+}
+
+// Called on instance teardown, after instance was removed from tables. Activation scheduled
+// through that instance may never arrive, so it's scheduled again through another one.
+void
+ppb_core_browser_thread_instance_gone(PP_Instance instance)
+{
+    pthread_mutex_lock(&activation_lock);
+    const int rearm = activation_pending && activation_owner == instance;
+    if (rearm)
+        activation_pending = 0;
+    pthread_mutex_unlock(&activation_lock);
+
+    if (!rearm)
+        return;
+
+    struct pp_instance_s *pp_i = tables_get_some_pp_instance();
+    if (pp_i)
+        schedule_browser_thread_activation(pp_i);
+}
+
+static
+void
+call_coalesced_ptac(void *param)
+{
+    struct coalesced_task_s *ct = param;
+
+    // detach task, so subsequent calls will schedule a new one
+    pthread_mutex_lock(&coalesced_tasks_lock);
+    coalesced_tasks = g_list_remove(coalesced_tasks, ct);
+    pthread_mutex_unlock(&coalesced_tasks_lock);
+
+    ct->func(ct->user_data);
+    g_slice_free(struct coalesced_task_s, ct);
+}
+
+// Idempotent tasks (redraws, cursor and caret updates) only need their latest state to be applied.
+// If task with the same instance and function is still waiting in the queue, its data are
+// replaced instead of queueing another one.
+void
+ppb_core_call_on_browser_thread_coalesced(PP_Instance instance, void (*func)(void *),
+                                          void *user_data, void (*free_func)(void *))
+{
+    pthread_mutex_lock(&coalesced_tasks_lock);
+    for (GList *ll = coalesced_tasks; ll != NULL; ll = g_list_next(ll)) {
+        struct coalesced_task_s *ct = ll->data;
+
+        if (ct->instance == instance && ct->func == func) {
+            void *prev_user_data = ct->user_data;
+            ct->user_data = user_data;
+            pthread_mutex_unlock(&coalesced_tasks_lock);
+
+            if (free_func && prev_user_data != user_data)
+                free_func(prev_user_data);
+            return;
+        }
+    }
+
+    struct coalesced_task_s *ct = g_slice_alloc(sizeof(*ct));
+    ct->instance =  instance;
+    ct->func =      func;
+    ct->user_data = user_data;
+    coalesced_tasks = g_list_prepend(coalesced_tasks, ct);
+    pthread_mutex_unlock(&coalesced_tasks_lock);
+
+    ppb_core_call_on_browser_thread(instance, call_coalesced_ptac, ct);
 }
 
 PP_Bool
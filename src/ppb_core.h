@@ -59,6 +59,18 @@ ppb_core_call_on_main_thread2(int32_t delay_in_milliseconds, struct PP_Completio
 void
 ppb_core_call_on_browser_thread(PP_Instance instance, void (*func)(void *), void *user_data);
 
+/// schedule idempotent task for execution on browser thread
+///
+/// At most one task with the same @instance and @func is pending at any time. If there is one
+/// already, its @user_data is replaced, and previous one is freed with @free_func (if not NULL).
+void
+ppb_core_call_on_browser_thread_coalesced(PP_Instance instance, void (*func)(void *),
+                                          void *user_data, void (*free_func)(void *));
+
+/// re-arm browser thread activation if it was scheduled through now destroyed @instance
+void
+ppb_core_browser_thread_instance_gone(PP_Instance instance);
+
 PP_Bool
 ppb_core_is_main_thread(void);
 
@@ -69,6 +69,13 @@ create_cursor_from_image_data_resource(Display *dpy, Window wnd, PP_Resource ima
     return cursor;
 }
 
+static
+void
+comt_param_free(void *user_data)
+{
+    g_slice_free(struct comt_param_s, user_data);
+}
+
 void
 set_cursor_ptac(void *user_data)
 {
@@ -114,7 +121,7 @@ set_cursor_ptac(void *user_data)
     pthread_mutex_unlock(&display.lock);
 
 quit:
-    g_slice_free(struct comt_param_s, params);
+    comt_param_free(params);
 }
 
 PP_Bool
@@ -282,7 +289,9 @@ ppb_cursor_control_set_cursor(PP_Instance instance, enum PP_CursorType_Dev type,
         comt_params->hotspot_y = hot_spot->y;
     }
 
-    ppb_core_call_on_browser_thread(instance, set_cursor_ptac, comt_params);
+    // only the latest cursor shape matters
+    ppb_core_call_on_browser_thread_coalesced(instance, set_cursor_ptac, comt_params,
+                                              comt_param_free);
 
     return PP_TRUE;
 }
@@ -26,12 +26,32 @@
 #include <stdlib.h>
 #include <ppapi/c/pp_errors.h>
 #include <inttypes.h>
+#include <unistd.h>
 #include "trace.h"
 #include "tables.h"
 #include "pp_resource.h"
 #include "ppb_core.h"
 #include "pp_interface.h"
 #include "ppb_message_loop.h"
+#include "worker_pool.h"
+#include "eintr_retry.h"
+
+
+enum file_io_op_e {
+    FILE_IO_OP_READ,
+    FILE_IO_OP_WRITE,
+    FILE_IO_OP_SET_LENGTH,
+    FILE_IO_OP_FLUSH,
+};
+
+struct file_io_op_s {
+    enum file_io_op_e   type;
+    PP_Resource         file_io;
+    int                 fd;
+    int64_t             offset;
+    char               *buffer;
+    int32_t             bufsize;
+};
 
 
 int32_t
@@ -150,30 +170,118 @@ ppb_file_io_touch(PP_Resource file_io, PP_Time last_access_time, PP_Time last_mo
     return PP_OK;
 }
 
+// runs on a worker pool thread, or on the caller thread for blocking calls
+static
+int32_t
+file_io_do_op(void *user_data)
+{
+    struct file_io_op_s *op = user_data;
+    int32_t retval;
+
+    switch (op->type) {
+    case FILE_IO_OP_READ:
+        retval = RETRY_ON_EINTR(pread(op->fd, op->buffer, op->bufsize, op->offset));
+        break;
+    case FILE_IO_OP_WRITE:
+        retval = RETRY_ON_EINTR(pwrite(op->fd, op->buffer, op->bufsize, op->offset));
+        break;
+    case FILE_IO_OP_SET_LENGTH:
+        retval = RETRY_ON_EINTR(ftruncate(op->fd, op->offset));
+        break;
+    case FILE_IO_OP_FLUSH:
+        retval = RETRY_ON_EINTR(fdatasync(op->fd));
+        break;
+    default:
+        trace_error("%s, never reached\n", __func__);
+        retval = -1;
+        break;
+    }
+
+    if (retval < 0)
+        retval = PP_ERROR_FAILED;
+
+    pp_resource_unref(op->file_io);
+    g_slice_free(struct file_io_op_s, op);
+    return retval;
+}
+
+static
+int32_t
+file_io_schedule_op(PP_Resource file_io, struct file_io_op_s *op,
+                    struct PP_CompletionCallback callback)
+{
+    struct pp_file_io_s *fio = pp_resource_acquire(file_io, PP_RESOURCE_FILE_IO);
+    if (!fio) {
+        trace_error("%s, bad resource\n", __func__);
+        g_slice_free(struct file_io_op_s, op);
+        return PP_ERROR_BADRESOURCE;
+    }
+
+    if (fio->fd < 0) {
+        pp_resource_release(file_io);
+        g_slice_free(struct file_io_op_s, op);
+        return PP_ERROR_FAILED;
+    }
+
+    // keep resource (and thus its file descriptor) alive until operation is done
+    op->file_io = file_io;
+    op->fd = fio->fd;
+    pp_resource_ref(file_io);
+    pp_resource_release(file_io);
+
+    if (callback.func == NULL) {
+        // blocking call
+        return file_io_do_op(op);
+    }
+
+    worker_pool_run_with_completion(file_io_do_op, op, callback, ppb_message_loop_get_current(),
+                                    __func__);
+    return PP_OK_COMPLETIONPENDING;
+}
+
 int32_t
 ppb_file_io_read(PP_Resource file_io, int64_t offset, char *buffer, int32_t bytes_to_read,
                  struct PP_CompletionCallback callback)
 {
-    return PP_OK;
+    struct file_io_op_s *op = g_slice_new0(struct file_io_op_s);
+
+    op->type =      FILE_IO_OP_READ;
+    op->offset =    offset;
+    op->buffer =    buffer;
+    op->bufsize =   MAX(bytes_to_read, 0);
+    return file_io_schedule_op(file_io, op, callback);
 }
 
 int32_t
 ppb_file_io_write(PP_Resource file_io, int64_t offset, const char *buffer, int32_t bytes_to_write,
                   struct PP_CompletionCallback callback)
 {
-    return PP_OK;
+    struct file_io_op_s *op = g_slice_new0(struct file_io_op_s);
+
+    op->type =      FILE_IO_OP_WRITE;
+    op->offset =    offset;
+    op->buffer =    (char *)buffer;
+    op->bufsize =   MAX(bytes_to_write, 0);
+    return file_io_schedule_op(file_io, op, callback);
 }
 
 int32_t
 ppb_file_io_set_length(PP_Resource file_io, int64_t length, struct PP_CompletionCallback callback)
 {
-    return PP_OK;
+    struct file_io_op_s *op = g_slice_new0(struct file_io_op_s);
+
+    op->type =      FILE_IO_OP_SET_LENGTH;
+    op->offset =    length;
+    return file_io_schedule_op(file_io, op, callback);
 }
 
 int32_t
 ppb_file_io_flush(PP_Resource file_io, struct PP_CompletionCallback callback)
 {
-    return PP_OK;
+    struct file_io_op_s *op = g_slice_new0(struct file_io_op_s);
+
+    op->type =      FILE_IO_OP_FLUSH;
+    return file_io_schedule_op(file_io, op, callback);
 }
 
 void
@@ -254,7 +362,7 @@ int32_t
 trace_ppb_file_io_read(PP_Resource file_io, int64_t offset, char *buffer, int32_t bytes_to_read,
                        struct PP_CompletionCallback callback)
 {
-    trace_info("[PPB] {zilch} %s file_io=%d, offset=%"PRId64", bytes_to_read=%d, "
+    trace_info("[PPB] {full} %s file_io=%d, offset=%"PRId64", bytes_to_read=%d, "
                "callback={.func=%p, .user_data=%p, .flags=%u}\n", __func__+6, file_io, offset,
                bytes_to_read, callback.func, callback.user_data, callback.flags);
     return ppb_file_io_read(file_io, offset, buffer, bytes_to_read, callback);
@@ -265,7 +373,7 @@ int32_t
 trace_ppb_file_io_write(PP_Resource file_io, int64_t offset, const char *buffer,
                         int32_t bytes_to_write, struct PP_CompletionCallback callback)
 {
-    trace_info("[PPB] {zilch} %s file_io=%d, offset=%"PRId64", bytes_to_write=%d, "
+    trace_info("[PPB] {full} %s file_io=%d, offset=%"PRId64", bytes_to_write=%d, "
                "callback={.func=%p, .user_data=%p, .flags=%u}\n", __func__+6, file_io, offset,
                bytes_to_write, callback.func, callback.user_data, callback.flags);
     return ppb_file_io_write(file_io, offset, buffer, bytes_to_write, callback);
@@ -276,7 +384,7 @@ int32_t
 trace_ppb_file_io_set_length(PP_Resource file_io, int64_t length,
                              struct PP_CompletionCallback callback)
 {
-    trace_info("[PPB] {zilch} %s file_io=%d, length=%"PRId64", callback={.func=%p, .user_data=%p, "
+    trace_info("[PPB] {full} %s file_io=%d, length=%"PRId64", callback={.func=%p, .user_data=%p, "
                ".flags=%u}\n", __func__+6, file_io, length, callback.func, callback.user_data,
                callback.flags);
     return ppb_file_io_set_length(file_io, length, callback);
@@ -286,7 +394,7 @@ TRACE_WRAPPER
 int32_t
 trace_ppb_file_io_flush(PP_Resource file_io, struct PP_CompletionCallback callback)
 {
-    trace_info("[PPB] {zilch} %s file_io=%d, callback={.func=%p, .user_data=%p, .flags=%u}\n",
+    trace_info("[PPB] {full} %s file_io=%d, callback={.func=%p, .user_data=%p, .flags=%u}\n",
                __func__+6, file_io, callback.func, callback.user_data, callback.flags);
     return ppb_file_io_flush(file_io, callback);
 }
@@ -324,7 +324,8 @@ ppb_graphics2d_flush(PP_Resource graphics_2d, struct PP_CompletionCallback callb
 
     pp_resource_release(graphics_2d);
 
-    ppb_core_call_on_browser_thread(pp_i->id, call_forceredraw_ptac, GSIZE_TO_POINTER(pp_i->id));
+    ppb_core_call_on_browser_thread_coalesced(pp_i->id, call_forceredraw_ptac,
+                                              GSIZE_TO_POINTER(pp_i->id), NULL);
 
     if (callback.func) {
         // invoke callback as soon as possible if graphics device is not bound to an instance
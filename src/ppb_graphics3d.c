@@ -456,7 +456,8 @@ ppb_graphics3d_swap_buffers(PP_Resource context, struct PP_CompletionCallback ca
     pp_i->graphics_in_progress = 1;
     pthread_mutex_unlock(&display.lock);
 
-    ppb_core_call_on_browser_thread(pp_i->id, call_forceredraw_ptac, GSIZE_TO_POINTER(pp_i->id));
+    ppb_core_call_on_browser_thread_coalesced(pp_i->id, call_forceredraw_ptac,
+                                              GSIZE_TO_POINTER(pp_i->id), NULL);
 
     if (callback.func)
         return PP_OK_COMPLETIONPENDING;
@@ -120,8 +120,8 @@ done:
 
     if (invalidate_area) {
         // successful binding causes plugin graphics area invalidation
-        ppb_core_call_on_browser_thread(instance, call_invalidaterect_ptac,
-                                        GSIZE_TO_POINTER(instance));
+        ppb_core_call_on_browser_thread_coalesced(instance, call_invalidaterect_ptac,
+                                                  GSIZE_TO_POINTER(instance), NULL);
     }
 
     return retval;
@@ -26,6 +26,8 @@
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <ppapi/c/pp_errors.h>
 #include "ppb_core.h"
 #include "trace.h"
@@ -52,6 +54,7 @@ ppb_tcp_socket_create(PP_Instance instance)
     }
 
     ts->sock = socket(AF_INET, SOCK_STREAM, 0);
+    ts->no_delay = -1;
     pp_resource_release(tcp_socket);
     return tcp_socket;
 }
@@ -221,13 +224,11 @@ ppb_tcp_socket_read(PP_Resource tcp_socket, char *buffer, int32_t bytes_to_read,
         return PP_ERROR_FAILED;
     }
 
-    if (bytes_to_read > 1024 * 1024)
-        bytes_to_read = 1024 * 1024;
-
     struct async_network_task_s *task = async_network_task_create();
 
     task->type = ASYNC_NETWORK_TCP_READ;
     task->resource = tcp_socket;
+    task->sock = ts->sock;
     task->buffer = buffer;
     task->bufsize = bytes_to_read;
     task->callback = callback;
@@ -259,13 +260,11 @@ ppb_tcp_socket_write(PP_Resource tcp_socket, const char *buffer, int32_t bytes_t
         return PP_ERROR_FAILED;
     }
 
-    if (bytes_to_write > 1024 * 1024)
-        bytes_to_write = 1024 * 1024;
-
     struct async_network_task_s *task = async_network_task_create();
 
     task->type = ASYNC_NETWORK_TCP_WRITE;
     task->resource = tcp_socket;
+    task->sock = ts->sock;
     task->buffer = (char *)buffer;
     task->bufsize = bytes_to_write;
     task->callback = callback;
@@ -292,7 +291,37 @@ int32_t
 ppb_tcp_socket_set_option(PP_Resource tcp_socket, PP_TCPSocketOption_Private name,
                           struct PP_Var value, struct PP_CompletionCallback callback)
 {
-    return -1;
+    if (name != PP_TCPSOCKETOPTION_PRIVATE_NO_DELAY) {
+        trace_error("%s, unknown option %d\n", __func__, name);
+        return PP_ERROR_BADARGUMENT;
+    }
+
+    if (value.type != PP_VARTYPE_BOOL) {
+        trace_error("%s, bad value type\n", __func__);
+        return PP_ERROR_BADARGUMENT;
+    }
+
+    struct pp_tcp_socket_s *ts = pp_resource_acquire(tcp_socket, PP_RESOURCE_TCP_SOCKET);
+    if (!ts) {
+        trace_error("%s, bad resource\n", __func__);
+        return PP_ERROR_BADRESOURCE;
+    }
+
+    // remembered, as connect may replace the socket
+    int flag = value.value.as_bool ? 1 : 0;
+    int ret = setsockopt(ts->sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    if (ret == 0)
+        ts->no_delay = flag;
+    pp_resource_release(tcp_socket);
+
+    if (ret != 0) {
+        trace_warning("%s, setsockopt failed\n", __func__);
+        return PP_ERROR_FAILED;
+    }
+
+    ppb_message_loop_post_work_with_result(ppb_message_loop_get_current(), callback, 0, PP_OK, 0,
+                                           __func__);
+    return PP_OK_COMPLETIONPENDING;
 }
 
 
@@ -415,7 +444,11 @@ int32_t
 trace_ppb_tcp_socket_set_option(PP_Resource tcp_socket, PP_TCPSocketOption_Private name,
                                 struct PP_Var value, struct PP_CompletionCallback callback)
 {
-    trace_info("[PPB] {zilch} %s\n", __func__+6);
+    gchar *s_value = trace_var_as_string(value);
+    trace_info("[PPB] {full} %s tcp_socket=%d, name=%d, value=%s, callback={.func=%p, "
+               ".user_data=%p, .flags=%d}\n", __func__+6, tcp_socket, name, s_value,
+               callback.func, callback.user_data, callback.flags);
+    g_free(s_value);
     return ppb_tcp_socket_set_option(tcp_socket, name, value, callback);
 }
 
@@ -89,6 +89,13 @@ struct update_caret_position_param_s {
     GdkRectangle    caret;
 };
 
+static
+void
+update_caret_position_param_free(void *param)
+{
+    g_slice_free(struct update_caret_position_param_s, param);
+}
+
 static
 void
 update_caret_position_ptac(void *param)
@@ -97,7 +104,7 @@ update_caret_position_ptac(void *param)
     struct pp_instance_s *pp_i = tables_get_pp_instance(p->instance);
     if (!pp_i) {
         trace_error("%s, bad instance\n", __func__);
-        return;
+        goto done;
     }
 
     p->caret.x += pp_i->offset_x;
@@ -105,7 +112,9 @@ update_caret_position_ptac(void *param)
 
     if (pp_i->im_context)
         gtk_im_context_set_cursor_location(pp_i->im_context, &p->caret);
-    g_slice_free1(sizeof(*p), p);
+
+done:
+    update_caret_position_param_free(p);
 }
 
 void
@@ -122,7 +131,9 @@ ppb_text_input_interface_update_caret_position(PP_Instance instance, const struc
     p->caret.width =  caret->size.width;
     p->caret.height = caret->size.height;
 
-    ppb_core_call_on_browser_thread(instance, update_caret_position_ptac, p);
+    // only the latest caret position matters
+    ppb_core_call_on_browser_thread_coalesced(instance, update_caret_position_ptac, p,
+                                              update_caret_position_param_free);
 }
 
 static
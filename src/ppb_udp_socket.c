@@ -143,10 +143,17 @@ ppb_udp_socket_recv_from(PP_Resource udp_socket, char *buffer, int32_t num_bytes
         return PP_ERROR_BADRESOURCE;
     }
 
+    if (us->destroyed) {
+        trace_warning("%s, socket is closed\n", __func__);
+        pp_resource_release(udp_socket);
+        return PP_ERROR_FAILED;
+    }
+
     struct async_network_task_s *task = async_network_task_create();
 
     task->type = ASYNC_NETWORK_UDP_RECV;
     task->resource = udp_socket;
+    task->sock =     us->sock;
     task->buffer =   buffer;
     task->bufsize =  num_bytes;
     task->callback = callback;
@@ -190,11 +197,18 @@ ppb_udp_socket_send_to(PP_Resource udp_socket, const char *buffer, int32_t num_b
         return PP_ERROR_BADRESOURCE;
     }
 
+    if (us->destroyed) {
+        trace_warning("%s, socket is closed\n", __func__);
+        pp_resource_release(udp_socket);
+        return PP_ERROR_FAILED;
+    }
+
     num_bytes = MIN(num_bytes, 128 * 1024);
 
     struct async_network_task_s *task = async_network_task_create();
     task->type =     ASYNC_NETWORK_UDP_SEND;
     task->resource = udp_socket;
+    task->sock =     us->sock;
     task->buffer =   (char *)buffer;
     task->bufsize =  num_bytes;
     task->callback = callback;
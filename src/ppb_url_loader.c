@@ -76,10 +76,18 @@ ppb_url_loader_destroy(void *p)
         return;
     struct pp_url_loader_s *ul = p;
 
-    if (ul->fd >= 0) {
-        close(ul->fd);
-        ul->fd = -1;
+    if (ul->bytes_copied > 0 || ul->spill_count > 0) {
+        trace_info_f("%s, %" PRIu64 " bytes copied through memory, %u spills to file, "
+                     "%u readahead fills\n", __func__, ul->bytes_copied, ul->spill_count,
+                     ul->readahead_fills);
+    }
+    if (ul->read_queue_total > 0) {
+        trace_info_f("%s, %u read tasks queued, queue depth up to %u, up to %u completed at "
+                     "once\n", __func__, ul->read_queue_total, ul->read_queue_max,
+                     ul->read_batch_max);
     }
+
+    url_loader_body_close(ul);
     free_and_nullify(ul->headers);
     free_and_nullify(ul->url);
     free_and_nullify(ul->status_line);
@@ -246,6 +254,257 @@ open_temporary_file(void)
     return fd;
 }
 
+#define BODY_CHUNK_SIZE     (64 * 1024)
+#define READAHEAD_SIZE      (64 * 1024)
+#define WRITE_READY_MAX     (1024 * 1024)
+
+struct body_chunk_s {
+    size_t  size;       ///< capacity of data[]
+    size_t  used;       ///< bytes stored
+    size_t  pos;        ///< bytes already read
+    char    data[];
+};
+
+static
+int
+pwrite_all(int fd, const char *buf, size_t len, size_t offset)
+{
+    while (len > 0) {
+        ssize_t written = RETRY_ON_EINTR(pwrite(fd, buf, len, offset));
+        if (written <= 0)
+            return -1;
+        buf += written;
+        len -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+static
+void
+free_body_chunks(struct pp_url_loader_s *ul)
+{
+    struct body_chunk_s *chunk;
+    while ((chunk = g_queue_pop_head(&ul->body_chunks)) != NULL)
+        g_free(chunk);
+}
+
+int
+url_loader_body_open(struct pp_url_loader_s *ul)
+{
+    ul->body_end = 0;
+    ul->body_head_dropped = 0;
+
+    if (ul->stream_to_file || config.url_loader_memory_limit_kb <= 0) {
+        ul->fd = open_temporary_file();
+        if (ul->fd < 0) {
+            trace_error("%s, can't create temporary file\n", __func__);
+            return -1;
+        }
+    }
+
+    ul->body_open = 1;
+    return 0;
+}
+
+void
+url_loader_body_close(struct pp_url_loader_s *ul)
+{
+    if (ul->fd >= 0) {
+        close(ul->fd);
+        ul->fd = -1;
+    }
+    free_body_chunks(ul);
+    g_free(ul->readahead);
+    ul->readahead = NULL;
+    ul->readahead_len = 0;
+    ul->body_open = 0;
+}
+
+int
+url_loader_body_spill(struct pp_url_loader_s *ul)
+{
+    if (ul->fd >= 0)
+        return ul->fd;
+
+    int fd = open_temporary_file();
+    if (fd < 0) {
+        trace_error("%s, can't create temporary file\n", __func__);
+        return -1;
+    }
+
+    // chunks hold bytes from reading position up to the end of received data. Bytes before it
+    // are gone, and file will have a hole there
+    int ret = 0;
+    size_t offset = ul->read_pos;
+
+    struct body_chunk_s *chunk;
+    while ((chunk = g_queue_pop_head(&ul->body_chunks)) != NULL) {
+        const size_t n = chunk->used - chunk->pos;
+        if (ret == 0)
+            ret = pwrite_all(fd, chunk->data + chunk->pos, n, offset);
+        offset += n;
+        g_free(chunk);
+    }
+
+    if (ret != 0) {
+        trace_error("%s, can't write to temporary file\n", __func__);
+        close(fd);
+        return -1;
+    }
+
+    ul->fd = fd;
+    ul->body_head_dropped = (ul->read_pos > 0);
+    ul->spill_count ++;
+    return fd;
+}
+
+int
+url_loader_body_get_file(struct pp_url_loader_s *ul)
+{
+    if (ul->body_head_dropped || (ul->fd < 0 && ul->read_pos > 0)) {
+        trace_error("%s, body was partially read from memory, it's no longer complete\n",
+                    __func__);
+        return -1;
+    }
+
+    return url_loader_body_spill(ul);
+}
+
+int
+url_loader_body_write(struct pp_url_loader_s *ul, size_t offset, const void *buf, size_t len)
+{
+    if (ul->fd < 0) {
+        const size_t limit = (size_t)config.url_loader_memory_limit_kb * 1024;
+        const size_t buffered = ul->body_end - ul->read_pos;
+
+        if (offset == ul->body_end && buffered + len <= limit) {
+            const char *src = buf;
+            size_t left = len;
+
+            while (left > 0) {
+                struct body_chunk_s *chunk = g_queue_peek_tail(&ul->body_chunks);
+                if (!chunk || chunk->used == chunk->size) {
+                    const size_t size = MAX(left, BODY_CHUNK_SIZE);
+                    chunk = g_malloc(sizeof(*chunk) + size);
+                    chunk->size = size;
+                    chunk->used = 0;
+                    chunk->pos = 0;
+                    g_queue_push_tail(&ul->body_chunks, chunk);
+                }
+
+                const size_t n = MIN(left, chunk->size - chunk->used);
+                memcpy(chunk->data + chunk->used, src, n);
+                chunk->used += n;
+                src += n;
+                left -= n;
+            }
+
+            ul->body_end += len;
+            ul->bytes_copied += len;
+            return 0;
+        }
+
+        // out of order write or too much unread data, continue with a file
+        if (url_loader_body_spill(ul) < 0)
+            return -1;
+    }
+
+    if (pwrite_all(ul->fd, buf, len, offset) != 0)
+        return -1;
+
+    // drop readahead data if it was overwritten
+    if (offset < ul->readahead_pos + ul->readahead_len && ul->readahead_pos < offset + len)
+        ul->readahead_len = 0;
+
+    ul->body_end = MAX(ul->body_end, offset + len);
+    return 0;
+}
+
+/// reads from file-backed body, small reads are served from readahead buffer
+static
+int32_t
+read_body_file(struct pp_url_loader_s *ul, void *buf, size_t len)
+{
+    const size_t ra_end = ul->readahead_pos + ul->readahead_len;
+
+    if (ul->read_pos < ul->readahead_pos || ul->read_pos >= ra_end) {
+        if (len >= READAHEAD_SIZE) {
+            // large reads go directly to the destination
+            ssize_t read_bytes = RETRY_ON_EINTR(pread(ul->fd, buf, len, ul->read_pos));
+            if (read_bytes < 0)
+                return -1;
+            ul->read_pos += read_bytes;
+            return read_bytes;
+        }
+
+        if (!ul->readahead)
+            ul->readahead = g_malloc(READAHEAD_SIZE);
+
+        ssize_t read_bytes = RETRY_ON_EINTR(pread(ul->fd, ul->readahead, READAHEAD_SIZE,
+                                                  ul->read_pos));
+        if (read_bytes < 0) {
+            ul->readahead_len = 0;
+            return -1;
+        }
+
+        ul->readahead_pos = ul->read_pos;
+        ul->readahead_len = read_bytes;
+        ul->readahead_fills ++;
+    }
+
+    const size_t n = MIN(len, ul->readahead_pos + ul->readahead_len - ul->read_pos);
+    memcpy(buf, ul->readahead + (ul->read_pos - ul->readahead_pos), n);
+    ul->read_pos += n;
+    ul->bytes_copied += n;
+    return n;
+}
+
+int32_t
+url_loader_body_read(struct pp_url_loader_s *ul, void *buf, size_t len)
+{
+    if (ul->fd >= 0)
+        return read_body_file(ul, buf, len);
+
+    char *dst = buf;
+    size_t done = 0;
+
+    while (done < len) {
+        struct body_chunk_s *chunk = g_queue_peek_head(&ul->body_chunks);
+        if (!chunk)
+            break;
+
+        const size_t n = MIN(len - done, chunk->used - chunk->pos);
+        memcpy(dst + done, chunk->data + chunk->pos, n);
+        chunk->pos += n;
+        done += n;
+
+        if (chunk->pos == chunk->used) {
+            g_queue_pop_head(&ul->body_chunks);
+            g_free(chunk);
+        }
+    }
+
+    ul->read_pos += done;
+    ul->bytes_copied += done;
+    return done;
+}
+
+int32_t
+url_loader_body_write_ready(struct pp_url_loader_s *ul)
+{
+    if (ul->fd >= 0)
+        return WRITE_READY_MAX;
+
+    // ask for as much as fits under memory limit. Never ask for less than a chunk, as plugin
+    // may not read until stream ends; body is moved to a file then
+    const size_t limit = (size_t)config.url_loader_memory_limit_kb * 1024;
+    const size_t buffered = ul->body_end - ul->read_pos;
+    const size_t headroom = limit > buffered ? limit - buffered : 0;
+
+    return CLAMP(headroom, BODY_CHUNK_SIZE, WRITE_READY_MAX);
+}
+
 /// trim new line characters from the end of the string
 char *
 trim_nl(char *s)
@@ -319,7 +578,13 @@ ppb_url_loader_open_target(PP_Resource loader, PP_Resource request_info,
     post_data_free(ul->post_data);
     ul->post_data = post_data_duplicate(ri->post_data);
 
-    ul->fd = open_temporary_file();
+    url_loader_body_close(ul);
+    if (url_loader_body_open(ul) != 0) {
+        ppb_var_release(full_url);
+        pp_resource_release(request_info);
+        pp_resource_release(loader);
+        return PP_ERROR_FAILED;
+    }
     ul->ccb = callback;
     ul->ccb_ml = ppb_message_loop_get_current();
 
@@ -399,10 +664,7 @@ ppb_url_loader_follow_redirect(PP_Resource loader, struct PP_CompletionCallback
     post_data_free(ul->post_data);
     ul->post_data = NULL;
 
-    if (ul->fd >= 0) {
-        close(ul->fd);
-        ul->fd = -1;
-    }
+    url_loader_body_close(ul);
 
     // abort further handling of the NPStream
     if (ul->np_stream) {
@@ -410,9 +672,12 @@ ppb_url_loader_follow_redirect(PP_Resource loader, struct PP_CompletionCallback
         ul->np_stream = NULL;
     }
 
-    ul->fd = open_temporary_file();
     ul->url = new_url;
     ul->read_pos = 0;
+    if (url_loader_body_open(ul) != 0) {
+        pp_resource_release(loader);
+        return PP_ERROR_FAILED;
+    }
     ul->method = PP_METHOD_GET;
     ul->ccb = callback;
     ul->ccb_ml = ppb_message_loop_get_current();
@@ -488,16 +753,7 @@ ppb_url_loader_get_download_progress(PP_Resource loader, int64_t *bytes_received
     }
 
     *total_bytes_to_be_received = ul->response_size;
-    *bytes_received = 0;
-    if (ul->fd >= 0) {
-        struct stat sb;
-        if (fstat(ul->fd, &sb) != 0) {
-            pp_resource_release(loader);
-            *bytes_received = -1;
-            return PP_FALSE;
-        }
-        *bytes_received = sb.st_size;
-    }
+    *bytes_received = ul->body_end;
 
     pp_resource_release(loader);
     return PP_TRUE;
@@ -541,8 +797,8 @@ ppb_url_loader_read_response_body(PP_Resource loader, void *buffer, int32_t byte
         return PP_ERROR_BADRESOURCE;
     }
 
-    if (ul->fd == -1) {
-        trace_error("%s, fd==-1\n", __func__);
+    if (!ul->body_open) {
+        trace_error("%s, no response body\n", __func__);
         pp_resource_release(loader);
         return PP_ERROR_FAILED;
     }
@@ -553,15 +809,9 @@ ppb_url_loader_read_response_body(PP_Resource loader, void *buffer, int32_t byte
         goto schedule_read_task;
     }
 
-    read_bytes = -1;
-    off_t ofs = lseek(ul->fd, ul->read_pos, SEEK_SET);
-    if (ofs != (off_t)-1)
-        read_bytes = RETRY_ON_EINTR(read(ul->fd, buffer, bytes_to_read));
-
+    read_bytes = url_loader_body_read(ul, buffer, MAX(bytes_to_read, 0));
     if (read_bytes < 0)
         read_bytes = PP_ERROR_FAILED;
-    else
-        ul->read_pos += read_bytes;
 
     if (read_bytes == 0 && !ul->finished_loading) {
         // no data ready, schedule read task
@@ -585,6 +835,8 @@ schedule_read_task:
     rt->ccb_ml =        ppb_message_loop_get_current();
 
     ul->read_tasks = g_list_append(ul->read_tasks, rt);
+    ul->read_queue_total ++;
+    ul->read_queue_max = MAX(ul->read_queue_max, g_list_length(ul->read_tasks));
     pp_resource_release(loader);
     return PP_OK_COMPLETIONPENDING;
 }
@@ -621,10 +873,7 @@ ppb_url_loader_close(PP_Resource loader)
         return;
     }
 
-    if (ul->fd >= 0) {
-        close(ul->fd);
-        ul->fd = -1;
-    }
+    url_loader_body_close(ul);
     free_and_nullify(ul->headers);
     free_and_nullify(ul->url);
     pp_resource_release(loader);
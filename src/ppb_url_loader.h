@@ -27,6 +27,10 @@
 
 #include <ppapi/c/ppb_url_loader.h>
 #include <ppapi/c/trusted/ppb_url_loader_trusted.h>
+#include <stddef.h>
+
+
+struct pp_url_loader_s;
 
 
 PP_Resource
@@ -74,4 +78,34 @@ void
 ppb_url_loader_register_status_callback(PP_Resource loader,
                                         PP_URLLoaderTrusted_StatusCallback cb);
 
+/// sets up response body storage, in memory unless streaming to file was requested
+int
+url_loader_body_open(struct pp_url_loader_s *ul);
+
+/// frees response body storage
+void
+url_loader_body_close(struct pp_url_loader_s *ul);
+
+/// stores data received from browser at given stream offset
+int
+url_loader_body_write(struct pp_url_loader_s *ul, size_t offset, const void *buf, size_t len);
+
+/// reads up to |len| bytes at reading position, advancing it. Returns number of bytes read,
+/// 0 if no data available yet, or -1 on error
+int32_t
+url_loader_body_read(struct pp_url_loader_s *ul, void *buf, size_t len);
+
+/// number of bytes loader is ready to accept from browser
+int32_t
+url_loader_body_write_ready(struct pp_url_loader_s *ul);
+
+/// moves in-memory part of response body to a temporary file, returns file descriptor
+int
+url_loader_body_spill(struct pp_url_loader_s *ul);
+
+/// returns file descriptor of a file with the whole response body, or -1 if some of it was
+/// already read from memory and is not kept
+int
+url_loader_body_get_file(struct pp_url_loader_s *ul);
+
 #endif // FPP_PPB_URL_LOADER_H
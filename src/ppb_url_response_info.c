@@ -26,10 +26,12 @@
 #include "ppb_url_response_info.h"
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "trace.h"
 #include "tables.h"
 #include "reverse_constant.h"
 #include "pp_resource.h"
+#include "ppb_url_loader.h"
 #include "ppb_var.h"
 #include "pp_interface.h"
 
@@ -95,17 +97,33 @@ ppb_url_response_info_get_body_as_file_ref(PP_Resource response)
         trace_error("%s, bad resource\n", __func__);
         return 0;
     }
-    struct pp_url_loader_s *ul = ri->url_loader;
+
+    // response body may be kept in memory, move it to a file first. If plugin has already read
+    // some of it, there is no complete body left to give out
+    int fd = -1;
+    struct pp_url_loader_s *ul = pp_resource_acquire(ri->url_loader_id, PP_RESOURCE_URL_LOADER);
+    if (ul) {
+        fd = url_loader_body_get_file(ul);
+        if (fd >= 0)
+            fd = dup(fd);
+        pp_resource_release(ri->url_loader_id);
+    }
+
+    if (fd < 0) {
+        trace_error("%s, response body is not available as a file\n", __func__);
+        pp_resource_release(response);
+        return 0;
+    }
 
     PP_Resource file_ref = pp_resource_allocate(PP_RESOURCE_FILE_REF, ri->instance);
     struct pp_file_ref_s *fr = pp_resource_acquire(file_ref, PP_RESOURCE_FILE_REF);
     if (!fr) {
         trace_error("%s, resource allocation failure\n", __func__);
+        close(fd);
         pp_resource_release(response);
         return 0;
     }
-
-    fr->fd = dup(ul->fd);
+    fr->fd = fd;
     fr->type = PP_FILE_REF_TYPE_FD;
 
     pp_resource_release(file_ref);
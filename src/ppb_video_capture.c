@@ -37,15 +37,37 @@
 #include <linux/videodev2.h>
 #include "pp_interface.h"
 #include "eintr_retry.h"
+#include "video_dsp.h"
 #include <dirent.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #if HAVE_LIBV4L2
 #include <libv4l2.h>
 #endif // HAVE_LIBV4L2
+#if HAVE_HWDEC
+#include "compat_ffmpeg.h"
+#define FRAME_BUF_PADDING       AV_INPUT_BUFFER_PADDING_SIZE
+#else
+#define FRAME_BUF_PADDING       0
+#endif // HAVE_HWDEC
 
 
 const char *default_capture_device = "/dev/video0";
 
+#define MMAP_BUFFER_COUNT       4       ///< number of device buffers for streaming I/O
+#define FRAME_WAIT_TIMEOUT_MS   100     ///< how often capture thread checks for termination
+#define MAX_CAPTURE_IO_FAILURES 50      ///< consecutive I/O failures before capture is aborted
+
+enum capture_result_e {
+    CAPTURE_OK = 0,
+    CAPTURE_SKIPPED,        ///< frame is corrupted, or thread is terminating
+    CAPTURE_IO_ERROR,       ///< reading frame failed, may be transient
+    CAPTURE_DEVICE_LOST,    ///< device reported error or was unplugged
+};
+
 #if !HAVE_LIBV4L2
 // define simple wrappers, if libv4l2 is not used
 static
@@ -75,6 +97,20 @@ v4l2_ioctl(int fd, unsigned long int request, void *data)
 {
     return ioctl(fd, request, data);
 }
+
+static
+void *
+v4l2_mmap(void *start, size_t length, int prot, int flags, int fd, int64_t offset)
+{
+    return mmap(start, length, prot, flags, fd, offset);
+}
+
+static
+int
+v4l2_munmap(void *start, size_t length)
+{
+    return munmap(start, length);
+}
 #endif // !HAVE_LIBV4L2
 
 
@@ -103,6 +139,8 @@ ppb_video_capture_create(PP_Instance instance)
 
     vc->fd = -1;
     vc->ppp_video_capture_dev = ppp_video_capture_dev;
+    pthread_mutex_init(&vc->lock, NULL);
+    pthread_cond_init(&vc->buffer_freed, NULL);
 
     pp_resource_release(video_capture);
     return video_capture;
@@ -110,15 +148,48 @@ ppb_video_capture_create(PP_Instance instance)
 
 static
 void
-ppb_video_capture_destroy(void *p)
+free_mmap_buffers(struct pp_video_capture_s *vc)
 {
-    struct pp_video_capture_s *vc = p;
+    if (!vc->mmap_buffers)
+        return;
+
+    for (uint32_t k = 0; k < vc->mmap_buffer_count; k ++) {
+        if (vc->mmap_buffers[k].start != MAP_FAILED)
+            v4l2_munmap(vc->mmap_buffers[k].start, vc->mmap_buffers[k].length);
+    }
+
+    // release buffers in driver
+    struct v4l2_requestbuffers req = {
+        .count =    0,
+        .type =     V4L2_BUF_TYPE_VIDEO_CAPTURE,
+        .memory =   V4L2_MEMORY_MMAP,
+    };
+    v4l2_ioctl(vc->fd, VIDIOC_REQBUFS, &req);
+
+    free_and_nullify(vc->mmap_buffers);
+    vc->mmap_buffer_count = 0;
+}
 
+static
+void
+close_device(struct pp_video_capture_s *vc)
+{
     if (vc->fd != -1) {
+        free_mmap_buffers(vc);
         v4l2_close(vc->fd);
         vc->fd = -1;
     }
 
+#if HAVE_HWDEC
+    if (vc->mjpeg_ctx)
+        avcodec_free_context(&vc->mjpeg_ctx);
+    if (vc->mjpeg_frame)
+        av_frame_free(&vc->mjpeg_frame);
+#endif // HAVE_HWDEC
+
+    free_and_nullify(vc->frame_buf);
+    vc->frame_buf_size = 0;
+
     if (vc->buffers) {
         for (uint32_t k = 0; k < vc->buffer_count; k ++)
             ppb_core_release_resource(vc->buffers[k]);
@@ -128,6 +199,17 @@ ppb_video_capture_destroy(void *p)
     free_and_nullify(vc->buffer_is_free);
 }
 
+static
+void
+ppb_video_capture_destroy(void *p)
+{
+    struct pp_video_capture_s *vc = p;
+
+    close_device(vc);
+    pthread_mutex_destroy(&vc->lock);
+    pthread_cond_destroy(&vc->buffer_freed);
+}
+
 PP_Bool
 ppb_video_capture_is_video_capture(PP_Resource video_capture)
 {
@@ -163,7 +245,7 @@ video_device_is_usable(const char *dev, char **shortname)
     if (!(device_caps & V4L2_CAP_VIDEO_CAPTURE))
         goto err_1;
 
-    if (!(device_caps & V4L2_CAP_READWRITE))
+    if (!(device_caps & (V4L2_CAP_STREAMING | V4L2_CAP_READWRITE)))
         goto err_1;
 
     *shortname = g_strdup((char *)caps.card);
@@ -248,6 +330,302 @@ ppb_video_capture_monitor_device_change(PP_Resource video_capture,
     return 0;
 }
 
+static
+int
+setup_mmap_buffers(struct pp_video_capture_s *vc)
+{
+    struct v4l2_requestbuffers req = {
+        .count =    MMAP_BUFFER_COUNT,
+        .type =     V4L2_BUF_TYPE_VIDEO_CAPTURE,
+        .memory =   V4L2_MEMORY_MMAP,
+    };
+
+    if (v4l2_ioctl(vc->fd, VIDIOC_REQBUFS, &req) != 0 || req.count < 2) {
+        trace_warning("%s, VIDIOC_REQBUFS failed\n", __func__);
+        return -1;
+    }
+
+    vc->mmap_buffers = calloc(req.count, sizeof(*vc->mmap_buffers));
+    if (!vc->mmap_buffers) {
+        trace_error("%s, memory allocation failure\n", __func__);
+        return -1;
+    }
+
+    vc->mmap_buffer_count = req.count;
+    for (uint32_t k = 0; k < req.count; k ++)
+        vc->mmap_buffers[k].start = MAP_FAILED;
+
+    for (uint32_t k = 0; k < req.count; k ++) {
+        struct v4l2_buffer buf = {
+            .type =     V4L2_BUF_TYPE_VIDEO_CAPTURE,
+            .memory =   V4L2_MEMORY_MMAP,
+            .index =    k,
+        };
+
+        if (v4l2_ioctl(vc->fd, VIDIOC_QUERYBUF, &buf) != 0) {
+            trace_warning("%s, VIDIOC_QUERYBUF failed\n", __func__);
+            goto err;
+        }
+
+        vc->mmap_buffers[k].length = buf.length;
+        vc->mmap_buffers[k].start = v4l2_mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
+                                              MAP_SHARED, vc->fd, buf.m.offset);
+        if (vc->mmap_buffers[k].start == MAP_FAILED) {
+            trace_warning("%s, mmap failed\n", __func__);
+            goto err;
+        }
+    }
+
+    return 0;
+
+err:
+    free_mmap_buffers(vc);
+    return -1;
+}
+
+// queues all device buffers and starts streaming
+static
+int
+start_streaming(struct pp_video_capture_s *vc)
+{
+    for (uint32_t k = 0; k < vc->mmap_buffer_count; k ++) {
+        struct v4l2_buffer buf = {
+            .type =     V4L2_BUF_TYPE_VIDEO_CAPTURE,
+            .memory =   V4L2_MEMORY_MMAP,
+            .index =    k,
+        };
+
+        if (v4l2_ioctl(vc->fd, VIDIOC_QBUF, &buf) != 0) {
+            trace_error("%s, VIDIOC_QBUF failed\n", __func__);
+            return -1;
+        }
+    }
+
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (v4l2_ioctl(vc->fd, VIDIOC_STREAMON, &type) != 0) {
+        trace_error("%s, VIDIOC_STREAMON failed\n", __func__);
+        return -1;
+    }
+
+    vc->streaming = 1;
+    return 0;
+}
+
+// stops streaming, all device buffers become dequeued
+static
+void
+stop_streaming(struct pp_video_capture_s *vc)
+{
+    if (!vc->streaming)
+        return;
+
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    v4l2_ioctl(vc->fd, VIDIOC_STREAMOFF, &type);
+    vc->streaming = 0;
+}
+
+static
+int
+pixel_format_is_supported(uint32_t pixelformat)
+{
+    switch (pixelformat) {
+    case V4L2_PIX_FMT_YUV420:
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_NV12:
+#if HAVE_HWDEC
+    case V4L2_PIX_FMT_MJPEG:
+#endif // HAVE_HWDEC
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Picks format to capture in. Formats device supports natively are preferred, in the order of
+// conversion cost. If there are none, I420 is requested, which libv4l2 can emulate.
+static
+uint32_t
+choose_pixel_format(int fd)
+{
+    static const uint32_t preferred[] = {
+        V4L2_PIX_FMT_YUV420,
+        V4L2_PIX_FMT_YUYV,
+        V4L2_PIX_FMT_NV12,
+#if HAVE_HWDEC
+        V4L2_PIX_FMT_MJPEG,
+#endif // HAVE_HWDEC
+    };
+    uint32_t best = V4L2_PIX_FMT_YUV420;
+    size_t   best_rank = G_N_ELEMENTS(preferred);
+
+    for (uint32_t idx = 0; ; idx ++) {
+        struct v4l2_fmtdesc desc = {
+            .index = idx,
+            .type =  V4L2_BUF_TYPE_VIDEO_CAPTURE,
+        };
+
+        if (v4l2_ioctl(fd, VIDIOC_ENUM_FMT, &desc) != 0)
+            break;
+
+#ifdef V4L2_FMT_FLAG_EMULATED
+        if (desc.flags & V4L2_FMT_FLAG_EMULATED)
+            continue;
+#endif // V4L2_FMT_FLAG_EMULATED
+
+        for (size_t k = 0; k < best_rank; k ++) {
+            if (preferred[k] == desc.pixelformat) {
+                best = desc.pixelformat;
+                best_rank = k;
+                break;
+            }
+        }
+    }
+
+    return best;
+}
+
+#if HAVE_HWDEC
+static
+int
+setup_mjpeg_decoder(struct pp_video_capture_s *vc)
+{
+    AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_MJPEG);
+    if (!codec) {
+        trace_error("%s, no MJPEG decoder\n", __func__);
+        return -1;
+    }
+
+    vc->mjpeg_ctx = avcodec_alloc_context3(codec);
+    vc->mjpeg_frame = av_frame_alloc();
+    if (!vc->mjpeg_ctx || !vc->mjpeg_frame) {
+        trace_error("%s, memory allocation failure\n", __func__);
+        return -1;
+    }
+
+    // MJPEG decoder has no slice threading, and frame threads would delay every frame by
+    // thread_count-1 frames. So decoding is single-threaded, in capture thread.
+    vc->mjpeg_ctx->thread_count = 1;
+
+    if (avcodec_open2(vc->mjpeg_ctx, codec, NULL) < 0) {
+        trace_error("%s, can't open MJPEG decoder\n", __func__);
+        return -1;
+    }
+
+    return 0;
+}
+
+static
+int
+decode_mjpeg_frame(struct pp_video_capture_s *vc, const void *src, size_t size, uint8_t *dst)
+{
+    AVPacket packet;
+    int      got_frame = 0;
+
+    // decoder reads past the end of data, so it's copied into a padded buffer
+    size = MIN(size, vc->frame_buf_size - FRAME_BUF_PADDING);
+    if (src != vc->frame_buf)
+        memcpy(vc->frame_buf, src, size);
+    memset(vc->frame_buf + size, 0, FRAME_BUF_PADDING);
+
+    av_init_packet(&packet);
+    packet.data = vc->frame_buf;
+    packet.size = size;
+
+    if (avcodec_decode_video2(vc->mjpeg_ctx, vc->mjpeg_frame, &got_frame, &packet) < 0)
+        return -1;
+
+    if (!got_frame)
+        return -1;
+
+    AVFrame *frame = vc->mjpeg_frame;
+    int is_422;
+
+    switch (frame->format) {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+        is_422 = 0;
+        break;
+    case AV_PIX_FMT_YUV422P:
+    case AV_PIX_FMT_YUVJ422P:
+        is_422 = 1;
+        break;
+    default:
+        trace_error("%s, unsupported pixel format %d\n", __func__, frame->format);
+        return -1;
+    }
+
+    if ((uint32_t)frame->width != vc->width || (uint32_t)frame->height != vc->height) {
+        trace_error("%s, unexpected frame size %dx%d\n", __func__, frame->width,
+                    frame->height);
+        return -1;
+    }
+
+    video_dsp_planar_to_i420(frame->data[0], frame->linesize[0], frame->data[1],
+                             frame->linesize[1], frame->data[2], frame->linesize[2], dst,
+                             vc->width, vc->height, is_422);
+    return 0;
+}
+#endif // HAVE_HWDEC
+
+// converts captured frame into I420 plugin buffer
+static
+int
+convert_frame(struct pp_video_capture_s *vc, const uint8_t *src, size_t size, uint8_t *dst)
+{
+    const int64_t start = g_get_monotonic_time();
+    const size_t  bpl = vc->bytesperline;
+    const size_t  ch = (vc->height + 1) / 2;
+    int           result = 0;
+
+    switch (vc->pixelformat) {
+    case V4L2_PIX_FMT_YUV420:
+        if (bpl == vc->width) {
+            memcpy(dst, src, MIN(size, vc->buffer_size));
+        } else if (size >= bpl * vc->height + bpl * ch) {
+            video_dsp_planar_to_i420(src, bpl, src + bpl * vc->height, bpl / 2,
+                                     src + bpl * vc->height + bpl / 2 * ch, bpl / 2, dst,
+                                     vc->width, vc->height, 0);
+        } else {
+            result = -1;
+        }
+        break;
+
+    case V4L2_PIX_FMT_YUYV:
+        if (size >= bpl * vc->height)
+            video_dsp_yuyv_to_i420(src, bpl, dst, vc->width, vc->height);
+        else
+            result = -1;
+        break;
+
+    case V4L2_PIX_FMT_NV12:
+        if (size >= bpl * (vc->height + ch))
+            video_dsp_nv12_to_i420(src, bpl, src + bpl * vc->height, bpl, dst, vc->width,
+                                   vc->height);
+        else
+            result = -1;
+        break;
+
+#if HAVE_HWDEC
+    case V4L2_PIX_FMT_MJPEG:
+        result = decode_mjpeg_frame(vc, src, size, dst);
+        break;
+#endif // HAVE_HWDEC
+
+    default:
+        result = -1;
+        break;
+    }
+
+    if (result != 0)
+        return result;
+
+    const uint32_t elapsed = g_get_monotonic_time() - start;
+    vc->frame_count += 1;
+    vc->conversion_time_total_us += elapsed;
+    vc->conversion_time_max_us = MAX(vc->conversion_time_max_us, elapsed);
+    return 0;
+}
+
 int32_t
 ppb_video_capture_open(PP_Resource video_capture, PP_Resource device_ref,
                        const struct PP_VideoCaptureDeviceInfo_Dev *requested_info,
@@ -294,8 +672,9 @@ ppb_video_capture_open(PP_Resource video_capture, PP_Resource device_ref,
         goto point_2;
     }
 
-    if (!(device_caps & V4L2_CAP_READWRITE)) {
-        trace_error("%s, device doesn't support read/write interface\n", __func__);
+    if (!(device_caps & (V4L2_CAP_STREAMING | V4L2_CAP_READWRITE))) {
+        trace_error("%s, device supports neither streaming nor read/write interface\n",
+                    __func__);
         result = PP_ERROR_FAILED;
         goto point_2;
     }
@@ -310,11 +689,12 @@ ppb_video_capture_open(PP_Resource video_capture, PP_Resource device_ref,
         vc->fps =    15;
     }
 
+    // PPAPI hardcodes format to YUV420, other formats are converted
     struct v4l2_format fmt = {
         .type =                 V4L2_BUF_TYPE_VIDEO_CAPTURE,
         .fmt.pix.width =        vc->width,
         .fmt.pix.height =       vc->height,
-        .fmt.pix.pixelformat =  V4L2_PIX_FMT_YUV420,    // PPAPI hardcodes format to YUV420
+        .fmt.pix.pixelformat =  choose_pixel_format(vc->fd),
         .fmt.pix.field =        V4L2_FIELD_INTERLACED,
     };
 
@@ -324,10 +704,55 @@ ppb_video_capture_open(PP_Resource video_capture, PP_Resource device_ref,
         goto point_2;
     }
 
+    if (!pixel_format_is_supported(fmt.fmt.pix.pixelformat)) {
+        trace_error("%s, unsupported pixel format %#x\n", __func__, fmt.fmt.pix.pixelformat);
+        result = PP_ERROR_FAILED;
+        goto point_2;
+    }
+
     vc->width =  fmt.fmt.pix.width;
     vc->height = fmt.fmt.pix.height;
+    vc->pixelformat = fmt.fmt.pix.pixelformat;
+    vc->bytesperline = fmt.fmt.pix.bytesperline;
+    if (vc->bytesperline == 0) {
+        // driver didn't tell, assume there is no padding
+        vc->bytesperline = (vc->pixelformat == V4L2_PIX_FMT_YUYV) ? vc->width * 2 : vc->width;
+    }
 
-    vc->buffer_size = fmt.fmt.pix.sizeimage;    // buffer size in bytes
+#if HAVE_HWDEC
+    if (vc->pixelformat == V4L2_PIX_FMT_MJPEG && setup_mjpeg_decoder(vc) != 0) {
+        result = PP_ERROR_FAILED;
+        goto point_2;
+    }
+#endif // HAVE_HWDEC
+
+    // streaming avoids read() emulation and works with devices which can't read()
+    vc->io_method = VIDEO_CAPTURE_IO_READ;
+    if (device_caps & V4L2_CAP_STREAMING) {
+        if (setup_mmap_buffers(vc) == 0) {
+            vc->io_method = VIDEO_CAPTURE_IO_MMAP;
+        } else if (!(device_caps & V4L2_CAP_READWRITE)) {
+            trace_error("%s, failed to set up streaming I/O\n", __func__);
+            result = PP_ERROR_FAILED;
+            goto point_2;
+        }
+    }
+
+    // frames in device format are read into a staging buffer and converted from there
+    if ((vc->io_method == VIDEO_CAPTURE_IO_READ && vc->pixelformat != V4L2_PIX_FMT_YUV420) ||
+        vc->pixelformat == V4L2_PIX_FMT_MJPEG)
+    {
+        vc->frame_buf_size = fmt.fmt.pix.sizeimage + FRAME_BUF_PADDING;
+        vc->frame_buf = malloc(vc->frame_buf_size);
+        if (!vc->frame_buf) {
+            trace_error("%s, memory allocation failure\n", __func__);
+            result = PP_ERROR_FAILED;
+            goto point_2;
+        }
+    }
+
+    // plugin buffers are in I420
+    vc->buffer_size = vc->width * vc->height + 2 * ((vc->width + 1) / 2) * ((vc->height + 1) / 2);
     vc->buffer_count = MAX(buffer_count, 5);    // limit lowest number of buffers, just in case
 
     vc->buffers = calloc(sizeof(*vc->buffers), vc->buffer_count);
@@ -372,8 +797,7 @@ point_4:
 point_3:
     free_and_nullify(vc->buffers);
 point_2:
-    v4l2_close(vc->fd);
-    vc->fd = -1;
+    close_device(vc);
 point_1:
     pp_resource_release(video_capture);
 
@@ -403,23 +827,24 @@ on_buffer_ready_comt(void *user_data, int32_t result)
 }
 
 static
-void *
-video_capture_thread(void *param)
+int
+should_terminate(struct pp_video_capture_s *vc)
 {
-    struct pp_video_capture_s *vc = param;
-
-    PP_Resource  video_capture = vc->self_id;
-    PP_Instance  instance = vc->instance->id;
-    const int    fd = vc->fd;
-    const size_t buffer_size = vc->buffer_size;
+    pthread_mutex_lock(&vc->lock);
+    int terminate = vc->terminate_thread;
+    pthread_mutex_unlock(&vc->lock);
+    return terminate;
+}
 
-    vc = pp_resource_acquire(video_capture, PP_RESOURCE_VIDEO_CAPTURE);
-    if (!vc)
-        goto gone;
+// waits until plugin returns any buffer. Returns its index, or -1 if thread should terminate
+static
+uint32_t
+take_free_buffer(struct pp_video_capture_s *vc)
+{
+    uint32_t buf_idx = (uint32_t)-1;
 
+    pthread_mutex_lock(&vc->lock);
     while (!vc->terminate_thread) {
-        // find free buffer
-        uint32_t buf_idx = (uint32_t)-1;
         for (uint32_t k = 0; k < vc->buffer_count; k ++) {
             if (vc->buffer_is_free[k]) {
                 buf_idx = k;
@@ -428,27 +853,169 @@ video_capture_thread(void *param)
             }
         }
 
-        if (buf_idx == (uint32_t)-1) {
-            // all buffers are busy, wait for some to free, with resource unlocked
-            pp_resource_release(video_capture);
-            usleep(10);
-            vc = pp_resource_acquire(video_capture, PP_RESOURCE_VIDEO_CAPTURE);
-            if (!vc)
-                goto gone;
-            continue;
+        if (buf_idx != (uint32_t)-1)
+            break;
+
+        pthread_cond_wait(&vc->buffer_freed, &vc->lock);
+    }
+    pthread_mutex_unlock(&vc->lock);
+
+    return buf_idx;
+}
+
+static
+void
+put_free_buffer(struct pp_video_capture_s *vc, uint32_t buf_idx)
+{
+    pthread_mutex_lock(&vc->lock);
+    vc->buffer_is_free[buf_idx] = 1;
+    pthread_mutex_unlock(&vc->lock);
+}
+
+// waits for the next frame
+static
+enum capture_result_e
+wait_for_frame(struct pp_video_capture_s *vc)
+{
+    while (!should_terminate(vc)) {
+        struct pollfd pfd = { .fd = vc->fd, .events = POLLIN };
+        int ret = poll(&pfd, 1, FRAME_WAIT_TIMEOUT_MS);
+
+        if (ret > 0) {
+            if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                trace_error("%s, device error, revents=0x%x\n", __func__, pfd.revents);
+                return CAPTURE_DEVICE_LOST;
+            }
+            return CAPTURE_OK;
         }
 
-        PP_Resource buffer = vc->buffers[buf_idx];
-        pp_resource_release(video_capture);
+        if (ret < 0 && errno != EINTR) {
+            trace_error("%s, poll failed\n", __func__);
+            return CAPTURE_DEVICE_LOST;
+        }
+    }
+
+    return CAPTURE_SKIPPED;
+}
+
+static
+enum capture_result_e
+io_failure(const char *func, const char *what)
+{
+    if (errno == ENODEV) {
+        trace_error("%s, %s failed, device is gone\n", func, what);
+        return CAPTURE_DEVICE_LOST;
+    }
+
+    trace_error("%s, %s failed, errno=%d\n", func, what, errno);
+    return CAPTURE_IO_ERROR;
+}
+
+// copies next frame into dst
+static
+enum capture_result_e
+capture_frame(struct pp_video_capture_s *vc, void *dst)
+{
+    enum capture_result_e wait_result = wait_for_frame(vc);
+    if (wait_result != CAPTURE_OK)
+        return wait_result;
+
+    if (vc->io_method == VIDEO_CAPTURE_IO_READ) {
+        if (vc->pixelformat == V4L2_PIX_FMT_YUV420 && vc->bytesperline == vc->width) {
+            // already in the right format
+            ssize_t ret = RETRY_ON_EINTR(v4l2_read(vc->fd, dst, vc->buffer_size));
+            return ret > 0 ? CAPTURE_OK : io_failure(__func__, "read");
+        }
+
+        ssize_t ret = RETRY_ON_EINTR(v4l2_read(vc->fd, vc->frame_buf,
+                                               vc->frame_buf_size - FRAME_BUF_PADDING));
+        if (ret <= 0)
+            return io_failure(__func__, "read");
+        return convert_frame(vc, vc->frame_buf, ret, dst) == 0 ? CAPTURE_OK : CAPTURE_SKIPPED;
+    }
+
+    struct v4l2_buffer buf = {
+        .type =     V4L2_BUF_TYPE_VIDEO_CAPTURE,
+        .memory =   V4L2_MEMORY_MMAP,
+    };
 
-        // wait on v4l2_read() with resource unlocked
+    if (RETRY_ON_EINTR(v4l2_ioctl(vc->fd, VIDIOC_DQBUF, &buf)) != 0)
+        return io_failure(__func__, "VIDIOC_DQBUF");
+
+    enum capture_result_e result = CAPTURE_SKIPPED;
+    if (buf.index < vc->mmap_buffer_count && !(buf.flags & V4L2_BUF_FLAG_ERROR) &&
+        convert_frame(vc, vc->mmap_buffers[buf.index].start, buf.bytesused, dst) == 0)
+    {
+        result = CAPTURE_OK;
+    }
+
+    // return buffer to the driver
+    if (v4l2_ioctl(vc->fd, VIDIOC_QBUF, &buf) != 0)
+        return io_failure(__func__, "VIDIOC_QBUF");
+
+    return result;
+}
+
+struct on_error_param_s {
+    PP_Instance                            instance;
+    PP_Resource                            video_capture;
+    const struct PPP_VideoCapture_Dev_0_1 *ppp_video_capture_dev;
+};
+
+static
+void
+on_error_comt(void *user_data, int32_t result)
+{
+    struct on_error_param_s *p = user_data;
+    if (tables_get_pp_instance(p->instance))
+        p->ppp_video_capture_dev->OnError(p->instance, p->video_capture, PP_ERROR_FAILED);
+    g_slice_free1(sizeof(*p), p);
+}
+
+static
+void *
+video_capture_thread(void *param)
+{
+    // resource is kept alive by the reference taken in start_capture(), and fields used here
+    // don't change while capture thread is running
+    struct pp_video_capture_s *vc = param;
+
+    PP_Resource  video_capture = vc->self_id;
+    PP_Instance  instance = vc->instance->id;
+    uint32_t     io_failures = 0;
+
+    while (1) {
+        uint32_t buf_idx = take_free_buffer(vc);
+        if (buf_idx == (uint32_t)-1)
+            break;
+
+        PP_Resource buffer = vc->buffers[buf_idx];
         void *ptr = ppb_buffer_map(buffer);
-        RETRY_ON_EINTR(v4l2_read(fd, ptr, buffer_size));
+        enum capture_result_e ret = capture_frame(vc, ptr);
         ppb_buffer_unmap(buffer);
 
-        vc = pp_resource_acquire(video_capture, PP_RESOURCE_VIDEO_CAPTURE);
-        if (!vc)
-            goto gone;
+        if (ret != CAPTURE_OK) {
+            put_free_buffer(vc, buf_idx);
+
+            if (ret == CAPTURE_IO_ERROR)
+                io_failures += 1;
+
+            // there is no point to retry, plugin is notified and is expected to call StopCapture
+            if (ret == CAPTURE_DEVICE_LOST || io_failures >= MAX_CAPTURE_IO_FAILURES) {
+                trace_error("%s, capture device failed, stopping capture\n", __func__);
+                struct on_error_param_s *p = g_slice_alloc(sizeof(*p));
+                p->instance =               instance;
+                p->video_capture =          video_capture;
+                p->ppp_video_capture_dev =  vc->ppp_video_capture_dev;
+                ppb_message_loop_post_work_with_result(vc->message_loop,
+                                                       PP_MakeCCB(on_error_comt, p), 0,
+                                                       PP_ERROR_FAILED, 0, __func__);
+                break;
+            }
+            continue;
+        }
+
+        io_failures = 0;
 
         struct on_buffer_ready_param_s *p = g_slice_alloc(sizeof(*p));
         p->instance =               instance;
@@ -460,11 +1027,6 @@ video_capture_thread(void *param)
                                                __func__);
     }
 
-    pp_resource_release(video_capture);
-    return NULL;
-
-gone:
-    trace_error("%s, resource gone\n", __func__);
     return NULL;
 }
 
@@ -492,6 +1054,18 @@ ppb_video_capture_start_capture(PP_Resource video_capture)
     vc->ppp_video_capture_dev->OnStatus(vc->instance->id, video_capture,
                                         PP_VIDEO_CAPTURE_STATUS_STARTING);
 
+    if (vc->io_method == VIDEO_CAPTURE_IO_MMAP && start_streaming(vc) != 0) {
+        stop_streaming(vc);
+        vc->ppp_video_capture_dev->OnError(vc->instance->id, video_capture, PP_ERROR_FAILED);
+        pp_resource_release(video_capture);
+        return PP_ERROR_FAILED;
+    }
+
+    vc->capture_start_time = g_get_monotonic_time();
+    vc->frame_count = 0;
+    vc->conversion_time_total_us = 0;
+    vc->conversion_time_max_us = 0;
+
     pp_resource_ref(video_capture); // prevents freeing while thread is still running
     pthread_create(&vc->thread, NULL, video_capture_thread, vc);
     vc->thread_started = 1;
@@ -513,8 +1087,12 @@ ppb_video_capture_reuse_buffer(PP_Resource video_capture, uint32_t buffer)
         return PP_ERROR_BADRESOURCE;
     }
 
-    if (buffer < vc->buffer_count)
+    if (buffer < vc->buffer_count) {
+        pthread_mutex_lock(&vc->lock);
         vc->buffer_is_free[buffer] = 1;
+        pthread_cond_signal(&vc->buffer_freed);
+        pthread_mutex_unlock(&vc->lock);
+    }
 
     pp_resource_release(video_capture);
     return PP_OK;
@@ -535,7 +1113,10 @@ ppb_video_capture_stop_capture(PP_Resource video_capture)
     vc->ppp_video_capture_dev->OnStatus(vc->instance->id, video_capture,
                                         PP_VIDEO_CAPTURE_STATUS_STOPPING);
 
+    pthread_mutex_lock(&vc->lock);
     vc->terminate_thread = 1;
+    pthread_cond_broadcast(&vc->buffer_freed);
+    pthread_mutex_unlock(&vc->lock);
     pthread_t thread = vc->thread;
 
     pp_resource_release(video_capture);
@@ -548,8 +1129,18 @@ ppb_video_capture_stop_capture(PP_Resource video_capture)
         return PP_ERROR_BADRESOURCE;
     }
 
+    stop_streaming(vc);
     vc->thread_started = 0;
     vc->terminate_thread = 0;
+
+    if (vc->frame_count > 0) {
+        const double duration = (g_get_monotonic_time() - vc->capture_start_time) / 1e6;
+        trace_info_f("%s, format %.4s, %u frames, %.1f fps, conversion time %u us mean, "
+                     "%u us max\n", __func__, (const char *)&vc->pixelformat, vc->frame_count,
+                     vc->frame_count / MAX(duration, 1e-3),
+                     (unsigned)(vc->conversion_time_total_us / vc->frame_count),
+                     vc->conversion_time_max_us);
+    }
     vc->ppp_video_capture_dev->OnStatus(vc->instance->id, video_capture,
                                         PP_VIDEO_CAPTURE_STATUS_STOPPED);
 
@@ -571,7 +1162,7 @@ ppb_video_capture_close(PP_Resource video_capture)
         return;
     }
 
-    ppb_video_capture_destroy(vc);
+    close_device(vc);
 
     pp_resource_release(video_capture);
     return;
@@ -24,6 +24,7 @@
 
 #include "ppb_video_decoder.h"
 #include <stdlib.h>
+#include <string.h>
 #include <ppapi/c/pp_errors.h>
 #include "trace.h"
 #include "tables.h"
@@ -35,69 +36,349 @@
 #include "ppb_graphics3d.h"
 #include "ppb_message_loop.h"
 #include "config.h"
+#include "video_dsp.h"
 #include "compat_glx_defines.h"
-#include "autogenerated_ffmpeg_compat.h"
+#include "compat_ffmpeg.h"
 
 
-// compatibilty definitions
-#if !HAVE_AVPixelFormat
-#define AVPixelFormat           PixelFormat
-#define AV_PIX_FMT_NONE         PIX_FMT_NONE
-#define AV_PIX_FMT_YUV420P      PIX_FMT_YUV420P
-#define AV_PIX_FMT_VAAPI_VLD    PIX_FMT_VAAPI_VLD
-#endif // !HAVE_AVPixelFormat
+static
+void
+report_vdpau_error(VdpStatus st, const char *what, const char *where)
+{
+    if (st == VDP_STATUS_OK)
+        return;
+
+    trace_error("%s, %s failed: %d, %s\n", where, what, (int)st, display.vdp_get_error_string(st));
+}
+
+// Decoded frames waiting for a free picture buffer hold hw surfaces, so their number is limited.
+// Once there are that many, decoding pauses until plugin returns a picture buffer.
+#define MAX_PENDING_FRAMES      2
+
+enum decoder_task_type_e {
+    TASK_DECODE,            ///< decode bitstream buffer
+    TASK_FLUSH,             ///< flush decoder state
+    TASK_ISSUE_FRAMES,      ///< picture buffers became available
+    TASK_TERMINATE,
+};
+
+struct decoder_task_s {
+    enum decoder_task_type_e        type;
+    PP_Resource                     bitstream_buffer;
+    uint32_t                        bitstream_buffer_size;
+    int32_t                         bitstream_buffer_id;
+    int64_t                         enqueue_time;       ///< for latency measurements
+    uint32_t                        consumed;           ///< bitstream bytes already parsed
+    int                             parser_drained;     ///< flush passed parser leftovers
+    struct PP_CompletionCallback    callback;
+    PP_Resource                     message_loop;       ///< where to call callback
+};
 
-#if !HAVE_AV_PIX_FMT_VDPAU
-#define AV_PIX_FMT_VDPAU        (-2)
-#endif // !HAVE_AV_PIX_FMT_VDPAU
+struct decoded_frame_s {
+    AVFrame    *frame;
+    int64_t     enqueue_time;   ///< of bitstream buffer frame was decoded from
+};
 
-#if !HAVE_AVCodecID
-#define AV_CODEC_ID_H264        CODEC_ID_H264
-#endif // !HAVE_AVCodecID
+// Hw surfaces and picture buffer pixmaps are costly to create, and seeking recreates decoders
+// often. Resources of destroyed decoders are kept in per-display caches and reused by new
+// decoders of the same size. Most recently used entries are at the head.
+#define MAX_CACHED_SURFACE_SETS         2
+#define MAX_CACHED_PICTURE_BUFFERS      (2 * MAX_VA_SURFACES)
+
+struct surface_set_s {
+    enum hwdec_api_e    api;
+    int                 width;
+    int                 height;
+    VAConfigID          va_config_id;
+    VASurfaceID         va_surfaces[MAX_VA_SURFACES];
+    VdpDecoder          vdp_decoder;
+    VdpVideoSurface     vdp_video_surfaces[MAX_VDP_SURFACES];
+    VdpVideoMixer       vdp_video_mixer;
+    VdpOutputSurface    vdp_output_surface;
+};
 
-#if !HAVE_av_frame_alloc
-static inline AVFrame *
-av_frame_alloc(void)
+struct cached_picture_buffer_s {
+    enum hwdec_api_e            api;
+    uint32_t                    width;
+    uint32_t                    height;
+    int                         depth;
+    int                         fb_config_id;
+    Pixmap                      pixmap;
+    GLXPixmap                   glx_pixmap;
+    VdpPresentationQueueTarget  vdp_presentation_queue_target;
+    VdpPresentationQueue        vdp_presentation_queue;
+};
+
+static pthread_mutex_t  hw_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static GQueue           surface_set_cache = G_QUEUE_INIT;
+static GQueue           picture_buffer_cache = G_QUEUE_INIT;
+
+static
+void
+destroy_surface_set(struct surface_set_s *set)
 {
-    return avcodec_alloc_frame();
+    switch (set->api) {
+    case HWDEC_VAAPI:
+        vaDestroySurfaces(display.va, set->va_surfaces, MAX_VA_SURFACES);
+        if (set->va_config_id)
+            vaDestroyConfig(display.va, set->va_config_id);
+        break;
+
+    case HWDEC_VDPAU:
+        if (set->vdp_decoder != VDP_INVALID_HANDLE)
+            display.vdp_decoder_destroy(set->vdp_decoder);
+
+        if (set->vdp_video_mixer != VDP_INVALID_HANDLE)
+            display.vdp_video_mixer_destroy(set->vdp_video_mixer);
+
+        if (set->vdp_output_surface != VDP_INVALID_HANDLE)
+            display.vdp_output_surface_destroy(set->vdp_output_surface);
+
+        for (uintptr_t k = 0; k < MAX_VDP_SURFACES; k ++) {
+            if (set->vdp_video_surfaces[k] != VDP_INVALID_HANDLE)
+                display.vdp_video_surface_destroy(set->vdp_video_surfaces[k]);
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    g_slice_free1(sizeof(*set), set);
 }
-#endif // !HAVE_av_frame_alloc
 
-#if !HAVE_av_frame_free
-static inline void
-av_frame_free(AVFrame **frame)
+// removes matching surface set from cache and returns it, or returns NULL
+static
+struct surface_set_s *
+take_cached_surface_set(enum hwdec_api_e api, int width, int height)
 {
-    av_free(*frame);
-    *frame = NULL;
+    struct surface_set_s *found = NULL;
+
+    pthread_mutex_lock(&hw_cache_lock);
+    for (GList *ll = surface_set_cache.head; ll != NULL; ll = g_list_next(ll)) {
+        struct surface_set_s *set = ll->data;
+        if (set->api == api && set->width == width && set->height == height) {
+            found = set;
+            g_queue_delete_link(&surface_set_cache, ll);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&hw_cache_lock);
+
+    return found;
 }
-#endif // !HAVE_av_frame_free
 
-#if HAVE_AVCodecContext_get_buffer2
-#define AVCTX_HAVE_REFCOUNTED_BUFFERS   1
-#else
-#define AVCTX_HAVE_REFCOUNTED_BUFFERS   0
-#endif // HAVE_AVCodecContext_get_buffer2
+static
+void
+cache_surface_set(struct surface_set_s *set)
+{
+    struct surface_set_s *evicted = NULL;
+
+    pthread_mutex_lock(&hw_cache_lock);
+    g_queue_push_head(&surface_set_cache, set);
+    if (g_queue_get_length(&surface_set_cache) > MAX_CACHED_SURFACE_SETS)
+        evicted = g_queue_pop_tail(&surface_set_cache);
+    pthread_mutex_unlock(&hw_cache_lock);
+
+    if (evicted)
+        destroy_surface_set(evicted);
+}
+
+// should be called with display.lock held
+static
+void
+destroy_picture_buffer_resources(Pixmap pixmap, GLXPixmap glx_pixmap,
+                                 VdpPresentationQueueTarget vdp_presentation_queue_target,
+                                 VdpPresentationQueue vdp_presentation_queue)
+{
+    if (vdp_presentation_queue != VDP_INVALID_HANDLE)
+        display.vdp_presentation_queue_destroy(vdp_presentation_queue);
 
-#if !HAVE_avcodec_free_context
+    if (vdp_presentation_queue_target != VDP_INVALID_HANDLE)
+        display.vdp_presentation_queue_target_destroy(vdp_presentation_queue_target);
+
+    if (glx_pixmap != None)
+        glXDestroyPixmap(display.x, glx_pixmap);
+
+    if (pixmap != None)
+        XFreePixmap(display.x, pixmap);
+}
+
+// should be called with display.lock held
 static
 void
-avcodec_free_context(AVCodecContext **pavctx)
+destroy_cached_picture_buffer(struct cached_picture_buffer_s *pb)
 {
-    avcodec_close(*pavctx);
-    av_free(*pavctx);
-    *pavctx = NULL;
+    destroy_picture_buffer_resources(pb->pixmap, pb->glx_pixmap,
+                                     pb->vdp_presentation_queue_target,
+                                     pb->vdp_presentation_queue);
+    g_slice_free1(sizeof(*pb), pb);
 }
-#endif // !HAVE_avcodec_free_context
 
+static
+struct cached_picture_buffer_s *
+take_cached_picture_buffer(enum hwdec_api_e api, uint32_t width, uint32_t height, int depth,
+                           int fb_config_id)
+{
+    struct cached_picture_buffer_s *found = NULL;
 
+    pthread_mutex_lock(&hw_cache_lock);
+    for (GList *ll = picture_buffer_cache.head; ll != NULL; ll = g_list_next(ll)) {
+        struct cached_picture_buffer_s *pb = ll->data;
+        if (pb->api == api && pb->width == width && pb->height == height &&
+            pb->depth == depth && pb->fb_config_id == fb_config_id)
+        {
+            found = pb;
+            g_queue_delete_link(&picture_buffer_cache, ll);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&hw_cache_lock);
+
+    return found;
+}
+
+// should be called with display.lock held
 static
 void
-report_vdpau_error(VdpStatus st, const char *what, const char *where)
+cache_picture_buffer(struct cached_picture_buffer_s *pb)
 {
-    if (st == VDP_STATUS_OK)
-        return;
+    struct cached_picture_buffer_s *evicted = NULL;
 
-    trace_error("%s, %s failed: %d, %s\n", where, what, (int)st, display.vdp_get_error_string(st));
+    pthread_mutex_lock(&hw_cache_lock);
+    g_queue_push_head(&picture_buffer_cache, pb);
+    if (g_queue_get_length(&picture_buffer_cache) > MAX_CACHED_PICTURE_BUFFERS)
+        evicted = g_queue_pop_tail(&picture_buffer_cache);
+    pthread_mutex_unlock(&hw_cache_lock);
+
+    if (evicted)
+        destroy_cached_picture_buffer(evicted);
+}
+
+void
+ppb_video_decoder_clear_cache(void)
+{
+    struct surface_set_s           *set;
+    struct cached_picture_buffer_s *pb;
+
+    pthread_mutex_lock(&hw_cache_lock);
+
+    while ((pb = g_queue_pop_head(&picture_buffer_cache)) != NULL)
+        destroy_cached_picture_buffer(pb);
+
+    while ((set = g_queue_pop_head(&surface_set_cache)) != NULL)
+        destroy_surface_set(set);
+
+    pthread_mutex_unlock(&hw_cache_lock);
+}
+
+static
+void
+push_task(struct pp_video_decoder_s *vd, enum decoder_task_type_e type)
+{
+    struct decoder_task_s *task = g_slice_alloc0(sizeof(*task));
+    task->type = type;
+    g_async_queue_push(vd->task_queue, task);
+}
+
+struct notify_error_param_s {
+    PP_Instance                     instance;
+    PP_Resource                     video_decoder;
+    PP_VideoDecodeError_Dev         error;
+    const struct PPP_VideoDecoder_Dev_0_11 *ppp_video_decoder_dev;
+};
+
+static
+void
+notify_error_ptac(void *param, int32_t result)
+{
+    struct notify_error_param_s *p = param;
+
+    p->ppp_video_decoder_dev->NotifyError(p->instance, p->video_decoder, p->error);
+    g_slice_free1(sizeof(*p), p);
+}
+
+// puts decoder into failed state, and reports error to plugin. Called from decoder thread
+static
+void
+notify_error(struct pp_video_decoder_s *vd, PP_VideoDecodeError_Dev error)
+{
+    struct notify_error_param_s *p = g_slice_alloc(sizeof(*p));
+
+    g_atomic_int_set(&vd->failed_state, 1);
+
+    p->instance =               vd->instance->id;
+    p->video_decoder =          vd->self_id;
+    p->error =                  error;
+    p->ppp_video_decoder_dev =  vd->ppp_video_decoder_dev;
+
+    ppb_message_loop_post_work_with_result(vd->message_loop, PP_MakeCCB(notify_error_ptac, p),
+                                           0, PP_OK, 0, __func__);
+}
+
+// VDPAU decoding doesn't hold display.lock for the whole avcodec_decode_video2() call, only
+// actual hw calls are serialized with X traffic
+static
+VdpStatus
+vdpau_render_locked(VdpDecoder decoder, VdpVideoSurface target,
+                    VdpPictureInfo const *picture_info, uint32_t bitstream_buffer_count,
+                    VdpBitstreamBuffer const *bitstream_buffers)
+{
+    pthread_mutex_lock(&display.lock);
+    VdpStatus st = display.vdp_decoder_render(decoder, target, picture_info,
+                                              bitstream_buffer_count, bitstream_buffers);
+    pthread_mutex_unlock(&display.lock);
+    return st;
+}
+
+// Decoding itself doesn't touch Xlib, so X-facing calls (context and surface creation in
+// get_format(), vaPutSurface() and VDPAU render calls) take display.lock on their own. Some VA-API
+// drivers may call Xlib while decoding; they need the lock for the whole decode call, as a quirk
+static
+int
+decode_needs_display_lock(struct pp_video_decoder_s *vd)
+{
+    return vd->hwdec_api == HWDEC_VAAPI && config.quirks.vaapi_decode_display_lock;
+}
+
+static
+void
+free_decoded_frame(struct decoded_frame_s *df)
+{
+    av_frame_free(&df->frame);
+    g_slice_free1(sizeof(*df), df);
+}
+
+static
+void
+stop_decoder_thread(struct pp_video_decoder_s *vd)
+{
+    if (vd->decoder_thread_started) {
+        push_task(vd, TASK_TERMINATE);
+        pthread_join(vd->decoder_thread, NULL);
+        vd->decoder_thread_started = 0;
+    }
+
+    if (vd->task_queue) {
+        // pending tasks can only be a result of failed initialization
+        struct decoder_task_s *task;
+        while ((task = g_async_queue_try_pop(vd->task_queue)) != NULL)
+            g_slice_free1(sizeof(*task), task);
+        g_async_queue_unref(vd->task_queue);
+        vd->task_queue = NULL;
+    }
+
+    if (vd->output_queue) {
+        // frames hold hw surfaces, release them before surfaces are destroyed
+        g_queue_free_full(vd->output_queue, (GDestroyNotify)free_decoded_frame);
+        vd->output_queue = NULL;
+    }
+
+    if (vd->deferred_tasks) {
+        // emptied by decoder thread on termination
+        g_queue_free(vd->deferred_tasks);
+        vd->deferred_tasks = NULL;
+    }
 }
 
 
@@ -105,6 +386,8 @@ static
 void
 deinitialize_decoder(struct pp_video_decoder_s *vd)
 {
+    stop_decoder_thread(vd);
+
     if (vd->graphics3d) {
         pp_resource_unref(vd->graphics3d);
         vd->graphics3d = 0;
@@ -123,79 +406,67 @@ deinitialize_decoder(struct pp_video_decoder_s *vd)
     if (vd->avframe)
         av_frame_free(&vd->avframe);
 
-    switch (vd->hwdec_api) {
-    case HWDEC_VAAPI:
-        if (vd->va_context.context_id) {
-            vaDestroyContext(display.va, vd->va_context.context_id);
-            vd->va_context.context_id = 0;
-        }
-
-        if (vd->va_context.config_id) {
-            vaDestroyConfig(display.va, vd->va_context.config_id);
-            vd->va_context.config_id = 0;
-        }
+    if (vd->hwdec_api == HWDEC_VAAPI && vd->va_context.context_id) {
+        // context is cheap to create, and is bound to the decoding session
+        vaDestroyContext(display.va, vd->va_context.context_id);
+        vd->va_context.context_id = 0;
+    }
 
-        vaDestroySurfaces(display.va, vd->surfaces, MAX_VA_SURFACES);
-        for (uintptr_t k = 0; k < MAX_VA_SURFACES; k ++) {
+    if (vd->hwdec_api == HWDEC_VAAPI || vd->hwdec_api == HWDEC_VDPAU) {
+        struct surface_set_s *set = g_slice_alloc0(sizeof(*set));
+
+        set->api =                  vd->hwdec_api;
+        set->width =                vd->width;
+        set->height =               vd->height;
+        set->va_config_id =         vd->va_context.config_id;
+        set->vdp_decoder =          vd->vdpau_context.decoder;
+        set->vdp_video_mixer =      vd->vdp_video_mixer;
+        set->vdp_output_surface =   vd->vdp_output_surface;
+        memcpy(set->va_surfaces, vd->surfaces, sizeof(set->va_surfaces));
+        memcpy(set->vdp_video_surfaces, vd->vdp_video_surfaces, sizeof(set->vdp_video_surfaces));
+
+        // dimensions are set only when all surfaces were successfully created
+        if (vd->width > 0)
+            cache_surface_set(set);
+        else
+            destroy_surface_set(set);
+
+        vd->va_context.config_id = 0;
+        vd->vdpau_context.decoder = VDP_INVALID_HANDLE;
+        vd->vdp_video_mixer = VDP_INVALID_HANDLE;
+        vd->vdp_output_surface = VDP_INVALID_HANDLE;
+        for (uintptr_t k = 0; k < MAX_VA_SURFACES; k ++)
             vd->surfaces[k] = VA_INVALID_SURFACE;
+        for (uintptr_t k = 0; k < MAX_VDP_SURFACES; k ++)
+            vd->vdp_video_surfaces[k] = VDP_INVALID_HANDLE;
+        for (uintptr_t k = 0; k < MAX_VA_SURFACES; k ++)
             vd->surface_used[k] = 0;
-        }
-        break;
-
-    case HWDEC_VDPAU:
-        if (vd->vdpau_context.decoder != VDP_INVALID_HANDLE) {
-            display.vdp_decoder_destroy(vd->vdpau_context.decoder);
-            vd->vdpau_context.decoder = VDP_INVALID_HANDLE;
-        }
-
-        if (vd->vdp_video_mixer != VDP_INVALID_HANDLE) {
-            display.vdp_video_mixer_destroy(vd->vdp_video_mixer);
-            vd->vdp_video_mixer = VDP_INVALID_HANDLE;
-        }
-
-        if (vd->vdp_output_surface != VDP_INVALID_HANDLE) {
-            display.vdp_output_surface_destroy(vd->vdp_output_surface);
-            vd->vdp_output_surface = VDP_INVALID_HANDLE;
-        }
-
-        for (uintptr_t k = 0; k < MAX_VDP_SURFACES; k ++) {
-            if (vd->vdp_video_surfaces[k] != VDP_INVALID_HANDLE) {
-                display.vdp_video_surface_destroy(vd->vdp_video_surfaces[k]);
-                vd->vdp_video_surfaces[k] = VDP_INVALID_HANDLE;
-                vd->surface_used[k] = 0;
-            }
-        }
-
-        for (uintptr_t k = 0; k < vd->buffer_count; k ++) {
-            if (vd->buffers[k].vdp_presentation_queue != VDP_INVALID_HANDLE) {
-                display.vdp_presentation_queue_destroy(vd->buffers[k].vdp_presentation_queue);
-                vd->buffers[k].vdp_presentation_queue = VDP_INVALID_HANDLE;
-            }
-
-            if (vd->buffers[k].vdp_presentation_queue_target != VDP_INVALID_HANDLE) {
-                display.vdp_presentation_queue_target_destroy(vd->buffers[k]
-                                                              .vdp_presentation_queue_target);
-                vd->buffers[k].vdp_presentation_queue_target = VDP_INVALID_HANDLE;
-            }
-        }
-        break;
-
-    default:
-        // no-op
-        break;
+        vd->width = 0;
+        vd->height = 0;
     }
 
     for (uintptr_t k = 0; k < vd->buffer_count; k ++) {
         vd->ppp_video_decoder_dev->DismissPictureBuffer(vd->instance->id, vd->self_id,
                                                         vd->buffers[k].id);
         pthread_mutex_lock(&display.lock);
-        if (vd->buffers[k].glx_pixmap != None) {
-            glXDestroyPixmap(display.x, vd->buffers[k].glx_pixmap);
-            vd->buffers[k].glx_pixmap = None;
-        }
-        if (vd->buffers[k].pixmap != None) {
-            XFreePixmap(display.x, vd->buffers[k].pixmap);
-            vd->buffers[k].pixmap = None;
+        if (!vd->buffers[k].used && vd->buffers[k].pixmap != None) {
+            // buffers still bound to textures are not reused
+            struct cached_picture_buffer_s *pb = g_slice_alloc(sizeof(*pb));
+
+            pb->api =           vd->hwdec_api;
+            pb->width =         vd->buffers[k].width;
+            pb->height =        vd->buffers[k].height;
+            pb->depth =         vd->pixmap_depth;
+            pb->fb_config_id =  vd->fb_config_id;
+            pb->pixmap =        vd->buffers[k].pixmap;
+            pb->glx_pixmap =    vd->buffers[k].glx_pixmap;
+            pb->vdp_presentation_queue_target = vd->buffers[k].vdp_presentation_queue_target;
+            pb->vdp_presentation_queue =        vd->buffers[k].vdp_presentation_queue;
+            cache_picture_buffer(pb);
+        } else {
+            destroy_picture_buffer_resources(vd->buffers[k].pixmap, vd->buffers[k].glx_pixmap,
+                                             vd->buffers[k].vdp_presentation_queue_target,
+                                             vd->buffers[k].vdp_presentation_queue);
         }
         pthread_mutex_unlock(&display.lock);
     }
@@ -204,6 +475,14 @@ deinitialize_decoder(struct pp_video_decoder_s *vd)
     vd->buffers_were_requested = 0;
     vd->initialized = 0;
     free_and_nullify(vd->buffers);
+    free_and_nullify(vd->free_buffers);
+    vd->free_buffer_count = 0;
+    if (vd->buffer_idx) {
+        g_hash_table_unref(vd->buffer_idx);
+        vd->buffer_idx = NULL;
+    }
+    free_and_nullify(vd->rgba_buf);
+    vd->rgba_buf_size = 0;
 }
 
 static
@@ -218,6 +497,17 @@ ppb_video_decoder_destroy_priv(void *p)
     }
 
     deinitialize_decoder(vd);
+
+    if (vd->frame_count > 0) {
+        trace_info_f("%s, %u frames, %u queued, %u dropped, decode time %u us mean, %u us max, "
+                     "latency %u us mean, %u us max\n", __func__, vd->frame_count,
+                     vd->queued_frame_count, vd->dropped_frame_count,
+                     (unsigned)(vd->decode_time_total_us / vd->frame_count),
+                     vd->decode_time_max_us, (unsigned)(vd->latency_total_us / vd->frame_count),
+                     vd->latency_max_us);
+    }
+
+    pthread_mutex_destroy(&vd->buffers_lock);
 }
 
 static
@@ -230,6 +520,14 @@ prepare_vaapi_context(struct pp_video_decoder_s *vd, int width, int height)
     vd->va_context.config_id = VA_INVALID_ID;
     vd->va_context.context_id = VA_INVALID_ID;
 
+    struct surface_set_s *set = take_cached_surface_set(HWDEC_VAAPI, width, height);
+    if (set) {
+        vd->va_context.config_id = set->va_config_id;
+        memcpy(vd->surfaces, set->va_surfaces, sizeof(vd->surfaces));
+        g_slice_free1(sizeof(*set), set);
+        goto create_context;
+    }
+
     // function is called from libavcodec internals which were already protected by mutex
     status = vaCreateConfig(display.va, VAProfileH264High, VAEntrypointVLD, NULL, 0,
                             &vd->va_context.config_id);
@@ -250,6 +548,8 @@ prepare_vaapi_context(struct pp_video_decoder_s *vd, int width, int height)
         goto err;
     }
 
+create_context:
+
     status = vaCreateContext(display.va, vd->va_context.config_id, width, height,
                              VA_PROGRESSIVE, vd->surfaces, MAX_VA_SURFACES,
                              &vd->va_context.context_id);
@@ -260,12 +560,12 @@ prepare_vaapi_context(struct pp_video_decoder_s *vd, int width, int height)
 
     vd->avctx->hwaccel_context = &vd->va_context;
     vd->hwdec_api = HWDEC_VAAPI;
+    vd->width = width;
+    vd->height = height;
     return AV_PIX_FMT_VAAPI_VLD;
 
 err:
-    vd->failed_state = 1;
-    vd->ppp_video_decoder_dev->NotifyError(vd->instance->id, vd->self_id,
-                                           PP_VIDEODECODERERROR_UNREADABLE_INPUT);
+    notify_error(vd, PP_VIDEODECODERERROR_UNREADABLE_INPUT);
     return AV_PIX_FMT_NONE;
 }
 
@@ -283,6 +583,16 @@ prepare_vdpau_context(struct pp_video_decoder_s *vd, int width, int height)
     for (uintptr_t k = 0; k < MAX_VDP_SURFACES; k ++)
         vd->vdp_video_surfaces[k] = VDP_INVALID_HANDLE;
 
+    struct surface_set_s *set = take_cached_surface_set(HWDEC_VDPAU, width, height);
+    if (set) {
+        vd->vdpau_context.decoder = set->vdp_decoder;
+        vd->vdp_video_mixer = set->vdp_video_mixer;
+        vd->vdp_output_surface = set->vdp_output_surface;
+        memcpy(vd->vdp_video_surfaces, set->vdp_video_surfaces, sizeof(vd->vdp_video_surfaces));
+        g_slice_free1(sizeof(*set), set);
+        goto done;
+    }
+
     st = display.vdp_decoder_create(display.vdp_device, VDP_DECODER_PROFILE_H264_HIGH, width,
                                     height, MAX_VDP_SURFACES, &vd->vdpau_context.decoder);
     if (st != VDP_STATUS_OK) {
@@ -326,14 +636,15 @@ prepare_vdpau_context(struct pp_video_decoder_s *vd, int width, int height)
         goto err;
     }
 
-    vd->vdpau_context.render = display.vdp_decoder_render;
+done:
+    vd->width = width;
+    vd->height = height;
+    vd->vdpau_context.render = vdpau_render_locked;
     vd->avctx->hwaccel_context = &vd->vdpau_context;
     return AV_PIX_FMT_VDPAU;
 
 err:
-    vd->failed_state = 1;
-    vd->ppp_video_decoder_dev->NotifyError(vd->instance->id, vd->self_id,
-                                           PP_VIDEODECODERERROR_UNREADABLE_INPUT);
+    notify_error(vd, PP_VIDEODECODERERROR_UNREADABLE_INPUT);
     return AV_PIX_FMT_NONE;
 }
 
@@ -355,18 +666,25 @@ get_format(struct AVCodecContext *s, const enum AVPixelFormat *fmt)
     trace_info_f("      VDPAU:  %s\n", have_vdpau ? "present" : "not present");
     trace_info_f("      VA-API: %s\n", have_vaapi ? "present" : "not present");
 
+    enum AVPixelFormat pix_fmt = AV_PIX_FMT_NONE;
+
+    // contexts are created by hw calls, they should be serialized with X traffic
+    if (!vd->decode_holds_display_lock)
+        pthread_mutex_lock(&display.lock);
+
     if (have_vaapi) {
-        return prepare_vaapi_context(vd, s->width, s->height);
+        pix_fmt = prepare_vaapi_context(vd, s->width, s->height);
+    } else if (have_vdpau) {
+        pix_fmt = prepare_vdpau_context(vd, s->width, s->height);
+    } else {
+        // nothing found, report error
+        notify_error(vd, PP_VIDEODECODERERROR_UNREADABLE_INPUT);
     }
 
-    if (have_vdpau) {
-        return prepare_vdpau_context(vd, s->width, s->height);
-    }
+    if (!vd->decode_holds_display_lock)
+        pthread_mutex_unlock(&display.lock);
 
-    // nothing found, report error
-    vd->ppp_video_decoder_dev->NotifyError(vd->instance->id, vd->self_id,
-                                           PP_VIDEODECODERERROR_UNREADABLE_INPUT);
-    return AV_PIX_FMT_NONE;
+    return pix_fmt;
 }
 
 static
@@ -499,6 +817,10 @@ release_buffer(struct AVCodecContext *avctx, AVFrame *pic)
 }
 #endif
 
+static
+void *
+decoder_thread(void *param);
+
 static
 int
 initialize_decoder(struct pp_video_decoder_s *vd)
@@ -523,7 +845,9 @@ initialize_decoder(struct pp_video_decoder_s *vd)
         goto err;
     }
 
-    vd->hwdec_api = HWDEC_NONE;
+    if (vd->hwdec_api != HWDEC_SOFTWARE)
+        vd->hwdec_api = HWDEC_NONE;     // will be selected in get_format()
+
     vd->avcodec = avcodec_find_decoder(vd->codec_id);
     if (!vd->avcodec) {
         trace_error("%s, can't create codec\n", __func__);
@@ -548,15 +872,24 @@ initialize_decoder(struct pp_video_decoder_s *vd)
     }
 
     vd->avctx->opaque = vd;
-    vd->avctx->thread_count = 1;
-    vd->avctx->get_format = get_format;
 
+    if (vd->hwdec_api == HWDEC_SOFTWARE) {
+        // libavcodec's own threads; each frame thread adds a frame of delay
+        vd->avctx->thread_count = config.video_decode_threads;
+        vd->avctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    } else {
+        vd->avctx->thread_count = 1;
+        vd->avctx->get_format = get_format;
 #if AVCTX_HAVE_REFCOUNTED_BUFFERS
-    vd->avctx->get_buffer2 = get_buffer2;
-    vd->avctx->refcounted_frames = 1;
+        vd->avctx->get_buffer2 = get_buffer2;
 #else
-    vd->avctx->get_buffer = get_buffer;
-    vd->avctx->release_buffer = release_buffer;
+        vd->avctx->get_buffer = get_buffer;
+        vd->avctx->release_buffer = release_buffer;
+#endif
+    }
+
+#if AVCTX_HAVE_REFCOUNTED_BUFFERS
+    vd->avctx->refcounted_frames = 1;
 #endif
 
     if (avcodec_open2(vd->avctx, vd->avcodec, NULL) < 0) {
@@ -570,6 +903,17 @@ initialize_decoder(struct pp_video_decoder_s *vd)
         goto err;
     }
 
+    vd->task_queue = g_async_queue_new();
+    vd->output_queue = g_queue_new();
+    vd->deferred_tasks = g_queue_new();
+    vd->message_loop = ppb_message_loop_get_current();
+
+    if (pthread_create(&vd->decoder_thread, NULL, decoder_thread, vd) != 0) {
+        trace_error("%s, can't create decoder thread\n", __func__);
+        goto err;
+    }
+    vd->decoder_thread_started = 1;
+
     vd->initialized = 1;
     return 0;
 
@@ -581,23 +925,26 @@ err:
 PP_Resource
 ppb_video_decoder_create(PP_Instance instance, PP_Resource context, PP_VideoDecoder_Profile profile)
 {
-    if (!config.enable_hwdec) {
-        trace_info_f("      hardware-accelerated decoding was disabled in config file\n");
+    int software = 0;
+
+    if (!config.enable_hwdec && !config.enable_swdec) {
+        trace_info_f("      video decoding was disabled in config file\n");
         return 0;
     }
 
     if (!display.va_available && !display.vdpau_available) {
         trace_info_f("      no hw acceleration available\n");
-        return 0;
-    }
-
-    if (!display.glXBindTexImageEXT) {
+        software = 1;
+    } else if (!display.glXBindTexImageEXT) {
         trace_info_f("      no glXBindTexImageEXT available\n");
-        return 0;
+        software = 1;
+    } else if (!display.glXReleaseTexImageEXT) {
+        trace_info_f("      no glXReleaseTexImageEXT available\n");
+        software = 1;
     }
 
-    if (!display.glXReleaseTexImageEXT) {
-        trace_info_f("      no glXReleaseTexImageEXT available\n");
+    if (software && !config.enable_swdec) {
+        trace_info_f("      software decoding was disabled in config file\n");
         return 0;
     }
 
@@ -652,7 +999,8 @@ ppb_video_decoder_create(PP_Instance instance, PP_Resource context, PP_VideoDeco
     vd->orig_graphics3d = pp_resource_ref(context);
     vd->ppp_video_decoder_dev = ppp_video_decoder_dev;
     vd->codec_id = AV_CODEC_ID_H264;        // TODO: other codecs
-    vd->hwdec_api = HWDEC_NONE;
+    vd->hwdec_api = software ? HWDEC_SOFTWARE : HWDEC_NONE;
+    pthread_mutex_init(&vd->buffers_lock, NULL);
 
     pp_resource_release(video_decoder);
     return video_decoder;
@@ -664,40 +1012,75 @@ ppb_video_decoder_is_video_decoder(PP_Resource resource)
     return pp_resource_get_type(resource) == PP_RESOURCE_VIDEO_DECODER;
 }
 
+struct provide_picture_buffers_param_s {
+    PP_Instance             instance;
+    PP_Resource             video_decoder;
+    uint32_t                req_num_of_bufs;
+    struct PP_Size          dimensions;
+    const struct PPP_VideoDecoder_Dev_0_11 *ppp_video_decoder_dev;
+};
+
+static
+void
+provide_picture_buffers_ptac(void *param, int32_t result)
+{
+    struct provide_picture_buffers_param_s *p = param;
+
+    p->ppp_video_decoder_dev->ProvidePictureBuffers(p->instance, p->video_decoder,
+                                                    p->req_num_of_bufs, &p->dimensions,
+                                                    GL_TEXTURE_2D);
+    g_slice_free1(sizeof(*p), p);
+}
+
 static
 void
 request_buffers(struct pp_video_decoder_s *vd)
 {
-    int requested_buffer_count;
-    const PP_Instance instance = vd->instance->id;
-    const struct PP_Size dimensions = { .width = vd->avctx->width,
-                                        .height = vd->avctx->height };
+    struct provide_picture_buffers_param_s *p = g_slice_alloc(sizeof(*p));
 
     switch (vd->hwdec_api) {
-    case HWDEC_VAAPI:   requested_buffer_count = MAX_VA_SURFACES; break;
-    case HWDEC_VDPAU:   requested_buffer_count = MAX_VDP_SURFACES; break;
-    default:            requested_buffer_count = 5; break; // just a number, no particular reason
+    case HWDEC_VAAPI:   p->req_num_of_bufs = MAX_VA_SURFACES; break;
+    case HWDEC_VDPAU:   p->req_num_of_bufs = MAX_VDP_SURFACES; break;
+    default:            p->req_num_of_bufs = 5; break; // just a number, no particular reason
     }
 
-    pp_resource_release(vd->self_id);
+    p->instance =               vd->instance->id;
+    p->video_decoder =          vd->self_id;
+    p->dimensions.width =       vd->avctx->width;
+    p->dimensions.height =      vd->avctx->height;
+    p->ppp_video_decoder_dev =  vd->ppp_video_decoder_dev;
 
-    vd->ppp_video_decoder_dev->ProvidePictureBuffers(instance, vd->self_id, requested_buffer_count,
-                                                     &dimensions, GL_TEXTURE_2D);
-    pp_resource_acquire(vd->self_id, PP_RESOURCE_VIDEO_DECODER);
+    // plugin will call AssignPictureBuffers() on its thread, decoding continues meanwhile
+    ppb_message_loop_post_work_with_result(vd->message_loop,
+                                           PP_MakeCCB(provide_picture_buffers_ptac, p), 0, PP_OK,
+                                           0, __func__);
 }
 
+// takes buffer from the head of free buffer ring. Should be called with buffers_lock held
 static
 uint32_t
 find_free_buffer(struct pp_video_decoder_s *vd)
 {
-    for (uint32_t idx = 0; idx < vd->buffer_count; idx ++) {
-        if (!vd->buffers[idx].used) {
-            vd->buffers[idx].used = 1;
-            return idx;
-        }
-    }
+    if (vd->free_buffer_count == 0)
+        return (uint32_t)-1;
+
+    const uint32_t idx = vd->free_buffers[vd->free_buffers_head];
+    vd->free_buffers_head = (vd->free_buffers_head + 1) % vd->buffer_count;
+    vd->free_buffer_count -= 1;
+    vd->buffers[idx].used = 1;
+    return idx;
+}
 
-    return (uint32_t)-1;
+// returns buffer to the tail of free buffer ring. Should be called with buffers_lock held
+static
+void
+put_free_buffer(struct pp_video_decoder_s *vd, uint32_t idx)
+{
+    const uint32_t tail = (vd->free_buffers_head + vd->free_buffer_count) % vd->buffer_count;
+
+    vd->free_buffers[tail] = idx;
+    vd->free_buffer_count += 1;
+    vd->buffers[idx].used = 0;
 }
 
 struct picture_ready_param_s {
@@ -718,36 +1101,102 @@ picture_ready_ptac(void *param, int32_t result)
     g_slice_free1(sizeof(*p), p);
 }
 
+// converts software-decoded frame into vd->rgba_buf
+static
+int
+convert_frame_to_rgba(struct pp_video_decoder_s *vd, AVFrame *frame)
+{
+    int full_range;
+
+    switch (frame->format) {
+    case AV_PIX_FMT_YUV420P:    full_range = 0; break;
+    case AV_PIX_FMT_YUVJ420P:   full_range = 1; break;
+    default:
+        trace_error("%s, unsupported pixel format %d\n", __func__, frame->format);
+        return -1;
+    }
+
+    const size_t stride = frame->width * 4;
+    const size_t size = stride * frame->height;
+    if (vd->rgba_buf_size < size) {
+        free(vd->rgba_buf);
+        vd->rgba_buf = malloc(size);
+        vd->rgba_buf_size = vd->rgba_buf ? size : 0;
+        if (!vd->rgba_buf) {
+            trace_error("%s, memory allocation failure\n", __func__);
+            return -1;
+        }
+    }
+
+    video_dsp_yuv420_to_rgba(frame->data[0], frame->linesize[0], frame->data[1],
+                             frame->linesize[1], frame->data[2], frame->linesize[2],
+                             vd->rgba_buf, stride, frame->width, frame->height, full_range);
+    return 0;
+}
+
+// frame couldn't be rendered, picture buffer wasn't passed to the plugin and should be returned
+// to the ring, unless buffer set was replaced meanwhile
 static
 void
-issue_frame(struct pp_video_decoder_s *vd)
+drop_unissued_frame(struct pp_video_decoder_s *vd, const void *buffers, uint32_t idx)
+{
+    pthread_mutex_lock(&vd->buffers_lock);
+    if (vd->buffers == buffers && vd->buffers[idx].used)
+        put_free_buffer(vd, idx);
+    pthread_mutex_unlock(&vd->buffers_lock);
+
+    vd->dropped_frame_count += 1;
+}
+
+// renders frame into a free picture buffer and passes it to the plugin. Returns -1 if there
+// were no free buffers, 0 otherwise. Called from decoder thread
+static
+int
+issue_frame(struct pp_video_decoder_s *vd, AVFrame *frame, int64_t enqueue_time)
 {
-    AVFrame *frame = vd->avframe;
-    uint32_t idx = find_free_buffer(vd);
     int32_t  bitstream_buffer_id = (int32_t)frame->pkt_pts;
 
+    pthread_mutex_lock(&vd->buffers_lock);
+    uint32_t idx = find_free_buffer(vd);
     if (idx == (uint32_t)-1) {
-        trace_warning("%s, no free buffer available\n", __func__);
-        return;
+        pthread_mutex_unlock(&vd->buffers_lock);
+        return -1;
+    }
+    const int32_t    buffer_id =  vd->buffers[idx].id;
+    const uint32_t   texture_id = vd->buffers[idx].texture_id;
+    const uint32_t   width =      vd->buffers[idx].width;
+    const uint32_t   height =     vd->buffers[idx].height;
+    const Pixmap     pixmap =     vd->buffers[idx].pixmap;
+    const GLXPixmap  glx_pixmap = vd->buffers[idx].glx_pixmap;
+    const VdpPresentationQueue vdp_presentation_queue = vd->buffers[idx].vdp_presentation_queue;
+    const void      *buffers =    vd->buffers;
+    pthread_mutex_unlock(&vd->buffers_lock);
+
+    if (vd->hwdec_api == HWDEC_SOFTWARE && convert_frame_to_rgba(vd, frame) != 0) {
+        drop_unissued_frame(vd, buffers, idx);
+        return 0;
     }
 
     struct pp_graphics3d_s *g3d = pp_resource_acquire(vd->graphics3d, PP_RESOURCE_GRAPHICS3D);
     if (!g3d) {
         trace_error("%s, bad resource\n", __func__);
-        return;
+        drop_unissued_frame(vd, buffers, idx);
+        return 0;
     }
 
     pthread_mutex_lock(&display.lock);
     glXMakeCurrent(display.x, g3d->glx_pixmap, g3d->glc);
-    glBindTexture(GL_TEXTURE_2D, vd->buffers[idx].texture_id);
-    display.glXBindTexImageEXT(display.x, vd->buffers[idx].glx_pixmap, GLX_FRONT_EXT, NULL);
-    XFlush(display.x);
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+    if (vd->hwdec_api != HWDEC_SOFTWARE) {
+        display.glXBindTexImageEXT(display.x, glx_pixmap, GLX_FRONT_EXT, NULL);
+        XFlush(display.x);
+    }
 
     switch (vd->hwdec_api) {
     case HWDEC_VAAPI:
         {
             VASurfaceID va_surf = GPOINTER_TO_SIZE(frame->data[3]);
-            vaPutSurface(display.va, va_surf, vd->buffers[idx].pixmap,
+            vaPutSurface(display.va, va_surf, pixmap,
                          0, 0, frame->width, frame->height,
                          0, 0, frame->width, frame->height,
                          NULL, 0, VA_FRAME_PICTURE);
@@ -764,13 +1213,21 @@ issue_frame(struct pp_video_decoder_s *vd)
                                                 0, NULL);
             report_vdpau_error(st, "VdpVideoMixerRender", __func__);
 
-            st = display.vdp_presentation_queue_display(vd->buffers[idx].vdp_presentation_queue,
+            st = display.vdp_presentation_queue_display(vdp_presentation_queue,
                                                         vd->vdp_output_surface,
-                                                        vd->buffers[idx].width,
-                                                        vd->buffers[idx].height, 0);
+                                                        width, height, 0);
             report_vdpau_error(st, "VdpPresentationQueueDisplay", __func__);
         }
         break;
+    case HWDEC_SOFTWARE:
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, frame->width);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, MIN((uint32_t)frame->width, width),
+                        MIN((uint32_t)frame->height, height), GL_RGBA, GL_UNSIGNED_BYTE,
+                        vd->rgba_buf);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        // texture will be used from plugin's context
+        glFinish();
+        break;
     default:
         trace_error("%s, not reached\n", __func__);
         break;
@@ -786,19 +1243,42 @@ issue_frame(struct pp_video_decoder_s *vd)
 
     p->instance =                    vd->instance->id;
     p->video_decoder =               vd->self_id;
-    p->picture.picture_buffer_id =   vd->buffers[idx].id;
+    p->picture.picture_buffer_id =   buffer_id;
     p->picture.bitstream_buffer_id = bitstream_buffer_id;
     p->ppp_video_decoder_dev =       vd->ppp_video_decoder_dev;
 
-    ppb_message_loop_post_work_with_result(ppb_message_loop_get_current(),
-                                           PP_MakeCCB(picture_ready_ptac, p), 0, PP_OK, 0,
-                                           __func__);
+    ppb_message_loop_post_work_with_result(vd->message_loop, PP_MakeCCB(picture_ready_ptac, p),
+                                           0, PP_OK, 0, __func__);
+
+    const uint32_t latency = g_get_monotonic_time() - enqueue_time;
+    vd->frame_count += 1;
+    vd->latency_total_us += latency;
+    vd->latency_max_us = MAX(vd->latency_max_us, latency);
+
+    return 0;
 }
 
+// passes queued frames to the plugin while there are free picture buffers
 static
 void
+issue_pending_frames(struct pp_video_decoder_s *vd)
+{
+    struct decoded_frame_s *df;
+
+    while ((df = g_queue_peek_head(vd->output_queue)) != NULL) {
+        if (issue_frame(vd, df->frame, df->enqueue_time) != 0)
+            break;
+        g_queue_pop_head(vd->output_queue);
+        free_decoded_frame(df);
+    }
+}
+
+// decodes a packet and passes resulting frame, if any, to the output. Empty packet drains frames
+// held by decoder. Returns 1 if there was a frame, 0 otherwise
+static
+int
 decode_frame(struct pp_video_decoder_s *vd, uint8_t *data, size_t data_len,
-             int32_t bitstream_buffer_id)
+             int32_t bitstream_buffer_id, int64_t enqueue_time)
 {
     AVPacket packet;
     av_init_packet(&packet);
@@ -806,25 +1286,245 @@ decode_frame(struct pp_video_decoder_s *vd, uint8_t *data, size_t data_len,
     packet.size = data_len;
     packet.pts = bitstream_buffer_id;
 
-    // libavcodec can call hw functions, which in turn can call Xlib functions,
-    // therefore we need to lock
-    pthread_mutex_lock(&display.lock);
+    // hw calls which touch Xlib are serialized on their own, see decode_needs_display_lock()
+    vd->decode_holds_display_lock = decode_needs_display_lock(vd);
+
+    const int64_t decode_start = g_get_monotonic_time();
+    if (vd->decode_holds_display_lock)
+        pthread_mutex_lock(&display.lock);
     int got_frame = 0;
     int len = avcodec_decode_video2(vd->avctx, vd->avframe, &got_frame, &packet);
-    pthread_mutex_unlock(&display.lock);
+    if (vd->decode_holds_display_lock)
+        pthread_mutex_unlock(&display.lock);
+
+    const uint32_t decode_time = g_get_monotonic_time() - decode_start;
+    vd->decode_time_total_us += decode_time;
+    vd->decode_time_max_us = MAX(vd->decode_time_max_us, decode_time);
+
     if (len < 0) {
         trace_error("%s, error %d while decoding frame\n", __func__, len);
-        return;
+        return 0;
+    }
+
+    if (!got_frame)
+        return 0;
+
+    if (!vd->buffers_were_requested) {
+        request_buffers(vd);
+        vd->buffers_were_requested = 1;
+    }
+
+#if AVCTX_HAVE_REFCOUNTED_BUFFERS
+    // keep frame until there is a free picture buffer for it
+    struct decoded_frame_s *df = g_slice_alloc(sizeof(*df));
+    df->frame = av_frame_alloc();
+    df->enqueue_time = enqueue_time;
+    av_frame_move_ref(df->frame, vd->avframe);
+    g_queue_push_tail(vd->output_queue, df);
+
+    issue_pending_frames(vd);
+
+    if (!g_queue_is_empty(vd->output_queue))
+        vd->queued_frame_count += 1;
+#else
+    // frame data will be overwritten by next decode call, there is no way to keep it
+    if (issue_frame(vd, vd->avframe, enqueue_time) != 0) {
+        trace_warning("%s, no free buffer available\n", __func__);
+        vd->dropped_frame_count += 1;
+    }
+#endif
+
+    return 1;
+}
+
+static
+int
+output_queue_is_full(struct pp_video_decoder_s *vd)
+{
+    return g_queue_get_length(vd->output_queue) >= MAX_PENDING_FRAMES;
+}
+
+// A single bitstream buffer can produce several frames. If output queue fills up, decoding
+// stops in the middle of the buffer, and task is resumed when plugin returns picture buffers.
+// Returns 1 if task was paused, 0 if it's done
+static
+int
+handle_decode_task(struct pp_video_decoder_s *vd, struct decoder_task_s *task)
+{
+    void *rawdata = ppb_buffer_map(task->bitstream_buffer);
+    if (!rawdata) {
+        trace_error("%s, bad bitstream buffer\n", __func__);
+        goto done;
+    }
+
+    uint8_t *inbuf = (uint8_t *)rawdata + task->consumed;
+    size_t   inbuf_sz = task->bitstream_buffer_size - task->consumed;
+
+    while (inbuf_sz > 0) {
+        uint8_t *outbuf = NULL;
+        int      outbuf_sz = 0;
+        int len = av_parser_parse2(vd->avparser, vd->avctx, &outbuf, &outbuf_sz,
+                                   inbuf, inbuf_sz, 0, 0, AV_NOPTS_VALUE);
+        if (outbuf_sz > 0) {
+            decode_frame(vd, outbuf, outbuf_sz, vd->last_consumed_bitstream_buffer_id,
+                         task->enqueue_time);
+        }
+        inbuf += len;
+        inbuf_sz -= len;
+        task->consumed += len;
+
+        if (inbuf_sz > 0 && output_queue_is_full(vd)) {
+            // keep the reference taken in ppb_video_decoder_decode()
+            ppb_buffer_unmap(task->bitstream_buffer);
+            return 1;
+        }
+    }
+
+    vd->last_consumed_bitstream_buffer_id = task->bitstream_buffer_id;
+    ppb_buffer_unmap(task->bitstream_buffer);
+
+done:
+    // drop the reference taken in ppb_video_decoder_decode()
+    ppb_buffer_unmap(task->bitstream_buffer);
+    return 0;
+}
+
+// Parser keeps the last packet until it sees the next one, and frame threads hold back decoded
+// frames. Both are passed to the output, so flush doesn't lose the end of the stream. Like
+// decoding, draining pauses when output queue is full. Returns 1 if paused, 0 if done
+static
+int
+drain_decoder(struct pp_video_decoder_s *vd, struct decoder_task_s *task)
+{
+    const int32_t bitstream_buffer_id = vd->last_consumed_bitstream_buffer_id;
+
+    if (!task->parser_drained) {
+        uint8_t *outbuf = NULL;
+        int      outbuf_sz = 0;
+
+        av_parser_parse2(vd->avparser, vd->avctx, &outbuf, &outbuf_sz, NULL, 0, 0, 0,
+                         AV_NOPTS_VALUE);
+        if (outbuf_sz > 0)
+            decode_frame(vd, outbuf, outbuf_sz, bitstream_buffer_id, task->enqueue_time);
+        task->parser_drained = 1;
     }
 
-    if (got_frame) {
-        if (!vd->buffers_were_requested) {
-            request_buffers(vd);
-            vd->buffers_were_requested = 1;
+    while (!output_queue_is_full(vd)) {
+        if (!decode_frame(vd, NULL, 0, bitstream_buffer_id, task->enqueue_time))
+            return 0;
+    }
+
+    return 1;
+}
+
+// runs decode or flush task, and passes its result to the plugin. Returns 1 if task was paused
+// due to full output queue, and should be run again later
+static
+int
+run_task(struct pp_video_decoder_s *vd, struct decoder_task_s *task)
+{
+    switch (task->type) {
+    case TASK_DECODE:
+        if (!g_atomic_int_get(&vd->failed_state)) {
+            if (handle_decode_task(vd, task) != 0)
+                return 1;
+        } else {
+            ppb_buffer_unmap(task->bitstream_buffer);
+        }
+        break;
+
+    case TASK_FLUSH:
+        if (!g_atomic_int_get(&vd->failed_state)) {
+            if (drain_decoder(vd, task) != 0)
+                return 1;
         }
 
-        issue_frame(vd);
+        if (decode_needs_display_lock(vd))
+            pthread_mutex_lock(&display.lock);
+        avcodec_flush_buffers(vd->avctx);
+        if (decode_needs_display_lock(vd))
+            pthread_mutex_unlock(&display.lock);
+        break;
+
+    default:
+        trace_error("%s, not reached\n", __func__);
+        break;
     }
+
+    ppb_message_loop_post_work_with_result(task->message_loop, task->callback, 0, PP_OK, 0,
+                                           __func__);
+    g_slice_free1(sizeof(*task), task);
+    return 0;
+}
+
+// resumes decoding which was paused due to lack of free picture buffers
+static
+void
+run_deferred_tasks(struct pp_video_decoder_s *vd)
+{
+    while (!g_queue_is_empty(vd->deferred_tasks) && !output_queue_is_full(vd)) {
+        struct decoder_task_s *task = g_queue_pop_head(vd->deferred_tasks);
+        if (run_task(vd, task) != 0) {
+            g_queue_push_head(vd->deferred_tasks, task);
+            break;
+        }
+    }
+}
+
+static
+void
+abort_deferred_tasks(struct pp_video_decoder_s *vd)
+{
+    struct decoder_task_s *task;
+
+    while ((task = g_queue_pop_head(vd->deferred_tasks)) != NULL) {
+        if (task->type == TASK_DECODE)
+            ppb_buffer_unmap(task->bitstream_buffer);
+        ppb_message_loop_post_work_with_result(task->message_loop, task->callback, 0,
+                                               PP_ERROR_ABORTED, 0, __func__);
+        g_slice_free1(sizeof(*task), task);
+    }
+}
+
+static
+void *
+decoder_thread(void *param)
+{
+    struct pp_video_decoder_s *vd = param;
+    int terminate = 0;
+
+    ppb_message_loop_mark_thread_unsuitable();
+
+    // Decoder thread never acquires video decoder resource itself, since plugin thread holds it
+    // while waiting for this thread to finish. Everything needed is reachable through vd.
+    while (!terminate) {
+        struct decoder_task_s *task = g_async_queue_pop(vd->task_queue);
+
+        switch (task->type) {
+        case TASK_DECODE:
+        case TASK_FLUSH:
+            // tasks are deferred in order, to keep flushes after decodes preceding them
+            if (output_queue_is_full(vd) || !g_queue_is_empty(vd->deferred_tasks))
+                g_queue_push_tail(vd->deferred_tasks, task);
+            else if (run_task(vd, task) != 0)
+                g_queue_push_tail(vd->deferred_tasks, task);
+            break;
+
+        case TASK_ISSUE_FRAMES:
+            issue_pending_frames(vd);
+            run_deferred_tasks(vd);
+            g_slice_free1(sizeof(*task), task);
+            break;
+
+        case TASK_TERMINATE:
+            abort_deferred_tasks(vd);
+            terminate = 1;
+            g_slice_free1(sizeof(*task), task);
+            break;
+        }
+    }
+
+    return NULL;
 }
 
 int32_t
@@ -838,7 +1538,7 @@ ppb_video_decoder_decode(PP_Resource video_decoder,
         return PP_ERROR_BADRESOURCE;
     }
 
-    if (vd->failed_state) {
+    if (g_atomic_int_get(&vd->failed_state)) {
         trace_warning("%s, there were errors before, giving up\n", __func__);
         pp_resource_release(video_decoder);
         return PP_ERROR_FAILED;
@@ -847,7 +1547,7 @@ ppb_video_decoder_decode(PP_Resource video_decoder,
     if (!vd->initialized) {
         int err = initialize_decoder(vd);
         if (err != 0) {
-            vd->failed_state = 1;
+            g_atomic_int_set(&vd->failed_state, 1);
             vd->ppp_video_decoder_dev->NotifyError(vd->instance->id, vd->self_id,
                                                    PP_VIDEODECODERERROR_PLATFORM_FAILURE);
             pp_resource_release(video_decoder);
@@ -855,33 +1555,24 @@ ppb_video_decoder_decode(PP_Resource video_decoder,
         }
     }
 
-    void *rawdata = ppb_buffer_map(bitstream_buffer->data);
-    if (!rawdata) {
+    // keep a reference to the buffer until decoder thread is done with it
+    if (!ppb_buffer_map(bitstream_buffer->data)) {
         trace_error("%s, bad bitstream buffer\n", __func__);
         pp_resource_release(video_decoder);
         return PP_ERROR_FAILED;
     }
 
-    uint8_t *inbuf = rawdata;
-    size_t   inbuf_sz = bitstream_buffer->size;
-
-    while (inbuf_sz > 0) {
-        uint8_t *outbuf = NULL;
-        int      outbuf_sz = 0;
-        int len = av_parser_parse2(vd->avparser, vd->avctx, &outbuf, &outbuf_sz,
-                                   inbuf, inbuf_sz, 0, 0, AV_NOPTS_VALUE);
-        if (outbuf_sz > 0)
-            decode_frame(vd, outbuf, outbuf_sz, vd->last_consumed_bitstream_buffer_id);
-        inbuf += len;
-        inbuf_sz -= len;
-    }
-
-    vd->last_consumed_bitstream_buffer_id = bitstream_buffer->id;
-    ppb_buffer_unmap(bitstream_buffer->data);
+    struct decoder_task_s *task = g_slice_alloc0(sizeof(*task));
+    task->type =                    TASK_DECODE;
+    task->bitstream_buffer =        bitstream_buffer->data;
+    task->bitstream_buffer_size =   bitstream_buffer->size;
+    task->bitstream_buffer_id =     bitstream_buffer->id;
+    task->enqueue_time =            g_get_monotonic_time();
+    task->callback =                callback;
+    task->message_loop =            ppb_message_loop_get_current();
+    g_async_queue_push(vd->task_queue, task);
 
     pp_resource_release(video_decoder);
-    ppb_message_loop_post_work_with_result(ppb_message_loop_get_current(), callback, 0, PP_OK, 0,
-                                           __func__);
     return PP_OK_COMPLETIONPENDING;
 }
 
@@ -901,22 +1592,49 @@ ppb_video_decoder_assign_picture_buffers(PP_Resource video_decoder, uint32_t no_
         goto err_2;
     }
 
-    vd->buffers = malloc(no_of_buffers * sizeof(*vd->buffers));
-    if (!vd->buffers) {
+    // buffers are prepared aside, and become visible to decoder thread only when complete
+    __typeof__(vd->buffers) new_buffers = malloc(no_of_buffers * sizeof(*new_buffers));
+    if (!new_buffers) {
         trace_error("%s, memory allocation failure\n", __func__);
         goto err_3;
     }
 
-    vd->buffer_count = no_of_buffers;
+    pthread_mutex_lock(&display.lock);
+    vd->pixmap_depth = g3d->depth;
+    glXGetFBConfigAttrib(display.x, g3d->fb_config, GLX_FBCONFIG_ID, &vd->fb_config_id);
+    pthread_mutex_unlock(&display.lock);
+
     for (uintptr_t k = 0; k < no_of_buffers; k ++) {
-        vd->buffers[k].id =         buffers[k].id;
-        vd->buffers[k].width =      buffers[k].size.width;
-        vd->buffers[k].height =     buffers[k].size.height;
-        vd->buffers[k].texture_id = buffers[k].texture_id;
-        vd->buffers[k].used =       0;
+        new_buffers[k].id =         buffers[k].id;
+        new_buffers[k].width =      buffers[k].size.width;
+        new_buffers[k].height =     buffers[k].size.height;
+        new_buffers[k].texture_id = buffers[k].texture_id;
+        new_buffers[k].used =       0;
+        new_buffers[k].pixmap =     None;
+        new_buffers[k].glx_pixmap = None;
+        new_buffers[k].vdp_presentation_queue_target = VDP_INVALID_HANDLE;
+        new_buffers[k].vdp_presentation_queue = VDP_INVALID_HANDLE;
+
+        if (vd->hwdec_api == HWDEC_SOFTWARE) {
+            // frames are uploaded directly into textures
+            continue;
+        }
+
+        struct cached_picture_buffer_s *pb =
+            take_cached_picture_buffer(vd->hwdec_api, new_buffers[k].width,
+                                       new_buffers[k].height, vd->pixmap_depth,
+                                       vd->fb_config_id);
+        if (pb) {
+            new_buffers[k].pixmap =     pb->pixmap;
+            new_buffers[k].glx_pixmap = pb->glx_pixmap;
+            new_buffers[k].vdp_presentation_queue_target = pb->vdp_presentation_queue_target;
+            new_buffers[k].vdp_presentation_queue =        pb->vdp_presentation_queue;
+            g_slice_free1(sizeof(*pb), pb);
+            continue;
+        }
 
         pthread_mutex_lock(&display.lock);
-        vd->buffers[k].pixmap = XCreatePixmap(display.x, DefaultRootWindow(display.x),
+        new_buffers[k].pixmap = XCreatePixmap(display.x, DefaultRootWindow(display.x),
                                               buffers[k].size.width, buffers[k].size.height,
                                               g3d->depth);
         int tfp_pixmap_attrs[] = {
@@ -926,11 +1644,12 @@ ppb_video_decoder_assign_picture_buffers(PP_Resource video_decoder, uint32_t no_
                                                      : GLX_TEXTURE_FORMAT_RGB_EXT,
             GL_NONE
         };
-        vd->buffers[k].glx_pixmap = glXCreatePixmap(display.x, g3d->fb_config,
-                                                    vd->buffers[k].pixmap, tfp_pixmap_attrs);
+        new_buffers[k].glx_pixmap = glXCreatePixmap(display.x, g3d->fb_config,
+                                                    new_buffers[k].pixmap, tfp_pixmap_attrs);
         pthread_mutex_unlock(&display.lock);
-        if (vd->buffers[k].glx_pixmap == None) {
+        if (new_buffers[k].glx_pixmap == None) {
             trace_error("%s, failed to create GLX pixmap\n", __func__);
+            free(new_buffers);
             goto err_3;
             // TODO: proper resource cleanup in case of an error
         }
@@ -940,13 +1659,10 @@ ppb_video_decoder_assign_picture_buffers(PP_Resource video_decoder, uint32_t no_
             VdpPresentationQueueTarget  pq_target;
             VdpPresentationQueue        pq;
 
-            vd->buffers[k].vdp_presentation_queue_target = VDP_INVALID_HANDLE;
-            vd->buffers[k].vdp_presentation_queue = VDP_INVALID_HANDLE;
-
             pthread_mutex_lock(&display.lock);
             XSync(display.x, False);
             st = display.vdp_presentation_queue_target_create_x11(
-                                                    display.vdp_device, vd->buffers[k].pixmap,
+                                                    display.vdp_device, new_buffers[k].pixmap,
                                                     &pq_target);
             report_vdpau_error(st, "VdpPresentationQueueTargetCreateX11", __func__);
 
@@ -954,11 +1670,39 @@ ppb_video_decoder_assign_picture_buffers(PP_Resource video_decoder, uint32_t no_
             report_vdpau_error(st, "VdpPresentationQueueCreate", __func__);
             pthread_mutex_unlock(&display.lock);
 
-            vd->buffers[k].vdp_presentation_queue_target = pq_target;
-            vd->buffers[k].vdp_presentation_queue =        pq;
+            new_buffers[k].vdp_presentation_queue_target = pq_target;
+            new_buffers[k].vdp_presentation_queue =        pq;
         }
     }
 
+    uint32_t   *free_buffers = malloc(no_of_buffers * sizeof(*free_buffers));
+    GHashTable *buffer_idx = g_hash_table_new(g_direct_hash, g_direct_equal);
+    if (!free_buffers) {
+        trace_error("%s, memory allocation failure\n", __func__);
+        g_hash_table_unref(buffer_idx);
+        free(new_buffers);
+        goto err_3;
+    }
+
+    // all buffers are free initially. Index is stored off by one, to distinguish it from NULL
+    for (uint32_t k = 0; k < no_of_buffers; k ++) {
+        free_buffers[k] = k;
+        g_hash_table_insert(buffer_idx, GINT_TO_POINTER(buffers[k].id), GSIZE_TO_POINTER(k + 1));
+    }
+
+    pthread_mutex_lock(&vd->buffers_lock);
+    vd->buffers = new_buffers;
+    vd->buffer_count = no_of_buffers;
+    vd->free_buffers = free_buffers;
+    vd->free_buffers_head = 0;
+    vd->free_buffer_count = no_of_buffers;
+    vd->buffer_idx = buffer_idx;
+    pthread_mutex_unlock(&vd->buffers_lock);
+
+    // frames may have been waiting for buffers
+    if (vd->decoder_thread_started)
+        push_task(vd, TASK_ISSUE_FRAMES);
+
 err_3:
     pp_resource_release(vd->graphics3d);
 err_2:
@@ -976,25 +1720,49 @@ ppb_video_decoder_reuse_picture_buffer(PP_Resource video_decoder, int32_t pictur
         return;
     }
 
-    for (uintptr_t k = 0; k < vd->buffer_count; k ++) {
-        if (vd->buffers[k].id == picture_buffer_id && vd->buffers[k].used) {
-            vd->buffers[k].used = 0;
-
-            struct pp_graphics3d_s *g3d = pp_resource_acquire(vd->graphics3d,
-                                                              PP_RESOURCE_GRAPHICS3D);
-            if (g3d) {
-                pthread_mutex_lock(&display.lock);
-                glXMakeCurrent(display.x, g3d->glx_pixmap, g3d->glc);
-                glBindTexture(GL_TEXTURE_2D, vd->buffers[k].texture_id);
-                display.glXReleaseTexImageEXT(display.x, vd->buffers[k].glx_pixmap, GLX_FRONT_EXT);
-                glXMakeCurrent(display.x, None, NULL);
-                XFlush(display.x);
-                pthread_mutex_unlock(&display.lock);
-
-                pp_resource_release(vd->graphics3d);
-            }
-        }
+    // buffer was given to the plugin by decoder thread, so its "used" flag is already set
+    pthread_mutex_lock(&vd->buffers_lock);
+    uintptr_t k = (uintptr_t)-1;
+    if (vd->buffer_idx) {
+        // missing entries become (uintptr_t)-1
+        k = GPOINTER_TO_SIZE(g_hash_table_lookup(vd->buffer_idx,
+                                                 GINT_TO_POINTER(picture_buffer_id))) - 1;
     }
+    if (k == (uintptr_t)-1 || !vd->buffers[k].used) {
+        pthread_mutex_unlock(&vd->buffers_lock);
+        trace_error("%s, picture buffer %d is not in use\n", __func__, picture_buffer_id);
+        pp_resource_release(video_decoder);
+        return;
+    }
+    const void     *buffers =    vd->buffers;
+    const uint32_t  texture_id = vd->buffers[k].texture_id;
+    const GLXPixmap glx_pixmap = vd->buffers[k].glx_pixmap;
+    pthread_mutex_unlock(&vd->buffers_lock);
+
+    struct pp_graphics3d_s *g3d = NULL;
+    if (vd->hwdec_api != HWDEC_SOFTWARE)
+        g3d = pp_resource_acquire(vd->graphics3d, PP_RESOURCE_GRAPHICS3D);
+    if (g3d) {
+        pthread_mutex_lock(&display.lock);
+        glXMakeCurrent(display.x, g3d->glx_pixmap, g3d->glc);
+        glBindTexture(GL_TEXTURE_2D, texture_id);
+        display.glXReleaseTexImageEXT(display.x, glx_pixmap, GLX_FRONT_EXT);
+        glXMakeCurrent(display.x, None, NULL);
+        XFlush(display.x);
+        pthread_mutex_unlock(&display.lock);
+
+        pp_resource_release(vd->graphics3d);
+    }
+
+    // texture is released, decoder thread can now render into the buffer, unless buffer set
+    // was replaced meanwhile
+    pthread_mutex_lock(&vd->buffers_lock);
+    if (vd->buffers == buffers && vd->buffers[k].used)
+        put_free_buffer(vd, k);
+    pthread_mutex_unlock(&vd->buffers_lock);
+
+    if (vd->decoder_thread_started)
+        push_task(vd, TASK_ISSUE_FRAMES);
 
     pp_resource_release(video_decoder);
 }
@@ -1008,11 +1776,23 @@ ppb_video_decoder_flush(PP_Resource video_decoder, struct PP_CompletionCallback
         return PP_ERROR_BADRESOURCE;
     }
 
-    avcodec_flush_buffers(vd->avctx);
+    if (!vd->decoder_thread_started) {
+        // nothing was decoded yet
+        pp_resource_release(video_decoder);
+        ppb_message_loop_post_work_with_result(ppb_message_loop_get_current(), callback, 0,
+                                               PP_OK, 0, __func__);
+        return PP_OK_COMPLETIONPENDING;
+    }
+
+    // flush is ordered after all pending decode tasks
+    struct decoder_task_s *task = g_slice_alloc0(sizeof(*task));
+    task->type =            TASK_FLUSH;
+    task->enqueue_time =    g_get_monotonic_time();
+    task->callback =        callback;
+    task->message_loop =    ppb_message_loop_get_current();
+    g_async_queue_push(vd->task_queue, task);
 
     pp_resource_release(video_decoder);
-    ppb_message_loop_post_work_with_result(ppb_message_loop_get_current(), callback, 0, PP_OK, 0,
-                                           __func__);
     return PP_OK_COMPLETIONPENDING;
 }
 
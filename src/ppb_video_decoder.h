@@ -56,4 +56,8 @@ ppb_video_decoder_reset(PP_Resource video_decoder, struct PP_CompletionCallback
 void
 ppb_video_decoder_destroy(PP_Resource video_decoder);
 
+/// destroys hw surfaces kept for reuse by future decoders. Should be called with display.lock held
+void
+ppb_video_decoder_clear_cache(void);
+
 #endif // FPP_PPB_VIDEO_DECODER_DEV_H
@@ -37,6 +37,9 @@
 #include <X11/extensions/Xrandr.h>
 #include <GL/glx.h>
 #include "screensaver_control.h"
+#if HAVE_HWDEC
+#include "ppb_video_decoder.h"
+#endif
 
 
 NPNetscapeFuncs     npn;
@@ -453,6 +456,8 @@ tables_close_display(void)
 
 #if HAVE_HWDEC
 
+    ppb_video_decoder_clear_cache();
+
     if (config.enable_hwdec) {
         if (config.enable_vaapi)
             deinitialize_vaapi();
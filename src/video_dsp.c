@@ -0,0 +1,349 @@
+/*
+ * Copyright © 2013-2015  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "video_dsp.h"
+#include <glib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+// Conversion is done in 16-bit fixed point, so SSE2 code can process eight pixels per
+// instruction. Inputs are scaled by 2^7 and coefficients by 2^13, a high half of their product
+// then has four fractional bits. Scalar code does exactly the same computations, to produce
+// identical results.
+#define COEF(x)     ((int16_t)((x) * 8192 + 0.5))
+
+struct yuv_coefs_s {
+    int16_t     y_offset;
+    int16_t     y;
+    int16_t     rv;
+    int16_t     gu;     ///< negated
+    int16_t     gv;     ///< negated
+    int16_t     bu;
+};
+
+static const struct yuv_coefs_s coefs_limited = {
+    .y_offset = 16,
+    .y =  COEF(1.164),
+    .rv = COEF(1.596),
+    .gu = COEF(0.391),
+    .gv = COEF(0.813),
+    .bu = COEF(2.018),
+};
+
+static const struct yuv_coefs_s coefs_full = {
+    .y_offset = 0,
+    .y =  COEF(1.0),
+    .rv = COEF(1.402),
+    .gu = COEF(0.344),
+    .gv = COEF(0.714),
+    .bu = COEF(1.772),
+};
+
+static
+inline
+int16_t
+mulhi_s16(int16_t a, int16_t b)
+{
+    return ((int32_t)a * b) >> 16;
+}
+
+static
+inline
+uint8_t
+clamp_u8(int v)
+{
+    return CLAMP(v, 0, 255);
+}
+
+static
+inline
+void
+convert_pixel(const struct yuv_coefs_s *c, uint8_t y, int16_t r_term, int16_t g_term,
+              int16_t b_term, uint8_t *dst)
+{
+    // 8 is for rounding
+    int16_t y_term = mulhi_s16((y - c->y_offset) * 128, c->y) + 8;
+
+    dst[0] = clamp_u8((y_term + r_term) >> 4);
+    dst[1] = clamp_u8((y_term + g_term) >> 4);
+    dst[2] = clamp_u8((y_term + b_term) >> 4);
+    dst[3] = 255;
+}
+
+static
+void
+convert_row_scalar(const struct yuv_coefs_s *c, const uint8_t *y_row, const uint8_t *u_row,
+                   const uint8_t *v_row, uint8_t *dst, unsigned int start, unsigned int width)
+{
+    for (unsigned int x = start; x < width; x ++) {
+        const int16_t u = (u_row[x / 2] - 128) * 128;
+        const int16_t v = (v_row[x / 2] - 128) * 128;
+        const int16_t r_term = mulhi_s16(v, c->rv);
+        const int16_t g_term = -(mulhi_s16(u, c->gu) + mulhi_s16(v, c->gv));
+        const int16_t b_term = mulhi_s16(u, c->bu);
+
+        convert_pixel(c, y_row[x], r_term, g_term, b_term, dst + 4 * x);
+    }
+}
+
+#if defined(__SSE2__)
+static
+inline
+void
+store_rgba_sse2(uint8_t *dst, __m128i r, __m128i g, __m128i b)
+{
+    const __m128i a = _mm_set1_epi8((char)0xff);
+    const __m128i rg_lo = _mm_unpacklo_epi8(r, g);
+    const __m128i rg_hi = _mm_unpackhi_epi8(r, g);
+    const __m128i ba_lo = _mm_unpacklo_epi8(b, a);
+    const __m128i ba_hi = _mm_unpackhi_epi8(b, a);
+
+    _mm_storeu_si128((__m128i *)(dst + 0),  _mm_unpacklo_epi16(rg_lo, ba_lo));
+    _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi16(rg_lo, ba_lo));
+    _mm_storeu_si128((__m128i *)(dst + 32), _mm_unpacklo_epi16(rg_hi, ba_hi));
+    _mm_storeu_si128((__m128i *)(dst + 48), _mm_unpackhi_epi16(rg_hi, ba_hi));
+}
+
+// converts 16 pixels at a time, returns number of pixels processed
+static
+unsigned int
+convert_row_sse2(const struct yuv_coefs_s *c, const uint8_t *y_row, const uint8_t *u_row,
+                 const uint8_t *v_row, uint8_t *dst, unsigned int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i y_offset = _mm_set1_epi16(c->y_offset);
+    const __m128i uv_offset = _mm_set1_epi16(128);
+    const __m128i rounding = _mm_set1_epi16(8);
+    const __m128i cy = _mm_set1_epi16(c->y);
+    const __m128i crv = _mm_set1_epi16(c->rv);
+    const __m128i cgu = _mm_set1_epi16(c->gu);
+    const __m128i cgv = _mm_set1_epi16(c->gv);
+    const __m128i cbu = _mm_set1_epi16(c->bu);
+    unsigned int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        __m128i y8 = _mm_loadu_si128((const __m128i *)(y_row + x));
+        __m128i u = _mm_loadl_epi64((const __m128i *)(u_row + x / 2));
+        __m128i v = _mm_loadl_epi64((const __m128i *)(v_row + x / 2));
+
+        u = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(u, zero), uv_offset), 7);
+        v = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(v, zero), uv_offset), 7);
+
+        // chroma terms, one per two pixels
+        __m128i r_term = _mm_mulhi_epi16(v, crv);
+        __m128i g_term = _mm_sub_epi16(zero, _mm_add_epi16(_mm_mulhi_epi16(u, cgu),
+                                                            _mm_mulhi_epi16(v, cgv)));
+        __m128i b_term = _mm_mulhi_epi16(u, cbu);
+
+        __m128i y_lo = _mm_sub_epi16(_mm_unpacklo_epi8(y8, zero), y_offset);
+        __m128i y_hi = _mm_sub_epi16(_mm_unpackhi_epi8(y8, zero), y_offset);
+        y_lo = _mm_add_epi16(_mm_mulhi_epi16(_mm_slli_epi16(y_lo, 7), cy), rounding);
+        y_hi = _mm_add_epi16(_mm_mulhi_epi16(_mm_slli_epi16(y_hi, 7), cy), rounding);
+
+#define CHANNEL(term)                                                                   \
+        _mm_packus_epi16(                                                               \
+            _mm_srai_epi16(_mm_add_epi16(y_lo, _mm_unpacklo_epi16(term, term)), 4),     \
+            _mm_srai_epi16(_mm_add_epi16(y_hi, _mm_unpackhi_epi16(term, term)), 4))
+
+        store_rgba_sse2(dst + 4 * x, CHANNEL(r_term), CHANNEL(g_term), CHANNEL(b_term));
+#undef CHANNEL
+    }
+
+    return x;
+}
+#endif
+
+void
+video_dsp_yuv420_to_rgba(const uint8_t *y_plane, size_t y_stride,
+                         const uint8_t *u_plane, size_t u_stride,
+                         const uint8_t *v_plane, size_t v_stride,
+                         uint8_t *dst, size_t dst_stride,
+                         unsigned int width, unsigned int height, int full_range)
+{
+    const struct yuv_coefs_s *c = full_range ? &coefs_full : &coefs_limited;
+
+    for (unsigned int row = 0; row < height; row ++) {
+        const uint8_t *y_row = y_plane + row * y_stride;
+        const uint8_t *u_row = u_plane + (row / 2) * u_stride;
+        const uint8_t *v_row = v_plane + (row / 2) * v_stride;
+        uint8_t       *dst_row = dst + row * dst_stride;
+        unsigned int   x = 0;
+
+#if defined(__SSE2__)
+        x = convert_row_sse2(c, y_row, u_row, v_row, dst_row, width);
+#endif
+
+        convert_row_scalar(c, y_row, u_row, v_row, dst_row, x, width);
+    }
+}
+
+// averages two rows of chroma samples, rounding up as SSE2 pavgb does
+static
+void
+average_rows(const uint8_t *a, const uint8_t *b, uint8_t *dst, unsigned int count)
+{
+    unsigned int x = 0;
+
+#if defined(__SSE2__)
+    for (; x + 16 <= count; x += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + x));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + x));
+        _mm_storeu_si128((__m128i *)(dst + x), _mm_avg_epu8(va, vb));
+    }
+#endif
+
+    for (; x < count; x ++)
+        dst[x] = (a[x] + b[x] + 1) >> 1;
+}
+
+// splits interleaved pairs into two arrays
+static
+void
+deinterleave_row(const uint8_t *src, uint8_t *dst_a, uint8_t *dst_b, unsigned int count)
+{
+    unsigned int x = 0;
+
+#if defined(__SSE2__)
+    const __m128i lo_mask = _mm_set1_epi16(0x00ff);
+    for (; x + 16 <= count; x += 16) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)(src + 2 * x));
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(src + 2 * x + 16));
+        __m128i a = _mm_packus_epi16(_mm_and_si128(v0, lo_mask), _mm_and_si128(v1, lo_mask));
+        __m128i b = _mm_packus_epi16(_mm_srli_epi16(v0, 8), _mm_srli_epi16(v1, 8));
+        _mm_storeu_si128((__m128i *)(dst_a + x), a);
+        _mm_storeu_si128((__m128i *)(dst_b + x), b);
+    }
+#endif
+
+    for (; x < count; x ++) {
+        dst_a[x] = src[2 * x];
+        dst_b[x] = src[2 * x + 1];
+    }
+}
+
+// extracts luma from a YUYV row, and averages chroma of two YUYV rows into interleaved UV pairs
+static
+void
+yuyv_row_pair(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1, uint8_t *uv,
+              unsigned int width)
+{
+    unsigned int x = 0;
+
+#if defined(__SSE2__)
+    const __m128i lo_mask = _mm_set1_epi16(0x00ff);
+    for (; x + 16 <= width; x += 16) {
+        __m128i a0 = _mm_loadu_si128((const __m128i *)(row0 + 2 * x));
+        __m128i a1 = _mm_loadu_si128((const __m128i *)(row0 + 2 * x + 16));
+        __m128i b0 = _mm_loadu_si128((const __m128i *)(row1 + 2 * x));
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(row1 + 2 * x + 16));
+
+        _mm_storeu_si128((__m128i *)(y0 + x), _mm_packus_epi16(_mm_and_si128(a0, lo_mask),
+                                                               _mm_and_si128(a1, lo_mask)));
+        _mm_storeu_si128((__m128i *)(y1 + x), _mm_packus_epi16(_mm_and_si128(b0, lo_mask),
+                                                               _mm_and_si128(b1, lo_mask)));
+
+        __m128i ca = _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(a1, 8));
+        __m128i cb = _mm_packus_epi16(_mm_srli_epi16(b0, 8), _mm_srli_epi16(b1, 8));
+        _mm_storeu_si128((__m128i *)(uv + x), _mm_avg_epu8(ca, cb));
+    }
+#endif
+
+    for (; x < width; x ++) {
+        y0[x] = row0[2 * x];
+        y1[x] = row1[2 * x];
+        uv[x] = (row0[2 * x + 1] + row1[2 * x + 1] + 1) >> 1;
+    }
+}
+
+void
+video_dsp_yuyv_to_i420(const uint8_t *src, size_t src_stride, uint8_t *dst,
+                       unsigned int width, unsigned int height)
+{
+    const unsigned int cw = (width + 1) / 2;
+    const unsigned int ch = (height + 1) / 2;
+    uint8_t *dst_y = dst;
+    uint8_t *dst_u = dst_y + width * height;
+    uint8_t *dst_v = dst_u + cw * ch;
+    uint8_t  uv[2 * cw];
+    uint8_t  y_unused[width];
+
+    for (unsigned int row = 0; row < height; row += 2) {
+        const int has_pair = row + 1 < height;
+        const uint8_t *row0 = src + row * src_stride;
+        const uint8_t *row1 = has_pair ? row0 + src_stride : row0;
+
+        yuyv_row_pair(row0, row1, dst_y + row * width,
+                      has_pair ? dst_y + (row + 1) * width : y_unused, uv, width);
+        deinterleave_row(uv, dst_u + (row / 2) * cw, dst_v + (row / 2) * cw, cw);
+    }
+}
+
+void
+video_dsp_nv12_to_i420(const uint8_t *src_y, size_t y_stride, const uint8_t *src_uv,
+                       size_t uv_stride, uint8_t *dst, unsigned int width, unsigned int height)
+{
+    const unsigned int cw = (width + 1) / 2;
+    const unsigned int ch = (height + 1) / 2;
+    uint8_t *dst_y = dst;
+    uint8_t *dst_u = dst_y + width * height;
+    uint8_t *dst_v = dst_u + cw * ch;
+
+    for (unsigned int row = 0; row < height; row ++)
+        memcpy(dst_y + row * width, src_y + row * y_stride, width);
+
+    for (unsigned int row = 0; row < ch; row ++)
+        deinterleave_row(src_uv + row * uv_stride, dst_u + row * cw, dst_v + row * cw, cw);
+}
+
+void
+video_dsp_planar_to_i420(const uint8_t *src_y, size_t y_stride,
+                         const uint8_t *src_u, size_t u_stride,
+                         const uint8_t *src_v, size_t v_stride,
+                         uint8_t *dst, unsigned int width, unsigned int height, int is_422)
+{
+    const unsigned int cw = (width + 1) / 2;
+    const unsigned int ch = (height + 1) / 2;
+    uint8_t *dst_y = dst;
+    uint8_t *dst_u = dst_y + width * height;
+    uint8_t *dst_v = dst_u + cw * ch;
+
+    for (unsigned int row = 0; row < height; row ++)
+        memcpy(dst_y + row * width, src_y + row * y_stride, width);
+
+    for (unsigned int row = 0; row < ch; row ++) {
+        if (is_422) {
+            // 4:2:2 has chroma rows for every luma row
+            const unsigned int r0 = 2 * row;
+            const unsigned int r1 = MIN(r0 + 1, height - 1);
+            average_rows(src_u + r0 * u_stride, src_u + r1 * u_stride, dst_u + row * cw, cw);
+            average_rows(src_v + r0 * v_stride, src_v + r1 * v_stride, dst_v + row * cw, cw);
+        } else {
+            memcpy(dst_u + row * cw, src_u + row * u_stride, cw);
+            memcpy(dst_v + row * cw, src_v + row * v_stride, cw);
+        }
+    }
+}
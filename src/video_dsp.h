@@ -0,0 +1,65 @@
+/*
+ * Copyright © 2013-2015  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPP_VIDEO_DSP_H
+#define FPP_VIDEO_DSP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/// converts planar YUV 4:2:0 picture into packed RGBA, using BT.601 coefficients
+///
+/// Chroma planes have half width and height of luma plane, rounded up. If @full_range is
+/// non-zero, input uses full 0-255 range (as in JPEG), otherwise it's limited to 16-235.
+/// Alpha is set to 255.
+void
+video_dsp_yuv420_to_rgba(const uint8_t *y_plane, size_t y_stride,
+                         const uint8_t *u_plane, size_t u_stride,
+                         const uint8_t *v_plane, size_t v_stride,
+                         uint8_t *dst, size_t dst_stride,
+                         unsigned int width, unsigned int height, int full_range);
+
+/// I420 is a planar YUV 4:2:0 layout with Y, U and V planes following each other without gaps.
+/// Chroma planes have half width and height of luma plane, rounded up. Functions below convert
+/// other layouts to it, averaging vertically adjacent chroma samples where needed.
+
+/// converts packed YUYV 4:2:2 picture, @width should be even
+void
+video_dsp_yuyv_to_i420(const uint8_t *src, size_t src_stride, uint8_t *dst,
+                       unsigned int width, unsigned int height);
+
+/// converts NV12: luma plane followed by a plane of interleaved U and V samples
+void
+video_dsp_nv12_to_i420(const uint8_t *src_y, size_t y_stride, const uint8_t *src_uv,
+                       size_t uv_stride, uint8_t *dst, unsigned int width, unsigned int height);
+
+/// converts planar YUV 4:2:0 or 4:2:2 picture, which may have padding between rows
+void
+video_dsp_planar_to_i420(const uint8_t *src_y, size_t y_stride,
+                         const uint8_t *src_u, size_t u_stride,
+                         const uint8_t *src_v, size_t v_stride,
+                         uint8_t *dst, unsigned int width, unsigned int height, int is_422);
+
+#endif // FPP_VIDEO_DSP_H
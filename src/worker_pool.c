@@ -0,0 +1,221 @@
+/*
+ * Copyright © 2013-2015  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "worker_pool.h"
+#include <glib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <ppapi/c/pp_errors.h>
+#include "trace.h"
+#include "ppb_message_loop.h"
+
+
+#define MIN_THREAD_COUNT    2
+#define MAX_THREAD_COUNT    16
+
+struct worker_pool_task_s {
+    void                          (*func)(void *);
+    int32_t                       (*func_with_result)(void *);
+    void                           *user_data;
+    struct PP_CompletionCallback    callback;
+    PP_Resource                     callback_ml;
+    const char                     *origin;
+};
+
+// Each worker owns a deque. Worker takes tasks from the head of its own deque, and when it runs
+// out of them, steals from the tail of other workers' deques.
+struct worker_s {
+    pthread_mutex_t     lock;
+    GQueue              queue;
+    pthread_t           thread;
+    unsigned int        idx;
+};
+
+static struct worker_s     *workers = NULL;
+static unsigned int         worker_count = 0;
+static pthread_once_t       pool_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t      pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t       pool_cond = PTHREAD_COND_INITIALIZER;
+static volatile gint        pending_task_count = 0;
+static volatile gint        next_worker = 0;
+static __thread int         this_worker_idx = -1;
+
+
+static
+struct worker_pool_task_s *
+take_task(unsigned int idx)
+{
+    struct worker_pool_task_s *task = NULL;
+
+    for (unsigned int k = 0; k < worker_count && !task; k ++) {
+        struct worker_s *w = &workers[(idx + k) % worker_count];
+
+        pthread_mutex_lock(&w->lock);
+        if (k == 0)
+            task = g_queue_pop_head(&w->queue);
+        else
+            task = g_queue_pop_tail(&w->queue);
+        pthread_mutex_unlock(&w->lock);
+    }
+
+    if (task)
+        g_atomic_int_add(&pending_task_count, -1);
+
+    return task;
+}
+
+static
+void
+run_task(struct worker_pool_task_s *task)
+{
+    if (task->func_with_result) {
+        int32_t result = task->func_with_result(task->user_data);
+        if (task->callback.func) {
+            ppb_message_loop_post_work_with_result(task->callback_ml, task->callback, 0, result,
+                                                   0, task->origin);
+        }
+    } else {
+        task->func(task->user_data);
+    }
+
+    g_slice_free(struct worker_pool_task_s, task);
+}
+
+static
+void *
+worker_thread(void *param)
+{
+    struct worker_s *w = param;
+
+    this_worker_idx = w->idx;
+    ppb_message_loop_mark_thread_unsuitable();
+
+    while (1) {
+        struct worker_pool_task_s *task = take_task(w->idx);
+        if (task) {
+            run_task(task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool_lock);
+        while (g_atomic_int_get(&pending_task_count) == 0)
+            pthread_cond_wait(&pool_cond, &pool_lock);
+        pthread_mutex_unlock(&pool_lock);
+    }
+
+    return NULL;
+}
+
+static
+void
+worker_pool_initialize(void)
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    worker_count = CLAMP(ncpu, MIN_THREAD_COUNT, MAX_THREAD_COUNT);
+    workers = calloc(worker_count, sizeof(workers[0]));
+    if (!workers) {
+        trace_error("%s, can't allocate memory\n", __func__);
+        worker_count = 0;
+        return;
+    }
+
+    for (unsigned int k = 0; k < worker_count; k ++) {
+        pthread_mutex_init(&workers[k].lock, NULL);
+        g_queue_init(&workers[k].queue);
+        workers[k].idx = k;
+    }
+
+    for (unsigned int k = 0; k < worker_count; k ++) {
+        pthread_create(&workers[k].thread, NULL, worker_thread, &workers[k]);
+        pthread_detach(workers[k].thread);
+    }
+}
+
+static
+void
+push_task(struct worker_pool_task_s *task)
+{
+    pthread_once(&pool_once, worker_pool_initialize);
+
+    if (worker_count == 0) {
+        // no threads available, run synchronously
+        run_task(task);
+        return;
+    }
+
+    // Tasks spawned from within a pool thread go to that thread's own deque, so they are likely
+    // to be picked up while their data is still in cache. Other tasks are spread evenly.
+    unsigned int idx;
+    if (this_worker_idx >= 0)
+        idx = this_worker_idx;
+    else
+        idx = (unsigned int)g_atomic_int_add(&next_worker, 1) % worker_count;
+
+    // Count is incremented before task is published. Otherwise another worker could take task
+    // and decrement count first, making it negative, and idle workers would spin instead of
+    // waiting.
+    g_atomic_int_inc(&pending_task_count);
+
+    struct worker_s *w = &workers[idx];
+    pthread_mutex_lock(&w->lock);
+    g_queue_push_head(&w->queue, task);
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_mutex_lock(&pool_lock);
+    pthread_cond_signal(&pool_cond);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void
+worker_pool_run(void (*func)(void *), void *user_data)
+{
+    struct worker_pool_task_s *task = g_slice_new0(struct worker_pool_task_s);
+
+    task->func = func;
+    task->user_data = user_data;
+    push_task(task);
+}
+
+void
+worker_pool_run_with_completion(int32_t (*func)(void *), void *user_data,
+                                struct PP_CompletionCallback callback, PP_Resource callback_ml,
+                                const char *origin)
+{
+    struct worker_pool_task_s *task = g_slice_new0(struct worker_pool_task_s);
+
+    task->func_with_result = func;
+    task->user_data = user_data;
+    task->callback = callback;
+    task->callback_ml = callback_ml;
+    task->origin = origin;
+    push_task(task);
+}
+
+unsigned int
+worker_pool_get_thread_count(void)
+{
+    pthread_once(&pool_once, worker_pool_initialize);
+    return worker_count;
+}
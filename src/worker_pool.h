@@ -0,0 +1,53 @@
+/*
+ * Copyright © 2013-2015  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPP_WORKER_POOL_H
+#define FPP_WORKER_POOL_H
+
+#include <ppapi/c/pp_completion_callback.h>
+#include <ppapi/c/pp_resource.h>
+
+
+/// run @func on one of pool threads
+///
+/// Pool is shared between all instances and is sized to number of online processors. It's
+/// intended for short blocking helper operations (file IO, decoding, etc.) and must not be used
+/// for tasks which run indefinitely.
+void
+worker_pool_run(void (*func)(void *), void *user_data);
+
+/// run @func on one of pool threads, then post its return value to @callback
+///
+/// @param callback_ml message loop @callback is posted to
+/// @param origin name of scheduling function, used for tracing
+void
+worker_pool_run_with_completion(int32_t (*func)(void *), void *user_data,
+                                struct PP_CompletionCallback callback, PP_Resource callback_ml,
+                                const char *origin);
+
+/// number of threads in the pool
+unsigned int
+worker_pool_get_thread_count(void);
+
+#endif // FPP_WORKER_POOL_H
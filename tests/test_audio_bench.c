@@ -0,0 +1,156 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <glib.h>
+#include <math.h>
+#include <unistd.h>
+#include <src/audio_thread_bench.c>
+#include <src/audio_dsp.h>
+#include <src/ppb_audio.h>
+#include <src/ppb_audio_config.h>
+#include <src/ppb_core.h>
+#include <src/ppb_message_loop.h>
+#include "common.h"
+
+#define SAMPLE_RATE     48000
+#define FRAME_COUNT     480
+#define SECONDS         20
+
+static volatile gint    callback_count;
+static volatile gint    wrong_size_count;
+
+// stands in for plugin: synthesizes a tone and scales it, as a mixer would
+static
+void
+playback_cb(void *buf, uint32_t sz, double latency, void *user_data)
+{
+    int16_t *samples = buf;
+    const size_t frame_count = sz / (2 * sizeof(int16_t));
+    static uint64_t phase = 0;
+
+    for (size_t k = 0; k < frame_count; k ++) {
+        const int16_t v = 20000 * sin(2 * M_PI * 1000.0 * (phase + k) / SAMPLE_RATE);
+        samples[2 * k] = v;
+        samples[2 * k + 1] = v;
+    }
+    phase += frame_count;
+
+    audio_dsp_apply_gain_s16(samples, frame_count * 2, 0.7f);
+    g_atomic_int_inc(&callback_count);
+}
+
+static
+void
+capture_cb(const void *buf, uint32_t sz, double latency, void *user_data)
+{
+    if (sz != FRAME_COUNT * sizeof(int16_t))
+        g_atomic_int_inc(&wrong_size_count);
+    g_atomic_int_inc(&callback_count);
+}
+
+static
+void
+print_results(const char *name, const audio_bench_results *r)
+{
+    printf("  %s: %u callbacks, %.1fx real time, callback %.2f us mean, %.2f us max, "
+           "jitter %.2f us mean, %.2f us max\n", name, r->callback_count, r->speed,
+           r->mean_callback_us, r->max_callback_us, r->mean_jitter_us, r->max_jitter_us);
+}
+
+static
+void
+check_results(const char *name, const audio_bench_results *r)
+{
+    const int wanted = SECONDS * SAMPLE_RATE / FRAME_COUNT;
+
+    print_results(name, r);
+    assert(r->callback_count >= (uint32_t)wanted);
+    assert(r->frame_count == (uint64_t)r->callback_count * FRAME_COUNT);
+    assert(r->speed > 1.0);
+    assert(r->max_callback_us >= r->mean_callback_us);
+}
+
+// playback goes through the same PPB_Audio calls plugin makes
+static
+void
+run_playback(PP_Instance instance)
+{
+    const int wanted = SECONDS * SAMPLE_RATE / FRAME_COUNT;
+
+    g_atomic_int_set(&callback_count, 0);
+    PP_Resource audio_config = ppb_audio_config_create_stereo_16_bit(instance, SAMPLE_RATE,
+                                                                     FRAME_COUNT);
+    PP_Resource audio = ppb_audio_create_1_1(instance, audio_config, playback_cb, NULL);
+    assert(audio);
+
+    // stopped audio doesn't call plugin
+    usleep(20 * 1000);
+    assert(g_atomic_int_get(&callback_count) == 0);
+
+    assert(ppb_audio_start_playback(audio));
+    while (g_atomic_int_get(&callback_count) < wanted)
+        usleep(1000);
+    assert(ppb_audio_stop_playback(audio));
+
+    struct pp_audio_s *a = pp_resource_acquire(audio, PP_RESOURCE_AUDIO);
+    assert(a);
+    audio_bench_results r;
+    audio_bench_get_results(a->stream, &r);
+    pp_resource_release(audio);
+    check_results("playback", &r);
+
+    ppb_core_release_resource(audio);
+    ppb_core_release_resource(audio_config);
+}
+
+// there is no PPB interface for capture in this layer, backend is called directly
+static
+void
+run_capture(void)
+{
+    const int     wanted = SECONDS * SAMPLE_RATE / FRAME_COUNT;
+    audio_stream *as;
+
+    g_atomic_int_set(&callback_count, 0);
+    as = audio_bench.create_capture_stream(SAMPLE_RATE, FRAME_COUNT, capture_cb, NULL, NULL);
+    assert(as);
+
+    // paused streams don't call plugin
+    usleep(20 * 1000);
+    assert(g_atomic_int_get(&callback_count) == 0);
+
+    audio_bench.pause(as, 0);
+    while (g_atomic_int_get(&callback_count) < wanted)
+        usleep(1000);
+    audio_bench.pause(as, 1);
+
+    audio_bench_results r;
+    audio_bench_get_results(as, &r);
+    check_results("capture", &r);
+
+    audio_bench.destroy(as);
+}
+
+int
+main(void)
+{
+    config.audio_bench_speed = 1000;
+    assert(audio_bench.available());
+
+    PP_Instance instance = create_instance();
+
+    // start/stop notify browser through its thread; this one stands in for it
+    PP_Resource message_loop = ppb_message_loop_create(instance);
+    ppb_message_loop_attach_to_current_thread(message_loop);
+    ppb_message_loop_proclaim_this_thread_browser();
+
+    printf("%d seconds of audio at %dx\n", SECONDS, config.audio_bench_speed);
+    run_playback(instance);
+    run_capture();
+    assert(g_atomic_int_get(&wrong_size_count) == 0);
+
+    destroy_instance(instance);
+
+    printf("pass\n");
+    return 0;
+}
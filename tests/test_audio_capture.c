@@ -0,0 +1,167 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <glib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <src/audio_capture.c>
+
+#define CHUNK_FRAMES    441
+
+static pthread_mutex_t  lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   cond = PTHREAD_COND_INITIALIZER;
+static size_t           frames_received;
+static int              wrong_size_count;
+static int              wrong_data_count;
+static int16_t          expected_value;
+static volatile gint    block_callback;
+
+static
+void
+capture_cb(const void *buf, uint32_t sz, double latency, void *user_data)
+{
+    const int16_t *samples = buf;
+
+    while (g_atomic_int_get(&block_callback))
+        usleep(1000);
+
+    pthread_mutex_lock(&lock);
+    if (sz != CHUNK_FRAMES * sizeof(int16_t))
+        wrong_size_count ++;
+
+    for (uint32_t k = 0; k < sz / sizeof(int16_t); k ++) {
+        if (user_data && samples[k] != expected_value)
+            wrong_data_count ++;
+        expected_value ++;
+    }
+
+    frames_received += sz / sizeof(int16_t);
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+}
+
+static
+void
+wait_for_frames(size_t count)
+{
+    pthread_mutex_lock(&lock);
+    while (frames_received < count)
+        pthread_cond_wait(&cond, &lock);
+    pthread_mutex_unlock(&lock);
+}
+
+static
+void
+reset_counters(void)
+{
+    pthread_mutex_lock(&lock);
+    frames_received = 0;
+    wrong_size_count = 0;
+    wrong_data_count = 0;
+    expected_value = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+static
+void
+test_downmix_and_chunking(void)
+{
+    printf("stereo device, odd sized pushes\n");
+    audio_capture *ac = audio_capture_new(44100, 2, 44100, CHUNK_FRAMES, capture_cb, (void *)1);
+    int16_t buf[2 * 1500];
+    int16_t value = 0;
+
+    reset_counters();
+    assert(ac);
+
+    // push sizes unrelated to chunk size, plugin should still get whole chunks
+    const size_t push_sizes[] = { 1, 100, 1500, 37, 441, 1000, 1313 };
+    size_t total = 0;
+    for (int iter = 0; iter < 5; iter ++) {
+        for (size_t k = 0; k < sizeof(push_sizes) / sizeof(push_sizes[0]); k ++) {
+            const size_t n = push_sizes[k];
+            for (size_t j = 0; j < n; j ++) {
+                buf[2 * j] = value - 5;
+                buf[2 * j + 1] = value + 5;
+                value ++;
+            }
+            audio_capture_push(ac, buf, n, 0.01);
+            total += n;
+        }
+    }
+
+    const size_t expected = total / CHUNK_FRAMES * CHUNK_FRAMES;
+    wait_for_frames(expected);
+    audio_capture_stop(ac);
+
+    audio_stream_stats stats = {};
+    audio_capture_get_stats(ac, &stats);
+    assert(frames_received == expected);
+    assert(stats.callback_count == expected / CHUNK_FRAMES);
+    assert(stats.overrun_count == 0);
+    assert(wrong_size_count == 0);
+    assert(wrong_data_count == 0);
+
+    audio_capture_free(ac);
+}
+
+static
+void
+test_overrun(void)
+{
+    printf("overrun accounting\n");
+    audio_capture *ac = audio_capture_new(8000, 1, 8000, CHUNK_FRAMES, capture_cb, NULL);
+    int16_t buf[1000] = {};
+
+    reset_counters();
+    assert(ac);
+
+    // slow plugin, ring holds about a second of data
+    g_atomic_int_set(&block_callback, 1);
+    for (int k = 0; k < 20; k ++)
+        audio_capture_push(ac, buf, 1000, 0);
+
+    audio_stream_stats stats = {};
+    audio_capture_get_stats(ac, &stats);
+    assert(stats.overrun_count > 0);
+
+    g_atomic_int_set(&block_callback, 0);
+    wait_for_frames(7 * 1000 / CHUNK_FRAMES * CHUNK_FRAMES);
+    assert(wrong_size_count == 0);
+
+    audio_capture_free(ac);
+}
+
+static
+void
+test_resampling(void)
+{
+    printf("resampling, 48000 -> 44100\n");
+    audio_capture *ac = audio_capture_new(48000, 2, 44100, CHUNK_FRAMES, capture_cb, NULL);
+    int16_t buf[2 * 480] = {};
+
+    reset_counters();
+    assert(ac);
+
+    // a second of data
+    for (int k = 0; k < 100; k ++)
+        audio_capture_push(ac, buf, 480, 0);
+
+    wait_for_frames(44100 - 2 * CHUNK_FRAMES);
+    audio_capture_stop(ac);
+    assert(frames_received <= 44100);
+    assert(wrong_size_count == 0);
+
+    audio_capture_free(ac);
+}
+
+int
+main(void)
+{
+    test_downmix_and_chunking();
+    test_overrun();
+    test_resampling();
+
+    printf("pass\n");
+    return 0;
+}
@@ -0,0 +1,167 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <math.h>
+#include <src/audio_dsp.c>
+
+static
+void
+test_conversion(void)
+{
+    printf("format conversion\n");
+    int16_t src[22];
+    int16_t dst[22];
+    float   l[11], r[11];
+
+    for (int k = 0; k < 22; k ++)
+        src[k] = (k % 2) ? -1000 * k : 1000 * k;
+    src[0] = INT16_MIN;
+    src[1] = INT16_MAX;
+
+    audio_dsp_deinterleave_s16_to_float(src, l, r, 11);
+    assert(l[0] == -1.0f);
+    assert(l[3] == 6000 / 32768.0f);
+    assert(r[3] == -7000 / 32768.0f);
+
+    audio_dsp_interleave_float_to_s16(l, r, dst, 11);
+    assert(memcmp(src, dst, sizeof(src)) == 0);
+
+    // out of range values are clipped
+    float big[9] = {2.0f, -2.0f, 0.5f, 2.0f, -2.0f, 0.5f, 2.0f, -2.0f, 0.5f};
+    audio_dsp_float_to_s16(big, dst, 9);
+    assert(dst[0] == INT16_MAX && dst[1] == INT16_MIN && dst[2] == 16384);
+    assert(dst[8] == 16384);
+
+    audio_dsp_s16_to_float(dst, big, 9);
+    assert(big[7] == -1.0f);
+}
+
+static
+void
+test_gain_and_mix(void)
+{
+    printf("gain and mix\n");
+    int16_t a[19], b[19];
+
+    for (int k = 0; k < 19; k ++) {
+        a[k] = 30000;
+        b[k] = 1000 * k;
+    }
+
+    audio_dsp_mix_s16(a, b, 19);
+    assert(a[0] == 30000);
+    assert(a[2] == 32000);
+    assert(a[18] == INT16_MAX);
+
+    audio_dsp_apply_gain_s16(b, 19, 0.5f);
+    assert(b[18] == 9000);
+
+    audio_dsp_apply_gain_s16(b, 19, 0.0f);
+    for (int k = 0; k < 19; k ++)
+        assert(b[k] == 0);
+}
+
+static
+void
+test_downmix(void)
+{
+    printf("downmix\n");
+    int16_t buf[2 * 21];
+
+    for (int k = 0; k < 21; k ++) {
+        buf[2 * k] = 100 * k - 1000;
+        buf[2 * k + 1] = -3 - 100 * k;
+    }
+
+    // in place
+    audio_dsp_downmix_s16(buf, buf, 21, 2);
+    for (int k = 0; k < 21; k ++)
+        assert(buf[k] == -502);
+
+    int16_t tri[3 * 3] = { 3, 6, 9,  -1, -1, -2,  INT16_MAX, INT16_MAX, INT16_MAX };
+    int16_t mono[3];
+    audio_dsp_downmix_s16(tri, mono, 3, 3);
+    assert(mono[0] == 6);
+    assert(mono[1] == -2);
+    assert(mono[2] == INT16_MAX);
+}
+
+// resamples a sine and checks frequency is preserved
+static
+void
+test_resampler(audio_resampler_quality quality, unsigned int in_rate, unsigned int out_rate)
+{
+    printf("resampler, quality %d, %u -> %u\n", quality, in_rate, out_rate);
+    const size_t in_len = in_rate / 5;  // 200 ms
+    const double freq = 1000.0;
+    audio_resampler *rs = audio_resampler_new(in_rate, out_rate, 2, quality);
+    assert(rs);
+
+    float *in_l = malloc(in_len * sizeof(float));
+    float *in_r = malloc(in_len * sizeof(float));
+    for (size_t k = 0; k < in_len; k ++) {
+        in_l[k] = 0.5 * sin(2 * M_PI * freq * k / in_rate);
+        in_r[k] = -in_l[k];
+    }
+
+    const size_t max_out = audio_resampler_max_output_frames(rs, in_len);
+    float *out_l = calloc(max_out, sizeof(float));
+    float *out_r = calloc(max_out, sizeof(float));
+
+    // feed input in uneven pieces
+    size_t produced = 0;
+    size_t ofs = 0;
+    while (ofs < in_len) {
+        const size_t chunk = MIN(in_len - ofs, 441);
+        const float *in[2] = {in_l + ofs, in_r + ofs};
+        float *out[2] = {out_l + produced, out_r + produced};
+
+        assert(produced + audio_resampler_max_output_frames(rs, chunk) <= max_out + 2 * 441);
+        produced += audio_resampler_process(rs, in, chunk, out);
+        ofs += chunk;
+    }
+
+    const double expected = (double)in_len * out_rate / in_rate;
+    assert(fabs(produced - expected) <= 2);
+
+    // skip filter delay, then compare with ideal sine allowing for the delay
+    const size_t first = 100;
+    const size_t last = MIN(produced, first + 1000);
+    double best = 1e9;
+    for (int shift = -30 * 16; shift <= 30 * 16; shift ++) {
+        double max_err = 0;
+        for (size_t k = first; k < last; k ++) {
+            const double t = ((double)k - shift / 16.0) / out_rate;
+            max_err = MAX(max_err, fabs(out_l[k] - 0.5 * sin(2 * M_PI * freq * t)));
+        }
+        best = MIN(best, max_err);
+    }
+    for (size_t k = 0; k < produced; k ++)
+        assert(out_l[k] == -out_r[k]);
+    assert(best < 0.02);
+
+    free(in_l);
+    free(in_r);
+    free(out_l);
+    free(out_r);
+    audio_resampler_free(rs);
+}
+
+int
+main(void)
+{
+    test_conversion();
+    test_gain_and_mix();
+    test_downmix();
+    test_resampler(AUDIO_RESAMPLER_LINEAR, 44100, 48000);
+    test_resampler(AUDIO_RESAMPLER_LINEAR, 48000, 22050);
+    test_resampler(AUDIO_RESAMPLER_POLYPHASE, 44100, 48000);
+    test_resampler(AUDIO_RESAMPLER_POLYPHASE, 48000, 44100);
+    test_resampler(AUDIO_RESAMPLER_POLYPHASE, 16000, 48000);
+
+    // ratio is too complex for polyphase filter
+    assert(audio_resampler_new(44100, 47999, 1, AUDIO_RESAMPLER_POLYPHASE) == NULL);
+
+    printf("pass\n");
+    return 0;
+}
@@ -0,0 +1,123 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <src/audio_thread.c>
+
+#define SAMPLE_RATE     48000
+#define FRAME_SIZE      (2 * sizeof(int16_t))
+
+static
+void
+test_init(void)
+{
+    printf("initialization\n");
+    audio_latency_controller lc;
+
+    audio_latency_controller_init(&lc, 1000, 10000, 100, 5);
+    assert(lc.target == 1000);
+
+    // minimum is never below a single step, maximum is never below minimum
+    audio_latency_controller_init(&lc, 10, 50, 100, 5);
+    assert(lc.min == 100);
+    assert(lc.max == 100);
+    assert(lc.target == 100);
+}
+
+static
+void
+test_underrun_growth(void)
+{
+    printf("growth after underruns\n");
+    audio_latency_controller lc;
+
+    audio_latency_controller_init(&lc, 1000, 10000, 100, 5);
+
+    // grows by a half of current target
+    assert(audio_latency_controller_underrun(&lc) == 1500);
+    assert(audio_latency_controller_underrun(&lc) == 2250);
+
+    // but at least by a step
+    audio_latency_controller_init(&lc, 100, 10000, 100, 5);
+    assert(audio_latency_controller_underrun(&lc) == 200);
+
+    // and never above maximum
+    for (int k = 0; k < 20; k ++)
+        audio_latency_controller_underrun(&lc);
+    assert(lc.target == 10000);
+}
+
+static
+void
+test_shrink(void)
+{
+    printf("shrinking without underruns\n");
+    audio_latency_controller lc;
+
+    audio_latency_controller_init(&lc, 1000, 10000, 100, 5);
+    audio_latency_controller_underrun(&lc);
+    assert(lc.target == 1500);
+
+    // target stays until shrink_after quiet ticks pass
+    for (int k = 0; k < 4; k ++)
+        assert(audio_latency_controller_tick(&lc) == 1500);
+    assert(audio_latency_controller_tick(&lc) == 1400);
+
+    // underrun restarts counting
+    for (int k = 0; k < 4; k ++)
+        audio_latency_controller_tick(&lc);
+    audio_latency_controller_underrun(&lc);
+    assert(lc.target == 2100);
+    for (int k = 0; k < 4; k ++)
+        assert(audio_latency_controller_tick(&lc) == 2100);
+    assert(audio_latency_controller_tick(&lc) == 2000);
+
+    // shrinks down to minimum, but not below it
+    for (int k = 0; k < 1000; k ++)
+        audio_latency_controller_tick(&lc);
+    assert(lc.target == 1000);
+
+    // minimum which isn't a multiple of step is reached exactly
+    audio_latency_controller_init(&lc, 1050, 10000, 100, 1);
+    audio_latency_controller_underrun(&lc);
+    for (int k = 0; k < 100; k ++)
+        audio_latency_controller_tick(&lc);
+    assert(lc.target == 1050);
+}
+
+static
+void
+test_config_limits(void)
+{
+    printf("limits from configuration\n");
+    audio_latency_controller lc;
+
+    // backends convert audio_buffer_min_ms and audio_buffer_max_ms into bytes
+    config.audio_buffer_min_ms = 20;
+    config.audio_buffer_max_ms = 200;
+    const size_t chunk = 480 * FRAME_SIZE;
+    const size_t min_fill = (size_t)SAMPLE_RATE * config.audio_buffer_min_ms / 1000 * FRAME_SIZE;
+    const size_t max_fill = (size_t)SAMPLE_RATE * config.audio_buffer_max_ms / 1000 * FRAME_SIZE;
+
+    audio_latency_controller_init(&lc, min_fill, max_fill, chunk, 10);
+    assert(lc.target == min_fill);
+
+    for (int k = 0; k < 100; k ++)
+        assert(audio_latency_controller_underrun(&lc) <= max_fill);
+    assert(lc.target == max_fill);
+
+    for (int k = 0; k < 100000; k ++)
+        assert(audio_latency_controller_tick(&lc) >= min_fill);
+    assert(lc.target == min_fill);
+}
+
+int
+main(void)
+{
+    test_init();
+    test_underrun_growth();
+    test_shrink();
+    test_config_limits();
+
+    printf("pass\n");
+    return 0;
+}
@@ -0,0 +1,132 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <src/audio_ringbuffer.c>
+
+#define STREAM_LENGTH   (4 * 1024 * 1024)
+
+static
+void
+test_basic(void)
+{
+    printf("basic operations\n");
+    audio_ringbuffer *rb = audio_ringbuffer_new(1000);
+    char buf[2048];
+
+    assert(rb);
+    assert(audio_ringbuffer_size(rb) == 1024);
+    assert(audio_ringbuffer_read_space(rb) == 0);
+    assert(audio_ringbuffer_write_space(rb) == 1024);
+
+    for (int k = 0; k < (int)sizeof(buf); k ++)
+        buf[k] = k;
+
+    assert(audio_ringbuffer_write(rb, buf, 700) == 700);
+    assert(audio_ringbuffer_read_space(rb) == 700);
+    assert(audio_ringbuffer_write(rb, buf + 700, 700) == 324);
+    assert(audio_ringbuffer_write_space(rb) == 0);
+
+    char out[2048];
+    assert(audio_ringbuffer_read(rb, out, 600) == 600);
+    assert(memcmp(out, buf, 600) == 0);
+
+    // wrap around
+    assert(audio_ringbuffer_write(rb, buf + 1024, 500) == 500);
+    assert(audio_ringbuffer_read(rb, out, 2048) == 924);
+    assert(memcmp(out, buf + 600, 924) == 0);
+    assert(audio_ringbuffer_read_space(rb) == 0);
+
+    audio_ringbuffer_free(rb);
+}
+
+static
+void
+test_regions(void)
+{
+    printf("contiguous regions\n");
+    audio_ringbuffer *rb = audio_ringbuffer_new(256);
+    char buf[256] = {};
+    size_t len;
+
+    audio_ringbuffer_write(rb, buf, 200);
+    audio_ringbuffer_read(rb, buf, 150);
+
+    // write pointer is at 200, so only 56 bytes are contiguous
+    void *p = audio_ringbuffer_get_write_ptr(rb, &len);
+    assert(len == 56);
+    memset(p, 7, len);
+    audio_ringbuffer_write_advance(rb, len);
+
+    p = audio_ringbuffer_get_write_ptr(rb, &len);
+    assert(len == 150);
+    assert((char *)p == (char *)audio_ringbuffer_get_read_ptr(rb, &len) - 150);
+    assert(len == 106);
+
+    audio_ringbuffer_free(rb);
+}
+
+static
+void *
+producer_thread(void *param)
+{
+    audio_ringbuffer *rb = param;
+    uint32_t value = 0;
+
+    while (value < STREAM_LENGTH / sizeof(value)) {
+        // odd batch size to exercise wrapping at different offsets
+        uint32_t values[37];
+        size_t   cnt = MIN(G_N_ELEMENTS(values), STREAM_LENGTH / sizeof(value) - value);
+
+        if (audio_ringbuffer_write_space(rb) < cnt * sizeof(values[0])) {
+            sched_yield();
+            continue;
+        }
+
+        for (size_t k = 0; k < cnt; k ++)
+            values[k] = value++;
+        assert(audio_ringbuffer_write(rb, values, cnt * sizeof(values[0])) ==
+               cnt * sizeof(values[0]));
+    }
+
+    return NULL;
+}
+
+static
+void
+test_threads(void)
+{
+    printf("producer and consumer threads\n");
+    audio_ringbuffer *rb = audio_ringbuffer_new(4096);
+    pthread_t t;
+    uint32_t expected = 0;
+
+    pthread_create(&t, NULL, producer_thread, rb);
+
+    while (expected < STREAM_LENGTH / sizeof(expected)) {
+        uint32_t values[64];
+        size_t rd = audio_ringbuffer_read(rb, values, sizeof(values));
+
+        if (rd == 0)
+            sched_yield();
+        assert(rd % sizeof(values[0]) == 0);
+        for (size_t k = 0; k < rd / sizeof(values[0]); k ++)
+            assert(values[k] == expected++);
+    }
+
+    pthread_join(t, NULL);
+    audio_ringbuffer_free(rb);
+}
+
+int
+main(void)
+{
+    test_basic();
+    test_regions();
+    test_threads();
+
+    printf("pass\n");
+    return 0;
+}
@@ -0,0 +1,211 @@
+#undef NDEBUG
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <src/video_dsp.c>
+
+static
+void
+test_known_colors(void)
+{
+    printf("known colors\n");
+    uint8_t y[2] = {16, 235};
+    uint8_t u[1] = {128};
+    uint8_t v[1] = {128};
+    uint8_t dst[8];
+
+    video_dsp_yuv420_to_rgba(y, 2, u, 1, v, 1, dst, 8, 2, 1, 0);
+    assert(dst[0] == 0 && dst[1] == 0 && dst[2] == 0 && dst[3] == 255);
+    assert(dst[4] == 255 && dst[5] == 255 && dst[6] == 255 && dst[7] == 255);
+
+    // pure red in limited range
+    y[0] = y[1] = 81;
+    u[0] = 90;
+    v[0] = 240;
+    video_dsp_yuv420_to_rgba(y, 2, u, 1, v, 1, dst, 8, 2, 1, 0);
+    assert(dst[0] >= 254 && dst[1] <= 1 && dst[2] <= 1);
+
+    y[0] = 0;
+    y[1] = 255;
+    u[0] = v[0] = 128;
+    video_dsp_yuv420_to_rgba(y, 2, u, 1, v, 1, dst, 8, 2, 1, 1);
+    assert(dst[0] == 0 && dst[4] == 255 && dst[6] == 255);
+}
+
+static
+void
+test_against_reference(void)
+{
+    printf("reference comparison\n");
+    // odd dimensions exercise both vector and tail code
+    const unsigned int width = 77;
+    const unsigned int height = 5;
+    const unsigned int cw = (width + 1) / 2;
+    const unsigned int ch = (height + 1) / 2;
+    uint8_t *y = malloc(width * height);
+    uint8_t *u = malloc(cw * ch);
+    uint8_t *v = malloc(cw * ch);
+    uint8_t *dst = malloc(width * height * 4);
+    uint8_t *row = malloc(width * 4);
+
+    srand(1);
+    for (unsigned int k = 0; k < width * height; k ++)
+        y[k] = rand() % 256;
+    for (unsigned int k = 0; k < cw * ch; k ++) {
+        u[k] = rand() % 256;
+        v[k] = rand() % 256;
+    }
+
+    for (int full_range = 0; full_range <= 1; full_range ++) {
+        const struct yuv_coefs_s *c = full_range ? &coefs_full : &coefs_limited;
+
+        video_dsp_yuv420_to_rgba(y, width, u, cw, v, cw, dst, width * 4, width, height,
+                                 full_range);
+
+        for (unsigned int r = 0; r < height; r ++) {
+            // vectorized code should give the same results as scalar one
+            convert_row_scalar(c, y + r * width, u + (r / 2) * cw, v + (r / 2) * cw, row, 0,
+                               width);
+            assert(memcmp(row, dst + r * width * 4, width * 4) == 0);
+
+            // and both should be close to floating point computation
+            for (unsigned int x = 0; x < width; x ++) {
+                const double yy = (y[r * width + x] - c->y_offset) * c->y / 8192.0;
+                const double uu = u[(r / 2) * cw + x / 2] - 128;
+                const double vv = v[(r / 2) * cw + x / 2] - 128;
+                const double rgb[3] = {
+                    yy + vv * c->rv / 8192.0,
+                    yy - uu * c->gu / 8192.0 - vv * c->gv / 8192.0,
+                    yy + uu * c->bu / 8192.0,
+                };
+
+                for (int k = 0; k < 3; k ++) {
+                    double expected = CLAMP(rgb[k], 0.0, 255.0);
+                    assert(fabs(dst[(r * width + x) * 4 + k] - expected) < 1.5);
+                }
+                assert(dst[(r * width + x) * 4 + 3] == 255);
+            }
+        }
+    }
+
+    free(y);
+    free(u);
+    free(v);
+    free(dst);
+    free(row);
+}
+
+static
+void
+test_capture_formats(void)
+{
+    printf("capture formats\n");
+    // odd height, and width which isn't a multiple of vector size
+    const unsigned int width = 38;
+    const unsigned int height = 5;
+    const unsigned int cw = width / 2;
+    const unsigned int ch = (height + 1) / 2;
+    uint8_t *yuyv = malloc(width * 2 * height);
+    uint8_t *nv12 = malloc(width * height + cw * 2 * ch);
+    uint8_t *u422 = malloc(cw * height);
+    uint8_t *v422 = malloc(cw * height);
+    uint8_t *out1 = malloc(width * height + 2 * cw * ch);
+    uint8_t *out2 = malloc(width * height + 2 * cw * ch);
+
+    srand(2);
+    for (unsigned int k = 0; k < width * 2 * height; k ++)
+        yuyv[k] = rand() % 256;
+
+    // same picture as NV12 and as planar 4:2:2
+    for (unsigned int r = 0; r < height; r ++) {
+        for (unsigned int x = 0; x < width; x ++)
+            nv12[r * width + x] = yuyv[r * width * 2 + x * 2];
+        for (unsigned int x = 0; x < cw; x ++) {
+            u422[r * cw + x] = yuyv[r * width * 2 + x * 4 + 1];
+            v422[r * cw + x] = yuyv[r * width * 2 + x * 4 + 3];
+        }
+    }
+    for (unsigned int r = 0; r < ch; r ++) {
+        const unsigned int r1 = MIN(2 * r + 1, height - 1);
+        for (unsigned int x = 0; x < cw; x ++) {
+            nv12[width * height + r * cw * 2 + 2 * x] =
+                (u422[2 * r * cw + x] + u422[r1 * cw + x] + 1) / 2;
+            nv12[width * height + r * cw * 2 + 2 * x + 1] =
+                (v422[2 * r * cw + x] + v422[r1 * cw + x] + 1) / 2;
+        }
+    }
+
+    const size_t out_size = width * height + 2 * cw * ch;
+
+    video_dsp_yuyv_to_i420(yuyv, width * 2, out1, width, height);
+    video_dsp_nv12_to_i420(nv12, width, nv12 + width * height, cw * 2, out2, width, height);
+    assert(memcmp(out1, out2, out_size) == 0);
+
+    video_dsp_planar_to_i420(nv12, width, u422, cw, v422, cw, out2, width, height, 1);
+    assert(memcmp(out1, out2, out_size) == 0);
+
+    // 4:2:0 is a plain copy
+    memset(out1, 0, out_size);
+    video_dsp_planar_to_i420(out2, width, out2 + width * height, cw,
+                             out2 + width * height + cw * ch, cw, out1, width, height, 0);
+    assert(memcmp(out1, out2, out_size) == 0);
+
+    // check a sample by hand
+    assert(out1[width + 3] == yuyv[width * 2 + 6]);
+    assert(out1[width * height + cw * ch + 1] == (yuyv[7] + yuyv[width * 2 + 7] + 1) / 2);
+
+    free(yuyv);
+    free(nv12);
+    free(u422);
+    free(v422);
+    free(out1);
+    free(out2);
+}
+
+static
+void
+test_throughput(void)
+{
+    printf("throughput\n");
+    const unsigned int width = 1280;
+    const unsigned int height = 720;
+    const int iterations = 50;
+    uint8_t *y = calloc(width * height * 3 / 2, 1);
+    uint8_t *uv = calloc(width * height / 4, 1);
+    uint8_t *dst = malloc(width * height * 4);
+
+    gint64 start = g_get_monotonic_time();
+    for (int k = 0; k < iterations; k ++) {
+        video_dsp_yuv420_to_rgba(y, width, uv, width / 2, uv, width / 2, dst, width * 4, width,
+                                 height, 0);
+    }
+    gint64 elapsed = MAX(g_get_monotonic_time() - start, 1);
+
+    printf("  %ux%u, YUV to RGBA, %.1f frames per second\n", width, height,
+           iterations * 1e6 / elapsed);
+
+    start = g_get_monotonic_time();
+    for (int k = 0; k < iterations; k ++)
+        video_dsp_yuyv_to_i420(dst, width * 2, y, width, height);
+    elapsed = MAX(g_get_monotonic_time() - start, 1);
+
+    printf("  %ux%u, YUYV to I420, %.1f frames per second\n", width, height,
+           iterations * 1e6 / elapsed);
+
+    free(y);
+    free(uv);
+    free(dst);
+}
+
+int
+main(void)
+{
+    test_known_colors();
+    test_against_reference();
+    test_capture_formats();
+    test_throughput();
+    printf("pass\n");
+    return 0;
+}
@@ -0,0 +1,80 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <glib.h>
+#include <pthread.h>
+#include <src/worker_pool.c>
+
+#define TASK_COUNT      10000
+#define SUBTASK_COUNT   8
+
+static volatile gint    done_count = 0;
+static pthread_mutex_t  done_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   done_cond = PTHREAD_COND_INITIALIZER;
+
+static
+void
+wait_for(int count)
+{
+    pthread_mutex_lock(&done_lock);
+    while (g_atomic_int_get(&done_count) < count)
+        pthread_cond_wait(&done_cond, &done_lock);
+    pthread_mutex_unlock(&done_lock);
+}
+
+static
+void
+simple_task(void *user_data)
+{
+    pthread_mutex_lock(&done_lock);
+    g_atomic_int_inc(&done_count);
+    pthread_cond_broadcast(&done_cond);
+    pthread_mutex_unlock(&done_lock);
+}
+
+static
+void
+spawning_task(void *user_data)
+{
+    // tasks spawned from a pool thread land in its own queue and get stolen by others
+    for (int k = 0; k < SUBTASK_COUNT; k ++)
+        worker_pool_run(simple_task, NULL);
+    simple_task(NULL);
+}
+
+static
+void
+test_simple_tasks(void)
+{
+    printf("simple tasks\n");
+    g_atomic_int_set(&done_count, 0);
+    for (int k = 0; k < TASK_COUNT; k ++)
+        worker_pool_run(simple_task, NULL);
+    wait_for(TASK_COUNT);
+    assert(g_atomic_int_get(&done_count) == TASK_COUNT);
+}
+
+static
+void
+test_nested_tasks(void)
+{
+    printf("nested tasks\n");
+    g_atomic_int_set(&done_count, 0);
+    for (int k = 0; k < TASK_COUNT / SUBTASK_COUNT; k ++)
+        worker_pool_run(spawning_task, NULL);
+    wait_for(TASK_COUNT / SUBTASK_COUNT * (SUBTASK_COUNT + 1));
+    assert(g_atomic_int_get(&done_count) == TASK_COUNT / SUBTASK_COUNT * (SUBTASK_COUNT + 1));
+}
+
+int
+main(void)
+{
+    printf("thread count = %u\n", worker_pool_get_thread_count());
+    assert(worker_pool_get_thread_count() >= MIN_THREAD_COUNT);
+
+    test_simple_tasks();
+    test_nested_tasks();
+
+    printf("pass\n");
+    return 0;
+}